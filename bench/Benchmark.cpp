@@ -0,0 +1,444 @@
+/*
+	shmft_bench: runs the server and the client in one process and sweeps
+	file size x file count x frame size x thread count. Every scenario reports
+	throughput, files/s, ring handoff latency percentiles and CPU time per GB.
+
+	Usage:
+		shmft_bench [--file-sizes=1K,1M,...] [--file-counts=1,100,...]
+					[--frame-sizes=64K,...] [--thread-counts=1,4,...]
+					[--max-scenario-bytes=<bytes>] [--work-dir=<path>] [--output=<file.json>]
+					[--payload=random|text]
+					[any SharedMemoryFileTransfer option, e.g. --segment-size=512M]
+		shmft_bench --checksum-only [--output=<file.json>]
+
+	--payload=text fills the inputs with log-like lines instead of random bytes (see --compression).
+	The inputs and the received files live in a private directory created under --work-dir
+	and removed at the end, so nothing else in --work-dir is touched.
+	--checksum-only compares the frame checksum throughput with memcpy over the same buffer.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <boost/thread.hpp>
+
+#include "SharedMemoryConsts.h"
+#include "SharedMemoryConfig.h"
+#include "SharedMemoryServer.h"
+#include "SharedMemoryClient.h"
+#include "SharedMemoryMetrics.h"
+#include "Crc32c.h"
+#include "Logger.h"
+
+namespace
+{
+	const char* INPUT_FILE_PREFIX = "in_";
+	const char* RUN_DIRECTORY_TEMPLATE = "/shmft_bench.XXXXXX";
+	const uint64_t RECEIVE_TIMEOUT_MICROSECONDS = 600 * 1000000ull;
+	const size_t CHECKSUM_BUFFER_SIZE = 64 * 1024 * 1024;
+	const uint32_t CHECKSUM_ITERATIONS = 16;
+
+	struct BenchmarkScenario
+	{
+		uint64_t _fileSize = 0;
+		uint32_t _fileCount = 0;
+		uint32_t _frameSize = 0;
+		uint32_t _threadCount = 0;
+	};
+
+	struct BenchmarkResult
+	{
+		BenchmarkScenario _scenario;
+		double _seconds = 0;
+		double _cpuSeconds = 0;
+		uint32_t _receivedFileCount = 0;
+		uint32_t _failedFileCount = 0;
+		uint64_t _handoffP50Nanoseconds = 0;
+		uint64_t _handoffP99Nanoseconds = 0;
+	};
+
+	bool ParseSize(const std::string& value, uint64_t& size)
+	{
+		char* end = nullptr;
+		unsigned long long number = std::strtoull(value.c_str(), &end, 10);
+		if(end == value.c_str())
+			return false;
+
+		switch(*end)
+		{
+			case 'G': case 'g': number *= 1024;	//	fallthrough
+			case 'M': case 'm': number *= 1024;	//	fallthrough
+			case 'K': case 'k': number *= 1024; ++end; break;
+			default: break;
+		}
+
+		size = number;
+		return *end == '\0';
+	}
+
+	bool ParseSizeList(const std::string& value, std::vector<uint64_t>& sizes)
+	{
+		sizes.clear();
+		std::string::size_type begin = 0;
+		while(begin <= value.size())
+		{
+			std::string::size_type end = value.find(',', begin);
+			if(end == std::string::npos)
+				end = value.size();
+
+			uint64_t size = 0;
+			if(!ParseSize(value.substr(begin, end - begin), size))
+				return false;
+			sizes.push_back(size);
+			begin = end + 1;
+		}
+		return !sizes.empty();
+	}
+
+	double GetCpuSeconds()
+	{
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+				+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+	}
+
+	//	Inputs are shared by all the frame size and thread count variants of a (size, count) pair.
+	bool GenerateInputFiles(uint64_t fileSize, uint32_t fileCount, bool isTextPayload, std::vector<std::string>& filePaths)
+	{
+		std::vector<uint64_t> buffer(1024 * 1024 / sizeof(uint64_t));
+		uint64_t state = 0x9E3779B97F4A7C15ull;
+		for(uint64_t& word : buffer)
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			word = state;
+		}
+
+		if(isTextPayload)
+		{
+			std::string text;
+			const size_t bufferBytes = buffer.size() * sizeof(uint64_t);
+			for(size_t i = 0; text.size() < bufferBytes; ++i)
+			{
+				char line[128];
+				const uint64_t word = buffer[i % buffer.size()];
+				std::snprintf(line, sizeof(line), "2026-01-01 12:%02u:%02u.%03u [worker-%u] INFO request id=%08x status=%u bytes=%u\n",
+							static_cast<unsigned>(i / 60000 % 60), static_cast<unsigned>(i / 1000 % 60), static_cast<unsigned>(i % 1000),
+							static_cast<unsigned>(word % 16), static_cast<unsigned>(word >> 32), word & 0x100 ? 404u : 200u,
+							static_cast<unsigned>(word >> 8 & 0xFFFF));
+				text += line;
+			}
+			memcpy(buffer.data(), text.data(), bufferBytes);
+		}
+
+		filePaths.clear();
+		for(uint32_t i = 0; i < fileCount; ++i)
+		{
+			std::string filePath = INPUT_FILE_PREFIX + std::to_string(i);
+			FILE* file = std::fopen(filePath.c_str(), "wb");
+			if(!file)
+				return false;
+
+			for(uint64_t written = 0; written < fileSize;)
+			{
+				size_t countBytes = static_cast<size_t>(std::min<uint64_t>(fileSize - written, buffer.size() * sizeof(uint64_t)));
+				buffer[0] = i ^ written;		//	keep every file and block distinct
+				if(std::fwrite(buffer.data(), 1, countBytes, file) != countBytes)
+				{
+					std::fclose(file);
+					return false;
+				}
+				written += countBytes;
+			}
+			std::fclose(file);
+			filePaths.push_back(filePath);
+		}
+		return true;
+	}
+
+	//	runs in the private directory of the bench, see main()
+	void RemoveFiles(bool isInputRemoved)
+	{
+		DIR* directory = opendir(".");
+		if(!directory)
+			return;
+
+		while(dirent* entry = readdir(directory))
+		{
+			std::string name = entry->d_name;
+			if(name == "." || name == "..")
+				continue;
+			if(isInputRemoved || name.compare(0, std::strlen(INPUT_FILE_PREFIX), INPUT_FILE_PREFIX) != 0)
+				unlink(name.c_str());
+		}
+		closedir(directory);
+	}
+
+	BenchmarkResult RunScenario(const SharedMemoryConfig& baseConfig, const BenchmarkScenario& scenario,
+								const std::vector<std::string>& filePaths)
+	{
+		SharedMemoryConfig config = baseConfig;
+		config._frameSize = scenario._frameSize;
+		config._threadCount = scenario._threadCount;
+
+		BenchmarkResult result;
+		result._scenario = scenario;
+
+		SharedMemoryServer server(config);
+		server.Start();
+
+		double cpuSecondsStart = GetCpuSeconds();
+		uint64_t microtimeStart = getMicrotime();
+		{
+			SharedMemoryClient client(config);
+			client.TransferFiles(filePaths);
+			client.WaitForCompletion();
+		}
+		while(server.GetReceivedFileCount() + server.GetFailedFileCount() < scenario._fileCount
+				&& getMicrotime() - microtimeStart < RECEIVE_TIMEOUT_MICROSECONDS)
+		{
+			boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+		}
+		result._seconds = (getMicrotime() - microtimeStart) / 1e6;
+		result._cpuSeconds = GetCpuSeconds() - cpuSecondsStart;
+
+		server.Stop();
+		result._receivedFileCount = static_cast<uint32_t>(server.GetReceivedFileCount());
+		result._failedFileCount = static_cast<uint32_t>(server.GetFailedFileCount());
+		if(const SharedMemoryMetrics* metrics = server.GetMetrics())
+		{
+			result._handoffP50Nanoseconds = metrics->_handoffLatencyHistogram.GetPercentile(50.0);
+			result._handoffP99Nanoseconds = metrics->_handoffLatencyHistogram.GetPercentile(99.0);
+		}
+		return result;
+	}
+
+	//	Bytes per second of `pass` run CHECKSUM_ITERATIONS times over a CHECKSUM_BUFFER_SIZE buffer
+	template<typename Pass>
+	double MeasureBytesPerSecond(Pass pass)
+	{
+		pass();		//	warm up the caches and the page tables
+		uint64_t microtimeStart = getMicrotime();
+		for(uint32_t i = 0; i < CHECKSUM_ITERATIONS; ++i)
+			pass();
+		uint64_t microseconds = std::max<uint64_t>(getMicrotime() - microtimeStart, 1);
+		return static_cast<double>(CHECKSUM_BUFFER_SIZE) * CHECKSUM_ITERATIONS * 1e6 / microseconds;
+	}
+
+	int RunChecksumBenchmark(const std::string& outputPath)
+	{
+		std::vector<uint8_t> source(CHECKSUM_BUFFER_SIZE);
+		std::vector<uint8_t> destination(CHECKSUM_BUFFER_SIZE);
+		for(size_t i = 0; i < source.size(); ++i)
+			source[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+
+		volatile uint32_t checksum = 0;
+		double memcpyRate = MeasureBytesPerSecond([&]() { memcpy(destination.data(), source.data(), source.size()); });
+		double crcRate = MeasureBytesPerSecond([&]() { checksum = Crc32c::Update(0, source.data(), source.size()); });
+		double portableRate = MeasureBytesPerSecond([&]() { checksum = Crc32c::UpdatePortable(0, source.data(), source.size()); });
+
+		const double GIGABYTE = 1024.0 * 1024.0 * 1024.0;
+		std::fprintf(stderr, "memcpy: %.2f GB/s, crc32c (%s): %.2f GB/s, crc32c portable: %.2f GB/s\n",
+					memcpyRate / GIGABYTE, Crc32c::IsHardwareAccelerated() ? "hardware" : "portable",
+					crcRate / GIGABYTE, portableRate / GIGABYTE);
+
+		FILE* output = std::fopen(outputPath.c_str(), "w");
+		if(!output)
+		{
+			std::fprintf(stderr, "Can't write the results: %s\n", outputPath.c_str());
+			return EXIT_FAILURE;
+		}
+		std::fprintf(output,
+			"{\"buffer_size\": %llu, \"memcpy_gb_per_second\": %.3f, \"crc32c_gb_per_second\": %.3f, "
+			"\"crc32c_portable_gb_per_second\": %.3f, \"crc32c_hardware\": %s}\n",
+			static_cast<unsigned long long>(CHECKSUM_BUFFER_SIZE), memcpyRate / GIGABYTE, crcRate / GIGABYTE,
+			portableRate / GIGABYTE, Crc32c::IsHardwareAccelerated() ? "true" : "false");
+		std::fclose(output);
+		return EXIT_SUCCESS;
+	}
+
+	void WriteResults(FILE* output, const std::vector<BenchmarkResult>& results)
+	{
+		std::fprintf(output, "[\n");
+		for(size_t i = 0; i < results.size(); ++i)
+		{
+			const BenchmarkResult& result = results[i];
+			const BenchmarkScenario& scenario = result._scenario;
+			double totalBytes = static_cast<double>(scenario._fileSize) * scenario._fileCount;
+			double totalGigabytes = totalBytes / (1024.0 * 1024.0 * 1024.0);
+			std::fprintf(output,
+				"\t{\"file_size\": %llu, \"file_count\": %u, \"frame_size\": %u, \"threads\": %u, "
+				"\"received\": %u, \"failed\": %u, \"seconds\": %.6f, \"mb_per_second\": %.2f, "
+				"\"files_per_second\": %.2f, \"handoff_p50_ns\": %llu, \"handoff_p99_ns\": %llu, "
+				"\"cpu_seconds_per_gb\": %.3f}%s\n",
+				static_cast<unsigned long long>(scenario._fileSize), scenario._fileCount, scenario._frameSize, scenario._threadCount,
+				result._receivedFileCount, result._failedFileCount, result._seconds,
+				result._seconds > 0 ? totalBytes / (1024.0 * 1024.0) / result._seconds : 0.0,
+				result._seconds > 0 ? scenario._fileCount / result._seconds : 0.0,
+				static_cast<unsigned long long>(result._handoffP50Nanoseconds),
+				static_cast<unsigned long long>(result._handoffP99Nanoseconds),
+				totalGigabytes > 0 ? result._cpuSeconds / totalGigabytes : 0.0,
+				i + 1 < results.size() ? "," : "");
+		}
+		std::fprintf(output, "]\n");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<uint64_t> fileSizes = {1024, 64 * 1024, 1024 * 1024, 64 * 1024 * 1024, 1024 * 1024 * 1024};
+	std::vector<uint64_t> fileCounts = {1, 100, 1000};
+	std::vector<uint64_t> frameSizes = {DEFAULT_DATA_FRAME_SIZE, 1024 * 1024};
+	std::vector<uint64_t> threadCounts = {1, ThreadPool::GetDefaultThreadCount()};
+	uint64_t maxScenarioBytes = 2ull * 1024 * 1024 * 1024;
+	std::string workDirectory = "/tmp/shmft_bench";
+	std::string outputPath = "shmft_bench.json";
+	bool isChecksumOnly = false;
+	bool isTextPayload = false;
+	SharedMemoryConfig config;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		std::string option = argv[i];
+		std::string::size_type separator = option.find('=');
+		std::string key = option.substr(0, separator);
+		std::string value = separator == std::string::npos ? std::string() : option.substr(separator + 1);
+
+		bool isParsed = true;
+		if(key == "--file-sizes")
+			isParsed = ParseSizeList(value, fileSizes);
+		else if(key == "--file-counts")
+			isParsed = ParseSizeList(value, fileCounts);
+		else if(key == "--frame-sizes")
+			isParsed = ParseSizeList(value, frameSizes);
+		else if(key == "--thread-counts")
+			isParsed = ParseSizeList(value, threadCounts);
+		else if(key == "--max-scenario-bytes")
+			isParsed = ParseSize(value, maxScenarioBytes);
+		else if(key == "--work-dir")
+			workDirectory = value;
+		else if(key == "--output")
+			outputPath = value;
+		else if(key == "--checksum-only")
+			isChecksumOnly = true;
+		else if(key == "--payload" && (value == "random" || value == "text"))
+			isTextPayload = value == "text";
+		else
+			isParsed = config.ParseOption(option);
+
+		if(!isParsed)
+		{
+			std::fprintf(stderr, "Invalid option: %s\n", option.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	char currentDirectory[PATH_MAX] = {0};
+	if(getcwd(currentDirectory, sizeof(currentDirectory)))
+	{
+		if(outputPath[0] != '/')
+			outputPath = std::string(currentDirectory) + "/" + outputPath;
+		if(!workDirectory.empty() && workDirectory[0] != '/')
+			workDirectory = std::string(currentDirectory) + "/" + workDirectory;
+	}
+
+	if(isChecksumOnly)
+		return RunChecksumBenchmark(outputPath);
+
+	//	every frame size of the sweep has to make a valid server, like the options of SharedMemoryFileTransfer
+	for(uint64_t frameSize : frameSizes)
+	{
+		SharedMemoryConfig scenarioConfig = config;
+		scenarioConfig._frameSize = static_cast<uint32_t>(std::min<uint64_t>(frameSize, UINT32_MAX));
+		if(frameSize > UINT32_MAX || !scenarioConfig.IsValid())
+		{
+			std::fprintf(stderr, "Invalid configuration for the frame size %llu\n", static_cast<unsigned long long>(frameSize));
+			return EXIT_FAILURE;
+		}
+	}
+
+	//	the files are generated and received in a directory of our own: --work-dir may be anything, even $HOME
+	mkdir(workDirectory.c_str(), 0755);
+	std::string runDirectory = workDirectory + RUN_DIRECTORY_TEMPLATE;
+	if(!mkdtemp(&runDirectory[0]) || chdir(runDirectory.c_str()) != 0)
+	{
+		std::fprintf(stderr, "Can't create a run directory in the work directory: %s\n", workDirectory.c_str());
+		return EXIT_FAILURE;
+	}
+
+	//	Transfer traces go to stdout; keep them from skewing the numbers.
+	int stdoutDescriptor = dup(STDOUT_FILENO);
+	int nullDescriptor = open("/dev/null", O_WRONLY);
+
+	std::vector<BenchmarkResult> results;
+	for(uint64_t fileSize : fileSizes)
+	{
+		for(uint64_t fileCount : fileCounts)
+		{
+			if(fileSize * fileCount > maxScenarioBytes)
+				continue;
+
+			std::vector<std::string> filePaths;
+			RemoveFiles(true);
+			if(!GenerateInputFiles(fileSize, static_cast<uint32_t>(fileCount), isTextPayload, filePaths))
+			{
+				std::fprintf(stderr, "Can't generate %llu input files\n", static_cast<unsigned long long>(fileCount));
+				RemoveFiles(true);
+				rmdir(runDirectory.c_str());
+				return EXIT_FAILURE;
+			}
+
+			for(uint64_t frameSize : frameSizes)
+			{
+				for(uint64_t threadCount : threadCounts)
+				{
+					BenchmarkScenario scenario;
+					scenario._fileSize = fileSize;
+					scenario._fileCount = static_cast<uint32_t>(fileCount);
+					scenario._frameSize = static_cast<uint32_t>(frameSize);
+					scenario._threadCount = static_cast<uint32_t>(threadCount);
+
+					std::fflush(stdout);
+					dup2(nullDescriptor, STDOUT_FILENO);
+					results.push_back(RunScenario(config, scenario, filePaths));
+					Logger::GetInstance().Flush();
+					std::fflush(stdout);
+					dup2(stdoutDescriptor, STDOUT_FILENO);
+					RemoveFiles(false);
+
+					const BenchmarkResult& result = results.back();
+					std::fprintf(stderr, "size=%llu count=%u frame=%u threads=%u: %.3f s, %u received, %u failed\n",
+								static_cast<unsigned long long>(fileSize), scenario._fileCount, scenario._frameSize,
+								scenario._threadCount, result._seconds, result._receivedFileCount, result._failedFileCount);
+				}
+			}
+		}
+	}
+	RemoveFiles(true);
+	if(chdir(workDirectory.c_str()) != 0 || rmdir(runDirectory.c_str()) != 0)
+		std::fprintf(stderr, "Can't remove the run directory: %s\n", runDirectory.c_str());
+	close(nullDescriptor);
+	close(stdoutDescriptor);
+
+	FILE* output = std::fopen(outputPath.c_str(), "w");
+	if(!output)
+	{
+		std::fprintf(stderr, "Can't write the results: %s\n", outputPath.c_str());
+		return EXIT_FAILURE;
+	}
+	WriteResults(output, results);
+	std::fclose(output);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <boost/interprocess/offset_ptr.hpp>
+
+using namespace boost::interprocess;
+
+/*
+	Lock-free allocator of chunk indices living in the shared segment.
+	Every chunk owns one bit; a free bit is found with ctz over 64-bit words and claimed with a CAS,
+	so clients take and release chunks directly without a round trip to the server.
+*/
+struct ChunkBitmap
+{
+	static uint32_t GetWordCount(uint32_t bitCount);
+
+	void Attach(std::atomic<uint64_t>* words, uint32_t bitCount);
+	bool Acquire(uint32_t& index);
+	void Release(uint32_t index);
+
+	offset_ptr<std::atomic<uint64_t>> _words;
+	uint32_t _wordCount = 0;
+	uint32_t _bitCount = 0;
+	std::atomic<uint32_t> _searchHint = {0};
+};
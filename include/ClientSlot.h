@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "SharedMemoryConsts.h"
+#include "SubmissionQueue.h"
+#include "TransferOptions.h"
+
+enum class ClientSlotStatus : uint32_t
+{
+	FREE,
+	CLAIMED,					//	taken by a registering client, the descriptor is being filled
+	ACTIVE,
+	CLOSING,					//	the client is gone, the slot is freed once its last chunk is released
+};
+
+/*
+	Registration of a client process in the segment. Each client submits into a queue of its own
+	and is admitted chunks up to its share, which the server scheduler recomputes from the weights
+	of the clients that have chunks in flight or wait for one (and caps by the client's quota).
+	A client frees its slot on exit; the slot of a crashed one is reclaimed by the server once the
+	process is gone (clients have to share the server's pid namespace for that) and its chunks are released.
+	The pid counts as the client's only while the process holding it has the start time the client registered with.
+*/
+struct ClientSlot
+{
+	bool IsRegistered() const;
+	bool IsProcessAlive() const;
+	uint32_t GetChunkLimit() const;
+	uint32_t GetWaitingCount() const;
+
+	static uint64_t GetProcessStartTime(uint32_t processId);
+
+	//	descriptor, written by the client on registration
+	alignas(CACHE_LINE_SIZE) std::atomic<ClientSlotStatus> _status = {ClientSlotStatus::FREE};
+	uint32_t _processId = 0;
+	uint32_t _weight = DEFAULT_CLIENT_WEIGHT;
+	uint32_t _chunkQuota = 0;					//	0 means no limit besides the share
+	uint64_t _processStartTime = 0;				//	clock ticks after boot, tells a reused pid apart; 0 if unknown
+
+	//	server line
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _chunkShare = {0};
+
+	//	client line
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _busyChunkCount = {0};
+	std::atomic<uint32_t> _waitingCounts[TRANSFER_PRIORITY_COUNT] = {};	//	client threads waiting for a credit, per class
+
+	alignas(CACHE_LINE_SIZE) SubmissionQueue _submissionQueue;
+};
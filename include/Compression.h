@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class CompressionCodec : uint8_t
+{
+	NONE,
+	LZ4,
+	ZSTD,
+};
+
+/*
+	Frame codecs. LZ4 is always there: liblz4 is used when the build finds it, otherwise a bundled
+	implementation of the same block format (frames of either one decode with the other).
+	zstd needs libzstd at build time, IsAvailable() tells whether it's compiled in.
+	Compress() returns 0 when the output doesn't fit into the destination: the caller sizes the
+	destination to the smallest gain it cares about, so an incompressible frame is given up early.
+*/
+struct Compression
+{
+	static bool IsAvailable(CompressionCodec codec);
+	static bool Parse(const std::string& value, CompressionCodec& codec, int32_t& level);
+	static const char* GetName(CompressionCodec codec);
+	static size_t Compress(CompressionCodec codec, int32_t level, const uint8_t* source, size_t sourceBytes, uint8_t* destination, size_t destinationBytes);
+	static bool Decompress(CompressionCodec codec, const uint8_t* source, size_t sourceBytes, uint8_t* destination, size_t destinationBytes);
+};
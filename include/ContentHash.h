@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+	128-bit identity of a dedup block: two XXH64 digests of the data with independent seeds.
+	It's bundled rather than taken from libxxhash, so both sides of a transfer always agree on it.
+	Not a cryptographic hash: the server recomputes it before it stores a block a client sent.
+*/
+struct ContentHash
+{
+	static ContentHash Compute(const void* data, size_t countBytes);
+	bool operator==(const ContentHash& other) const;
+	bool operator!=(const ContentHash& other) const;
+	std::string ToString() const;
+
+	uint64_t _low = 0;
+	uint64_t _high = 0;
+};
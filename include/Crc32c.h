@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+	CRC32C (Castagnoli). The SSE4.2 (or ARMv8 CRC) instruction is used when the CPU has it:
+	three independent streams hide the instruction latency and are merged with precomputed
+	shift tables, which keeps the checksum close to memcpy speed. The portable path is slicing-by-8.
+	Update() continues a previous value, 0 starts a new checksum; Combine() appends the checksum of
+	a further nextBytes bytes to a checksum without touching the bytes themselves.
+*/
+struct Crc32c
+{
+	static uint32_t Update(uint32_t crc, const void* data, size_t countBytes);
+	static uint32_t UpdatePortable(uint32_t crc, const void* data, size_t countBytes);
+	static uint32_t Combine(uint32_t crc, uint32_t nextCrc, uint64_t nextBytes);
+	static bool IsHardwareAccelerated();
+};
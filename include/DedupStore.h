@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include "SharedMemoryConsts.h"
+#include "ContentHash.h"
+#include "FutexEvent.h"
+
+class ThreadPool;
+
+/*
+	Entry of the dedup index in the segment: a block the server holds. The server is the only writer,
+	an entry is published under a sequence lock (odd while it's updated); a zero length marks a free one.
+*/
+struct DedupIndexEntry
+{
+	std::atomic<uint32_t> _sequence = {0};
+	uint32_t _length = 0;
+	ContentHash _hash;
+};
+
+/*
+	View of the index array. A block lives in one of DEDUP_INDEX_PROBE_COUNT entries following
+	the one its hash points at, so a lookup never reads more than that and needs no tombstones.
+*/
+struct DedupIndex
+{
+	bool Contains(const ContentHash& hash, uint32_t length) const;
+	uint32_t GetEntryIndex(const ContentHash& hash, uint32_t probe) const;
+
+	DedupIndexEntry* _entries = nullptr;
+	uint32_t _entryCount = 0;
+};
+
+/*
+	Content-addressed block store of the server, a file per block named after its hash and CRC32C.
+	Clients look blocks up in the index and send a reference instead of the data, the server
+	copies (or reflinks) the stored block into the output file. A block that comes with its data
+	is handed to the worker pool, checked against its hash and stored there, off the transfer thread;
+	with DEDUP_PENDING_BLOCK_COUNT blocks waiting already it isn't kept. When every entry a block
+	may take is busy, the least recently used one is dropped from the index. Its file stays for
+	DEDUP_EVICTION_GRACE_SECONDS more, so a reference a client has sent already still resolves.
+	A block whose file can't be opened is dropped from the index as well.
+*/
+class DedupStore
+{
+public:
+	DedupStore(DedupIndexEntry* entries, uint32_t entryCount, const std::string& directory, ThreadPool& threadPool);
+	DedupStore(const DedupStore&) = delete;
+	DedupStore(DedupStore&) = delete;
+	DedupStore(DedupStore&&) = delete;
+	~DedupStore();
+
+public:
+	int Open(const ContentHash& hash, uint32_t length, uint32_t& checksum);
+	void Insert(const ContentHash& hash, std::vector<uint8_t>&& block);
+
+private:
+	struct StoredBlock
+	{
+		ContentHash _hash;
+		uint32_t _length = 0;
+		uint32_t _checksum = 0;
+		uint64_t _lastUseSeconds = 0;
+	};
+
+	void Load();
+	void Store(const ContentHash& hash, const uint8_t* data, uint32_t length);
+	void EndInsert();
+	std::string GetBlockPath(const StoredBlock& block) const;
+	void Publish(uint32_t entryIndex, const StoredBlock& block);
+	void RemoveEvictedBlocks(uint64_t nowSeconds);
+
+private:
+	DedupIndex _index;
+	std::string _directory;
+	boost::mutex _mutex;
+	std::vector<StoredBlock> _storedBlocks;		//	server side copy of the index, with what clients don't need
+	std::deque<StoredBlock> _evictedBlocks;		//	by eviction time, _lastUseSeconds is that time
+	ThreadPool& _threadPool;
+	std::atomic<uint32_t> _countPendingInserts = {0};
+	FutexEvent _insertsEvent;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <boost/thread.hpp>
+
+class OutputFile;
+struct SharedMemoryMetrics;
+
+/*
+	Single write of a sink buffer. The buffers are page aligned, so full ones qualify for direct I/O.
+*/
+struct DiskWrite
+{
+	uint8_t* _buffer = nullptr;
+	OutputFile* _file = nullptr;
+	uint64_t _offset = 0;
+	size_t _countBytes = 0;
+	size_t _writtenBytes = 0;
+	int _fileDescriptor = -1;
+	iovec _iovec;
+};
+
+/*
+	Write-behind queue of the server. Transfer threads copy the stream into sink buffers and give
+	the ring slots back at once, so a client never waits for the disk while a buffer is free;
+	when all of them are in flight the transfer thread blocks and the ring fills up as before.
+	Writes go through io_uring (raw syscalls, no liburing) with a single thread reaping the
+	completions; where the kernel or a seccomp profile refuses io_uring a thread drains the
+	queue with pwritev, merging writes that continue each other in one file.
+*/
+class DiskSink
+{
+public:
+	DiskSink(uint32_t bufferCount, uint32_t bufferSize, SharedMemoryMetrics* metrics);
+	DiskSink(const DiskSink&) = delete;
+	DiskSink(DiskSink&) = delete;
+	DiskSink(DiskSink&&) = delete;
+	~DiskSink();
+
+public:
+	const char* GetBackendName() const;
+	uint32_t GetBufferSize() const;
+	DiskWrite* AcquireWrite();
+	void Submit(DiskWrite* write, OutputFile& file, uint64_t offset, size_t countBytes);
+	void ReleaseWrite(DiskWrite* write);
+
+private:
+	bool SetupRing(uint32_t entryCount);
+	void TeardownRing();
+	void SubmitToRing(DiskWrite* write);
+	void CompletionThread();
+	void WriterThread();
+	bool ContinueWrite(DiskWrite* write, ssize_t result);
+	void CompleteWrite(DiskWrite* write, bool isWritten);
+
+private:
+	SharedMemoryMetrics* _metrics;
+	const uint32_t _bufferSize;
+	std::vector<DiskWrite> _writes;
+	boost::mutex _freeWritesMutex;
+	boost::condition_variable _cvWriteIsFree;
+	std::vector<DiskWrite*> _freeWrites;
+
+	//	io_uring
+	int _ringDescriptor = -1;
+	void* _submissionRing = nullptr;
+	size_t _submissionRingSize = 0;
+	void* _completionRing = nullptr;
+	size_t _completionRingSize = 0;
+	void* _submissionEntries = nullptr;
+	size_t _submissionEntriesSize = 0;
+	uint32_t _submissionMask = 0;
+	std::atomic<uint32_t>* _submissionHead = nullptr;
+	std::atomic<uint32_t>* _submissionTail = nullptr;
+	uint32_t* _submissionArray = nullptr;
+	uint32_t _completionMask = 0;
+	std::atomic<uint32_t>* _completionHead = nullptr;
+	std::atomic<uint32_t>* _completionTail = nullptr;
+	void* _completionEntries = nullptr;
+	boost::mutex _submissionMutex;
+
+	//	pwritev fallback
+	boost::mutex _queueMutex;
+	boost::condition_variable _cvWriteIsQueued;
+	std::deque<DiskWrite*> _queue;
+	bool _isStopping = false;
+
+	boost::thread _thread;
+};
+
+/*
+	Sequential writer of one stream into a file. The data is gathered into full sink buffers,
+	so the writes stay large and page aligned; Finish() sends the tail and waits for the file.
+	Without a sink, or for a stream shorter than a sink buffer (it would wait for its only write
+	anyway), every piece is written through at once. Skip() leaves a piece to whoever fills it
+	in by other means; the gathered data before it is sent on. Writev() of a written through
+	stream goes out as one system call.
+*/
+class FileSinkWriter
+{
+public:
+	FileSinkWriter(DiskSink* sink, OutputFile& file, uint64_t offset, uint64_t length);
+	FileSinkWriter(const FileSinkWriter&) = delete;
+	FileSinkWriter(FileSinkWriter&) = delete;
+	FileSinkWriter(FileSinkWriter&&) = delete;
+	~FileSinkWriter();
+
+public:
+	bool Write(const uint8_t* source, size_t countBytes);
+	bool Writev(const struct iovec* vectors, uint32_t vectorCount);
+	void Skip(uint64_t countBytes);
+	bool Finish();
+	uint64_t GetOffset() const;
+
+private:
+	void SubmitBuffer();
+
+private:
+	DiskSink* _sink;
+	OutputFile& _file;
+	uint64_t _offset;
+	uint64_t _bufferOffset;
+	DiskWrite* _write = nullptr;
+	size_t _bufferedBytes = 0;
+};
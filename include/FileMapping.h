@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <atomic>
+
+#include <sys/uio.h>
+
+#include "FutexEvent.h"
+
+/*
+	Read side of a transfer. The source file is mapped into the address space with a sequential
+	access hint, so a frame is filled by a single memcpy from the page cache straight into
+	the shared memory slot. Only regular files are accepted; if mapping fails the reads fall back to pread.
+	A source truncated while it's sent would raise SIGBUS in the copy: the copy is guarded, the fault
+	switches the file to pread, which comes up short at the new end, so the file fails, not the process.
+*/
+class InputFileMapping
+{
+public:
+	InputFileMapping(const std::string& filePath);
+	InputFileMapping(const InputFileMapping&) = delete;
+	InputFileMapping(InputFileMapping&) = delete;
+	InputFileMapping(InputFileMapping&&) = delete;
+	~InputFileMapping();
+
+public:
+	bool IsOpen() const;
+	uint64_t GetSize() const;
+	size_t Read(uint8_t* destination, uint64_t offset, size_t countBytes) const;
+
+private:
+	int _fileDescriptor = -1;
+	uint64_t _fileSize = 0;
+	const uint8_t* _mappedData = nullptr;
+	mutable std::atomic<bool> _isTruncated = {false};
+};
+
+/*
+	Write side of a transfer. Frames are written with pwrite straight from the shared memory slot,
+	without an intermediate stream buffer, or handed to the DiskSink, which accounts its writes
+	in flight here so the file is closed only once they're done. Several threads may write disjoint
+	ranges of one file. With direct I/O enabled page aligned writes bypass the page cache through
+	a second descriptor; the unaligned tail still goes through the regular one. Writev() puts
+	several pieces at consecutive offsets with a single pwritev.
+	A resumed file is opened as it is: it has to exist and keeps its content.
+	Copy() takes a range of another file: shared extents where the filesystem can clone them,
+	an in-kernel copy where it can't, a plain read and write otherwise.
+*/
+class OutputFile
+{
+public:
+	OutputFile(const std::string& filePath, bool isResumed = false);
+	OutputFile(const OutputFile&) = delete;
+	OutputFile(OutputFile&) = delete;
+	OutputFile(OutputFile&&) = delete;
+	~OutputFile();
+
+public:
+	bool IsGood() const;
+	void Preallocate(uint64_t fileSize);
+	bool EnableDirectIo();
+	void DisableDirectIo();
+	int GetDescriptor(const uint8_t* source, size_t countBytes, uint64_t offset) const;
+	bool Write(const uint8_t* source, size_t countBytes, uint64_t offset);
+	bool Writev(const struct iovec* vectors, uint32_t vectorCount, uint64_t offset);
+	bool Copy(int sourceFileDescriptor, size_t countBytes, uint64_t offset);
+	void BeginWrite();
+	void EndWrite(bool isWritten);
+	void WaitForWrites();
+	bool Sync();
+	void Close();
+
+private:
+	std::string _filePath;
+	int _fileDescriptor = -1;
+	int _directFileDescriptor = -1;
+	std::atomic<bool> _isGood = {false};
+	std::atomic<bool> _isDirectIo = {false};
+	std::atomic<uint32_t> _countPendingWrites = {0};
+	FutexEvent _writesEvent;
+};
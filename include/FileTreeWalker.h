@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <boost/thread.hpp>
+
+class ThreadPool;
+
+/*
+	File the client sends: the path it's read from and the name the server files it under.
+	A file given on its own is sent under its base name; a file found in a directory is sent
+	under its path relative to the parent of that directory, so the server recreates the tree.
+*/
+struct SourceFile
+{
+	std::string _path;
+	std::string _name;
+	struct stat _stat;
+	bool _isFound = false;
+};
+
+/*
+	Expands the arguments of the client: globs are matched (an existing file is taken literally even
+	if its name has glob characters), directories are walked in parallel on the worker pool, every
+	directory read with getdents64, its entries stated and its subdirectories opened relative to
+	its descriptor. The walk keeps its own pending directories and counts those being read, the
+	thread waiting for it reads them too, so it neither waits for unrelated pool tasks nor needs a
+	free worker and may run on the pool itself. Symbolic links to files are followed, those to
+	directories aren't (no cycles). The files of a tree are ordered by directory and inode,
+	which is close to their order on the disk.
+*/
+class FileTreeWalker
+{
+public:
+	FileTreeWalker(ThreadPool& threadPool);
+	FileTreeWalker(const FileTreeWalker&) = delete;
+	FileTreeWalker(FileTreeWalker&) = delete;
+	FileTreeWalker(FileTreeWalker&&) = delete;
+
+public:
+	std::vector<SourceFile> Walk(const std::vector<std::string>& paths);
+
+private:
+	struct PendingDirectory;
+	struct TreeWalk;
+
+	void AddPath(const std::string& path, std::vector<SourceFile>& sourceFiles);
+	void WalkTree(const std::string& path, std::vector<SourceFile>& sourceFiles);
+	static void WalkDirectories(const std::shared_ptr<TreeWalk>& treeWalk, bool isWaiting);
+	static void WalkDirectory(const std::shared_ptr<TreeWalk>& treeWalk, PendingDirectory& directory);
+
+private:
+	ThreadPool& _threadPool;
+};
+
+/*
+	Read-ahead of the files about to be sent. Workers report the index of the file they start on,
+	a thread of its own keeps the heads of the next files (PREFETCH_FILE_COUNT of them, PREFETCH_SIZE
+	bytes at most) coming into the page cache with POSIX_FADV_WILLNEED, so a tree of small files
+	doesn't stall on every open. The rest of a large file is left to the sequential hint of its mapping.
+*/
+class FilePrefetcher
+{
+public:
+	FilePrefetcher(const std::vector<SourceFile>& sourceFiles);
+	FilePrefetcher(const FilePrefetcher&) = delete;
+	FilePrefetcher(FilePrefetcher&) = delete;
+	FilePrefetcher(FilePrefetcher&&) = delete;
+	~FilePrefetcher();
+
+public:
+	void Advance(size_t fileIndex);
+
+private:
+	void PrefetchThread();
+
+private:
+	std::vector<std::string> _paths;			//	empty for files with nothing to prefetch
+	std::vector<uint64_t> _prefetchOffsets;		//	prefetched bytes before every file
+	boost::mutex _mutex;
+	boost::condition_variable _cvIsAdvanced;
+	size_t _transferIndex = 0;
+	bool _isStopping = false;
+	boost::thread _thread;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "SharedMemoryConsts.h"
+
+/*
+	Wakeup primitive living in the shared segment: a 32-bit sequence word waited on with the
+	Linux futex syscall (shared, not process private). Waiters spin for an adaptive number of
+	iterations before they go to sleep, so a busy peer is picked up without a syscall.
+
+	The notifier publishes its state first and calls Notify() afterwards; the syscall is
+	skipped when nobody sleeps on the word.
+*/
+struct FutexEvent
+{
+	template<typename Predicate>
+	bool Wait(Predicate isReady, uint32_t timeoutMilliseconds);
+	void Notify();
+
+	std::atomic<uint32_t> _sequence = {0};
+	std::atomic<uint32_t> _countWaiters = {0};
+	std::atomic<uint32_t> _spinLimit = {FUTEX_MIN_SPIN_COUNT};
+
+private:
+	static void Pause();
+	bool Sleep(uint32_t sequence, uint64_t deadlineNanoseconds);
+	void AdaptSpinLimit(bool isSpinSucceeded);
+};
+
+template<typename Predicate>
+bool FutexEvent::Wait(Predicate isReady, uint32_t timeoutMilliseconds)
+{
+	const uint32_t spinLimit = _spinLimit.load(std::memory_order_relaxed);
+	for(uint32_t i = 0; i < spinLimit; ++i)
+	{
+		if(isReady())
+		{
+			AdaptSpinLimit(true);
+			return true;
+		}
+		Pause();
+	}
+	AdaptSpinLimit(false);
+
+	const uint64_t deadlineNanoseconds = getMonotonicNanoseconds() + uint64_t(timeoutMilliseconds) * 1000000;
+	while(true)
+	{
+		//	the sequence is sampled before the last check: a notification in between changes it
+		//	and the futex call returns immediately
+		const uint32_t sequence = _sequence.load();
+		_countWaiters.fetch_add(1);
+		if(isReady())
+		{
+			_countWaiters.fetch_sub(1);
+			return true;
+		}
+		bool isTimedOut = !Sleep(sequence, deadlineNanoseconds);
+		_countWaiters.fetch_sub(1);
+		if(isTimedOut)
+			return isReady();
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+	Liveness of a peer process. The owner beats periodically, the other side considers it dead
+	when the last beat is older than HEARTBEAT_TIMEOUT_MILLISECONDS. Waits themselves stay short
+	and don't double as a liveness check.
+*/
+struct Heartbeat
+{
+	void Beat();
+	bool IsAlive() const;
+
+	std::atomic<uint64_t> _lastBeatMilliseconds = {0};
+};
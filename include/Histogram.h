@@ -0,0 +1,26 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+	Log-linear histogram of 64-bit values (8 sub-buckets per power of two, ~12% precision).
+	Recording is a single relaxed atomic increment, so it can sit on the transfer hot path
+	and may live in the shared segment.
+*/
+struct Histogram
+{
+	static constexpr uint32_t SUB_BUCKET_BITS = 3;
+	static constexpr uint32_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+	static constexpr uint32_t BUCKET_COUNT = 64 * SUB_BUCKET_COUNT;
+
+	static uint32_t GetBucketIndex(uint64_t value);
+	static uint64_t GetBucketLowerBound(uint32_t bucketIndex);
+
+	void Record(uint64_t value);
+	void Reset();
+	uint64_t GetCount() const;
+	uint64_t GetPercentile(double percentile) const;
+
+	std::atomic<uint64_t> _buckets[BUCKET_COUNT] = {};
+};
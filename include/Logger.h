@@ -2,18 +2,229 @@
 /*
 	This file is used for redirection the application output
 	It can be helpful when is requred switch output to file/socket/terminal/etc.
+
+	TRACE doesn't format anything on the calling thread: it copies the format pointer, a
+	monotonic timestamp and the raw arguments (strings by value) into a fixed-size record
+	of a per-thread lock-free ring. A background thread wakes up periodically, formats the
+	records of all the rings in timestamp order, prefixes them with the wall clock time and
+	the thread id and writes them out, so transfer threads never serialize on the output.
+	A thread whose ring is full drains the rings itself rather than dropping the record.
+
+	Levels are stripped at compile time (-DLOG_LEVEL=...): disabled calls don't evaluate their arguments.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <boost/thread.hpp>
+
+#include "SharedMemoryConsts.h"
+#include "FutexEvent.h"
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
 #ifdef STDOUT_TRACE
-extern void trace(const char *fmt, ...);
+#define TRACE_OUTPUT stdout
+#else
+#define TRACE_OUTPUT stderr
 #endif
 
-#ifdef STDOUT_DEBUG_TRACE
-	//	dedebug tracer stub (__FILE__, __LINE__ options)
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define TRACE_ERROR(...) Logger::GetInstance().Write(__VA_ARGS__)
+#else
+#define TRACE_ERROR(...) do {} while(0)
 #endif
 
-#ifdef FILE_TRACE
-	//	file log tracer stub
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define TRACE(...) Logger::GetInstance().Write(__VA_ARGS__)
+#else
+#define TRACE(...) do {} while(0)
 #endif
 
-#define TRACE(fmt, ...) trace(fmt, __VA_ARGS__)
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define TRACE_DEBUG(...) Logger::GetInstance().Write(__VA_ARGS__)
+#else
+#define TRACE_DEBUG(...) do {} while(0)
+#endif
+
+static constexpr uint32_t LOG_RECORD_SIZE = 512;
+static constexpr uint32_t LOG_RECORD_MAX_ARGUMENTS = 20;
+static constexpr uint32_t LOG_RING_RECORD_COUNT = 512;
+static constexpr uint32_t LOG_WRITER_INTERVAL_MILLISECONDS = 20;
+
+struct LogRecord;
+typedef void (*LogFormatter)(const LogRecord& record, FILE* output);
+
+/*
+	Binary form of a single TRACE call. Arguments are kept as 64-bit words;
+	strings are copied into _text (truncated if it's full) and referenced by offset.
+*/
+struct LogRecord
+{
+	uint64_t _nanoseconds;
+	const char* _format;
+	LogFormatter _formatter;
+	uint64_t _arguments[LOG_RECORD_MAX_ARGUMENTS];
+	uint32_t _textLength;
+	char _text[LOG_RECORD_SIZE - 3 * sizeof(uint64_t) - LOG_RECORD_MAX_ARGUMENTS * sizeof(uint64_t) - sizeof(uint32_t)];
+};
+static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE, "LogRecord must be exactly LOG_RECORD_SIZE bytes");
+
+/*
+	Single producer (the owning thread) / single consumer (whoever holds the drain lock) ring.
+*/
+struct LogRing
+{
+	LogRing(const std::string& threadIdString);
+	LogRing(const LogRing&) = delete;
+	LogRing(LogRing&) = delete;
+	LogRing(LogRing&&) = delete;
+
+	LogRecord* GetWriteRecord();
+	void PublishWriteRecord();
+	const LogRecord* GetReadRecord();
+	void ReleaseReadRecord();
+
+	const std::string _threadIdString;
+	std::atomic<bool> _isThreadFinished = {false};
+	std::atomic<uint64_t> _head = {0};
+	std::atomic<uint64_t> _tail = {0};
+	std::vector<LogRecord> _records;
+};
+
+template<typename T, typename Enable = void>
+struct LogArgument
+{
+	static_assert(std::is_integral<T>::value || std::is_enum<T>::value, "Unsupported TRACE argument type");
+
+	static uint64_t Store(LogRecord&, T value) { return static_cast<uint64_t>(value); }
+	static T Load(const LogRecord&, uint64_t word) { return static_cast<T>(word); }
+};
+
+template<typename T>
+struct LogArgument<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+	static uint64_t Store(LogRecord&, T value) { double number = value; uint64_t word; memcpy(&word, &number, sizeof(word)); return word; }
+	static double Load(const LogRecord&, uint64_t word) { double number; memcpy(&number, &word, sizeof(number)); return number; }
+};
+
+template<typename T>
+struct LogArgument<T*, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+	static uint64_t Store(LogRecord&, T* value) { return reinterpret_cast<uint64_t>(value); }
+	static const void* Load(const LogRecord&, uint64_t word) { return reinterpret_cast<const void*>(word); }
+};
+
+template<typename T>
+struct LogArgument<T*, typename std::enable_if<std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+	static uint64_t Store(LogRecord& record, const char* value)
+	{
+		uint64_t offset = record._textLength;
+		if(offset >= sizeof(record._text))
+			return sizeof(record._text) - 1;		//	the text is full, point to its last terminator
+
+		size_t length = value ? strnlen(value, sizeof(record._text) - 1 - offset) : 0;
+		memcpy(record._text + offset, value ? value : "", length);
+		record._text[offset + length] = '\0';
+		record._textLength += static_cast<uint32_t>(length + 1);
+		return offset;
+	}
+	static const char* Load(const LogRecord& record, uint64_t word) { return record._text + word; }
+};
+
+template<uint32_t... Indexes>
+struct LogIndexes {};
+
+template<uint32_t Count, uint32_t... Indexes>
+struct MakeLogIndexes : MakeLogIndexes<Count - 1, Count - 1, Indexes...> {};
+
+template<uint32_t... Indexes>
+struct MakeLogIndexes<0, Indexes...> { typedef LogIndexes<Indexes...> Type; };
+
+class Logger
+{
+public:
+	static Logger& GetInstance();
+
+	Logger(const Logger&) = delete;
+	Logger(Logger&) = delete;
+	Logger(Logger&&) = delete;
+	~Logger();
+
+public:
+	template<typename... Args>
+	void Write(const char* format, const Args&... args);
+	void Flush();
+
+private:
+	Logger();
+
+	template<typename... Args, uint32_t... Indexes>
+	static void FormatArguments(const LogRecord& record, FILE* output, LogIndexes<Indexes...>);
+	template<typename... Args>
+	static void Format(const LogRecord& record, FILE* output);
+
+	LogRing& GetThreadRing();
+	LogRecord& AcquireRecord(LogRing& ring);
+	void Drain();
+	void WriterThread();
+
+private:
+	const long _wallClockOffsetMicroseconds;
+	std::atomic<bool> _isRunning = {true};
+	FutexEvent _writerEvent;
+	boost::mutex _ringsMutex;
+	std::vector<std::shared_ptr<LogRing>> _rings;
+	boost::mutex _drainMutex;
+	std::vector<std::pair<const LogRecord*, LogRing*>> _drainRecords;
+	boost::thread _writerThread;
+};
+
+template<typename... Args>
+void Logger::Write(const char* format, const Args&... args)
+{
+	static_assert(sizeof...(Args) <= LOG_RECORD_MAX_ARGUMENTS, "Too many TRACE arguments");
+
+	LogRing& ring = GetThreadRing();
+	LogRecord& record = AcquireRecord(ring);
+	record._nanoseconds = getMonotonicNanoseconds();
+	record._format = format;
+	record._formatter = &Logger::Format<typename std::decay<Args>::type...>;
+	record._textLength = 0;
+
+	//	a braced list is evaluated left to right, so strings are packed into _text in order
+	const uint64_t words[] = {LogArgument<typename std::decay<Args>::type>::Store(record, args)..., 0};
+	std::copy(words, words + sizeof...(Args), record._arguments);
+
+	ring.PublishWriteRecord();
+}
+
+template<typename... Args, uint32_t... Indexes>
+void Logger::FormatArguments(const LogRecord& record, FILE* output, LogIndexes<Indexes...>)
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+	fprintf(output, record._format, LogArgument<Args>::Load(record, record._arguments[Indexes])...);
+#pragma GCC diagnostic pop
+}
+
+template<typename... Args>
+void Logger::Format(const LogRecord& record, FILE* output)
+{
+	FormatArguments<Args...>(record, output, typename MakeLogIndexes<sizeof...(Args)>::Type());
+}
@@ -1,13 +1,20 @@
 #pragma once
 
-#include <boost/interprocess/sync/interprocess_mutex.hpp>
-#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <atomic>
+
 #include <boost/interprocess/containers/vector.hpp>
 #include <boost/interprocess/containers/deque.hpp>
 #include <boost/interprocess/allocators/allocator.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/offset_ptr.hpp>
 
 #include "TransferChunk.h"
+#include "ChunkBitmap.h"
+#include "SubmissionQueue.h"
+#include "ClientSlot.h"
+#include "FutexEvent.h"
+#include "Heartbeat.h"
+#include "SharedMemoryHeader.h"
 
 using namespace boost::interprocess;
 
@@ -15,12 +22,29 @@ enum class MemoryManagerStatus : uint8_t
 {
 	NOT_INITED,
 	READY,
-	REQ_TO_ALLOC_CHUNK,
-	REQ_TO_ALLOC_IS_COMPLETED,
-	ALLOC_IS_SUCCESSFUL,
-	ALLOCATION_ERROR,
 };
 
+/*
+	Chunks are claimed and released by the clients themselves through the lock-free bitmap
+	and handed over to the server through the lock-free submission queue of the client's slot.
+	The futex event is only used to put an idle server to sleep; the server heartbeat tells
+	clients it's alive.
+
+	Every client process registers in a slot of its own. The server scheduler splits the busy
+	chunk limit between the clients in proportion to their weights, so a bulk uploader with many
+	threads can't take every chunk from a client with a few small files, and it takes the
+	submissions round-robin, up to a weight's worth from a client at a time.
+
+	Flow control is credit based: a client may take as many chunks as its share leaves (within
+	the busy limit), and a client without a credit sleeps on the credit event, which the server
+	signals when a chunk is released or the shares change. The server also publishes the rate it
+	drains chunks at, so a waiting client re-checks about as often as a credit can come back.
+
+	Credits are per transfer class (see TransferOptions): an urgent chunk is held to the client's
+	quota only, the normal and bulk classes leave the reserves of the classes above them free and
+	yield while those have waiting threads. Urgent chunks go through a queue of their own that the
+	server takes from first.
+*/
 class MemoryManager
 {
 public:
@@ -31,26 +55,77 @@ public:
 
 public:
 	//MemoryManager (allocator_type customAllocator, uint32_t chunkCount);
-	MemoryManager(managed_shared_memory& sharedMemorySegment);
+	MemoryManager(managed_shared_memory& sharedMemorySegment, SharedMemoryHeader& sharedMemoryHeader);
 
 public:
 	void SetMemoryManagerStatus(MemoryManagerStatus status);
 	MemoryManagerStatus GetMemoryManagerStatus() const;
-	uint32_t GetLastChunkIndex() const;
-	TransferChunk* GetNextFreeTransferChunkPointer();
+	void SetBusyChunkLimit(uint32_t busyChunkLimit);
+	void SetChunkReserves(uint32_t urgentChunkReserve, uint32_t normalChunkReserve);
+	Heartbeat& GetServerHeartbeat();
+	const Heartbeat& GetServerHeartbeat() const;
+	uint32_t GetBusyChunkCount() const;
+	uint32_t GetDrainRate() const;
+	const ClientSlot& GetClientSlot(uint32_t clientIndex) const;
 
-public:
-	interprocess_mutex _memoryManagerMutex;
-	interprocess_condition _cvSignalToServer;
-	interprocess_condition _cvSignalToClient;
+	//	client side
+	uint32_t RegisterClient(uint32_t processId, uint32_t weight, uint32_t chunkQuota);
+	void UnregisterClient(uint32_t clientIndex);
+	TransferChunk* AcquireTransferChunk(uint32_t clientIndex, TransferPriority priority);
+	uint32_t GetChunkCredits(uint32_t clientIndex, TransferPriority priority = TransferPriority::NORMAL) const;
+	bool WaitForChunkCredit(uint32_t clientIndex, TransferPriority priority, uint32_t timeoutMilliseconds);
+	void SetClientWaiting(uint32_t clientIndex, TransferPriority priority, bool isWaiting);
+	bool SubmitTransferChunk(TransferChunk* transferChunk);
+
+	//	server side
+	void ScheduleClients();
+	TransferChunk* TakeSubmittedTransferChunk();
+	void WaitForSubmission(uint32_t timeoutMilliseconds);
+	void WakeServer();
+	void ReleaseTransferChunk(TransferChunk* transferChunk);
+
+private:
+	void RequestSchedule();
+	void UpdateClassChunkLimits();
+	uint32_t GetClientChunkLimit(const ClientSlot& clientSlot, TransferPriority priority) const;
+	uint32_t GetFreeClassChunkCount(TransferPriority priority) const;
+	void ReclaimClientSlots();
+	void FreeClosedClientSlots(const bool* isDead, const uint32_t* submittedChunkCounts);
+	void UpdateDrainRate(uint64_t nowNanoseconds);
+	void NotifyCredit();
 
 private:
 	managed_shared_memory& _sharedSegment;
-	TransferChunk* _transferChunkContainer;
+	offset_ptr<TransferChunk> _transferChunkContainer;
+	offset_ptr<ClientSlot> _clientSlots;
 
 private:
-	MemoryManagerStatus _memoryManagerStatus;
-	uint32_t _lastChunkIndex;
-	const uint32_t _maxChunkCount = (VIRTUAL_SHARED_MEMORY_SIZE - sizeof(MemoryManager))
-										/ sizeof(TransferChunk) - 1;
+	std::atomic<MemoryManagerStatus> _memoryManagerStatus;
+	uint32_t _maxChunkCount;
+	uint32_t _busyChunkLimit;
+	uint32_t _urgentChunkReserve = 0;
+	uint32_t _normalChunkReserve = 0;
+	uint32_t _classChunkLimits[TRANSFER_PRIORITY_COUNT];		//	share of the busy limit each class may fill
+	//	the manager is a named object, the segment doesn't honour alignas, so the lines every client writes are padded apart
+	char _busyChunkPadding[CACHE_LINE_SIZE];
+	std::atomic<uint32_t> _busyChunkCount = {0};
+	std::atomic<uint64_t> _releasedChunkCount = {0};
+	char _creditPadding[CACHE_LINE_SIZE];
+	FutexEvent _creditEvent;
+	std::atomic<uint32_t> _drainRate = {0};		//	chunks released per second, smoothed
+	std::atomic<uint32_t> _waitingCounts[TRANSFER_PRIORITY_COUNT] = {};	//	client threads waiting for a credit, per class
+	char _submissionPadding[CACHE_LINE_SIZE];
+	FutexEvent _submissionEvent;
+	std::atomic<uint32_t> _pendingSubmissionCount = {0};
+	std::atomic<bool> _isScheduleRequested = {false};
+	SubmissionQueue _urgentSubmissionQueue;
+	char _heartbeatPadding[CACHE_LINE_SIZE];
+	Heartbeat _serverHeartbeat;
+	//	scheduler state, touched by the server's manager thread only
+	uint32_t _scheduleCursor = 0;
+	uint32_t _scheduleBudget = 0;
+	uint64_t _lastReclaimNanoseconds = 0;
+	uint64_t _lastDrainNanoseconds = 0;
+	uint64_t _lastReleasedChunkCount = 0;
+	ChunkBitmap _chunkBitmap;
 };
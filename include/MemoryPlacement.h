@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr int32_t NO_NUMA_NODE = -1;
+
+/*
+	Physical placement of the segment and of the threads working on it.
+	Huge pages are transparent ones (madvise): the segment is a boost managed_shared_memory
+	object in /dev/shm, which can't be mapped with MAP_HUGETLB; tmpfs serves it from huge
+	pages when /sys/kernel/mm/transparent_hugepage/shmem_enabled allows "advise".
+	Everything is best effort: a failure is reported and the transfer goes on with the default placement.
+*/
+struct MemoryPlacement
+{
+	static bool AdviseHugePages(void* address, size_t size);
+	static bool Prefault(void* address, size_t size);
+	static bool BindToNode(void* address, size_t size, int32_t numaNode);
+	static bool GetNodeCpus(int32_t numaNode, std::vector<uint32_t>& cpus);
+	static bool PinCurrentThreadToNode(int32_t numaNode);
+};
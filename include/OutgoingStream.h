@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <sys/uio.h>
+
+#include "TransferStream.h"
+#include "TransferOptions.h"
+
+class SharedMemoryClient;
+struct Heartbeat;
+
+/*
+	Byte stream of unknown length sent through a chunk of its own, for producers that have
+	no file to give: SharedMemoryClient::OpenStream() takes the chunk, the stream fills its ring
+	on the caller's thread. Reserve/Commit let the data be produced straight into the frame,
+	Write/Writev copy it there; Flush() hands a partly filled frame over at once. The server hands
+	it to its StreamConsumer, or saves it as a file under the stream's name without one. The client
+	beats the heartbeat of an open stream, so its producer may stay idle for as long as it likes.
+	A stream belongs to one thread and has to be closed (or destroyed, which aborts it) before its client is.
+*/
+class OutgoingStream
+{
+public:
+	OutgoingStream(SharedMemoryClient& client, TransferChunk* transferChunk, const TransferTicket& ticket, const Heartbeat& serverHeartbeat,
+					SharedMemoryMetrics* metrics, CompressionCodec codec, int32_t compressionLevel);
+	OutgoingStream(const OutgoingStream&) = delete;
+	OutgoingStream(OutgoingStream&) = delete;
+	OutgoingStream(OutgoingStream&&) = delete;
+	~OutgoingStream();
+
+public:
+	uint8_t* Reserve(size_t& countBytes);
+	void Commit(size_t countBytes);
+	bool Write(const void* data, size_t countBytes);
+	bool Writev(const struct iovec* vectors, size_t vectorCount);
+	bool Flush();
+	bool Close();
+	void Abort();
+	TransferStreamStatus GetStatus() const;
+
+private:
+	void Finish(bool isCompleted);
+
+private:
+	SharedMemoryClient& _client;
+	TransferChunk* _transferChunk;
+	TransferStreamWriter _writer;
+	TransferTicket _ticket;
+	bool _isFinished = false;
+};
@@ -1,15 +1,29 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <boost/thread.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
 
+#include "SharedMemoryConfig.h"
+#include "ThreadPool.h"
+#include "DedupStore.h"
+
 using namespace boost::interprocess;
 
-class TransferChunk;
+struct TransferChunk;
+struct TransferRange;
+struct SharedMemoryHeader;
+struct SharedMemoryMetrics;
+struct JournalTable;
 class MemoryManager;
+class TransferStreamWriter;
+class FilePrefetcher;
+struct SourceFile;
+class InputFileMapping;
 
 enum class SharedMemoryClientStatus : uint8_t
 {
@@ -19,30 +33,71 @@ enum class SharedMemoryClientStatus : uint8_t
 	COMPLETED,
 };
 
+class OutgoingStream;
+
 class SharedMemoryClient
 {
+	friend class OutgoingStream;
+
 public:
-	SharedMemoryClient();
+	SharedMemoryClient(const SharedMemoryConfig& config = SharedMemoryConfig());
 	SharedMemoryClient(const SharedMemoryClient&) = delete;
 	SharedMemoryClient(SharedMemoryClient&) = delete;
 	SharedMemoryClient(SharedMemoryClient&&) = delete;
+	~SharedMemoryClient();
 
 public:
 	SharedMemoryClientStatus GetClientStatus() const;
 	void TransferFiles(const std::vector<std::string>& filePathsContainer);
+	void TransferFiles(const std::vector<std::string>& filePathsContainer, const TransferOptions& options);
+	void WaitForCompletion();
+	std::unique_ptr<OutgoingStream> OpenStream(const std::string& name, uint64_t sizeHint = 0);
+	std::unique_ptr<OutgoingStream> OpenStream(const std::string& name, uint64_t sizeHint, const TransferOptions& options);
 
 private:
 	bool IsInited() const;
-	TransferChunk* GetTransferChunk();
-	void TransferThread(TransferChunk* transferChunk, const std::string& filePath);
+	TransferChunk* GetTransferChunk(const TransferTicket& ticket);
+	TransferRange ResumeRange(const std::string& filePath, const TransferRange& range) const;
+	uint32_t GetRangeCount(uint64_t fileSize) const;
+	uint64_t GetNextFileId();
+	void PostBatch(std::vector<SourceFile>& batchFiles, uint64_t& batchSize, const std::shared_ptr<FilePrefetcher>& prefetcher, size_t lastFileIndex,
+				   const TransferTicket& ticket);
+	void TransferThread(TransferChunk* transferChunk, const TransferTicket& ticket, const SourceFile& sourceFile, const TransferRange& range);
+	bool SendBlocks(TransferChunk* transferChunk, TransferStreamWriter& writer, const InputFileMapping& file, uint64_t fileOffset, uint64_t rangeEnd) const;
+	void TransferBatchThread(TransferChunk* transferChunk, const TransferTicket& ticket, const std::vector<SourceFile>& sourceFiles);
+	void RegisterStream(TransferChunk* transferChunk);
+	void UnregisterStream(TransferChunk* transferChunk);
+	void StreamHeartbeatThread();
+	void CompleteStream(const TransferTicket& ticket, bool isCompleted);
+	void RecordLatency(const TransferTicket& ticket) const;
 
 private:
 	managed_shared_memory _sharedSegment;
 
 private:
 	std::atomic<SharedMemoryClientStatus> _clientStatus = {SharedMemoryClientStatus::NOT_INITED};
-	std::atomic<uint32_t> _countThreads = {0};
+	std::atomic<uint32_t> _countPendingTransfers = {0};
 	std::atomic<uint32_t> _transmittedFileCounter = {0};
+	std::atomic<uint32_t> _fileIdCounter = {0};
+	uint64_t _stripeSize;
+	uint64_t _batchFileSize;
+	CompressionCodec _compressionCodec;
+	int32_t _compressionLevel;
+	TransferOptions _transferOptions;
+	uint32_t _clientIndex = NO_CLIENT_SLOT;
+	SharedMemoryHeader* _sharedMemoryHeaderPtr;
 	MemoryManager* _memoryManagerPtr;
-	TransferChunk* _sharedTransferChunkArray;
+	SharedMemoryMetrics* _metricsPtr;
+	const JournalTable* _journalTablePtr = nullptr;
+	DedupIndex _dedupIndex;					//	no entries when the server keeps no store or --dedup=0
+
+	//	open streams, their producers may idle between writes
+	boost::mutex _streamsMutex;
+	boost::condition_variable _cvStreamsChanged;
+	std::vector<TransferChunk*> _openStreamChunks;
+	bool _isStopping = false;
+	boost::thread _streamHeartbeatThread;
+
+private:
+	ThreadPool _transferThreadPool;			//	must be the last member: it's joined before the rest is destroyed
 };
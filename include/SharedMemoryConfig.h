@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "SharedMemoryConsts.h"
+#include "MemoryPlacement.h"
+#include "Compression.h"
+#include "TransferOptions.h"
+
+/*
+	Server side tunables. They are picked at startup (command line or a config file)
+	and published to clients through SharedMemoryHeader, so the binaries don't have to be
+	rebuilt in lockstep to change the layout of the segment.
+	The thread count, the stripe size, the batch file size and the compression are process local and are accepted by the client as well;
+	the client weight and quota, the dedup switch, the priority and the deadline are the client's own.
+
+	Supported options:
+		--segment-size=<bytes>[K|M|G]
+		--frame-size=<bytes>[K|M|G]
+		--slot-count=<power of two>
+		--threads=<count>			(worker pool size, 0 means one per core)
+		--stripe-size=<bytes>[K|M|G]	(client: minimal byte range sent through a separate chunk)
+		--batch-file-size=<bytes>[K|M|G]	(client: files up to this size are packed into batches, 0 disables)
+		--compression=<none|lz4|zstd>[:level]	(client: frame codec, frames that don't shrink are sent as is)
+		--client-weight=<1..64>		(client: share of the server's chunks against the other clients, see ClientSlot)
+		--client-quota=<chunks>		(client: chunks in flight at most, 0 leaves only the share)
+		--priority=<urgent|normal|bulk>	(client: scheduling class of the transfers, see TransferOptions)
+		--deadline=<milliseconds>		(client: time a transfer should be done in, 0 for none)
+		--urgent-reserve=<chunks>		(server: chunks of the busy limit only urgent transfers take)
+		--normal-reserve=<chunks>		(server: chunks of the busy limit bulk transfers leave to normal ones)
+		--write-queue-depth=<buffers>		(server: write-back buffers in flight, 0 writes straight from the ring)
+		--direct-io=<0|1>			(server: write large files with O_DIRECT)
+		--overwrite=<0|1>			(server: a received file replaces an existing one of its name instead of failing)
+		--journal=<file>			(server: progress of resumable transfers, created on the first one, see TransferJournal)
+		--dedup-store=<directory>		(server: keep received blocks there and let clients reference them, see DedupStore)
+		--dedup-store-size=<bytes>[K|M|G]	(server: blocks the store holds at most)
+		--dedup=<0|1>				(client: send blocks the server's store holds as references)
+		--frame-loans=<count>			(server: frames of a stream a StreamConsumer may hold at a time)
+		--huge-pages=<0|1>			(back the segment with transparent huge pages)
+		--prefault=<0|1>			(fault the whole segment in at startup)
+		--numa-node=<node>			(bind the segment and pin the workers to a node; the client follows the server by default)
+		--stats-interval=<milliseconds>	(stats: report period)
+		--config=<file>				(lines in "option=value" form, '#' starts a comment)
+*/
+struct SharedMemoryConfig
+{
+	bool ParseArguments(int argc, char* argv[], int firstArgument);
+	bool ParseOption(const std::string& option);
+	bool ParseFile(const std::string& filePath);
+	bool IsValid() const;
+
+	uint64_t _segmentSize = DEFAULT_SHARED_MEMORY_SIZE;
+	uint32_t _frameSize = DEFAULT_DATA_FRAME_SIZE;
+	uint32_t _slotCount = DEFAULT_RING_SLOT_COUNT;
+	uint32_t _threadCount = 0;
+	uint64_t _stripeSize = DEFAULT_STRIPE_SIZE;
+	uint64_t _batchFileSize = DEFAULT_BATCH_FILE_SIZE;
+	CompressionCodec _compressionCodec = CompressionCodec::NONE;
+	int32_t _compressionLevel = 0;
+	uint32_t _clientWeight = DEFAULT_CLIENT_WEIGHT;
+	uint32_t _clientChunkQuota = 0;
+	TransferOptions _transferOptions;
+	uint32_t _urgentChunkReserve = DEFAULT_URGENT_CHUNK_RESERVE;
+	uint32_t _normalChunkReserve = 0;
+	uint32_t _writeQueueDepth = DEFAULT_WRITE_QUEUE_DEPTH;
+	bool _isDirectIo = false;
+	bool _isOverwriting = false;
+	std::string _journalPath = JOURNAL_FILE_NAME;
+	std::string _dedupStorePath;
+	uint64_t _dedupStoreSize = DEFAULT_DEDUP_STORE_SIZE;
+	bool _isDedupEnabled = true;
+	uint32_t _frameLoanCount = DEFAULT_FRAME_LOAN_COUNT;
+	uint32_t _statsIntervalMilliseconds = DEFAULT_STATS_INTERVAL_MILLISECONDS;
+	bool _isHugePageBacked = false;
+	bool _isPrefaulted = false;
+	int32_t _numaNode = NO_NUMA_NODE;
+};
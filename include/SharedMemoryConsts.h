@@ -3,14 +3,55 @@
 #include <cstdint>
 #include <string>
 
-constexpr uint32_t MAIN_THREAD_SLEEP_TIME = 3;
-constexpr uint32_t CONDITIONAL_VARIABLE_TIMEOUT_MILLISECONDS = 3000;
-constexpr uint32_t CONDITIONAL_VARIABLE_STRIKE_LIMIT = 3;
-constexpr uint32_t VIRTUAL_SHARED_MEMORY_SIZE = 256*1024*1024;		//	shares memory size in bytes (256KB)
-constexpr uint32_t DATA_FRAME_SIZE = 256;
-constexpr uint32_t MAX_FILE_NAME_LENGTH = 256;
+constexpr uint32_t HEARTBEAT_INTERVAL_MILLISECONDS = 500;				//	also the longest single futex wait
+constexpr uint32_t HEARTBEAT_TIMEOUT_MILLISECONDS = 9000;				//	a peer without a beat this long is dead
+constexpr uint32_t FUTEX_MIN_SPIN_COUNT = 16;
+constexpr uint32_t FUTEX_MAX_SPIN_COUNT = 4096;
+constexpr uint32_t MIN_CREDIT_WAIT_MILLISECONDS = 1;					//	first re-check of a client waiting for a chunk, see MemoryManager
+constexpr uint32_t DEFAULT_STATS_INTERVAL_MILLISECONDS = 1000;
+constexpr uint64_t DEFAULT_SHARED_MEMORY_SIZE = 256*1024*1024;		//	shared memory size in bytes (256MB), see SharedMemoryConfig
+constexpr uint32_t DEFAULT_DATA_FRAME_SIZE = 64*1024;
+constexpr uint32_t MAX_DATA_FRAME_SIZE = 1024*1024*1024;				//	keeps the frame stride within 32 bits, see SharedMemoryConfig::IsValid
+constexpr uint32_t DEFAULT_RING_SLOT_COUNT = 8;						//	frames per TransferChunk ring
+constexpr uint32_t MAX_DRAIN_FRAME_COUNT = 64;						//	frames the server writes out with a single pwritev
+constexpr uint64_t DEFAULT_STRIPE_SIZE = 64*1024*1024;				//	files larger than this are split across chunks
+constexpr uint64_t DEFAULT_BATCH_FILE_SIZE = 64*1024;				//	files up to this size are packed into batches
+constexpr uint64_t MAX_BATCH_SIZE = 4*1024*1024;					//	payload bytes of a single batch
+constexpr uint32_t MAX_BATCH_FILE_COUNT = 1024;
+constexpr uint32_t COMPRESSION_SAMPLE_SIZE = 4*1024;				//	prefix of a frame probed before compressing all of it
+constexpr uint32_t COMPRESSION_MAX_BACKOFF_FRAMES = 64;				//	raw frames sent at most before the next probe
+constexpr uint32_t DEFAULT_WRITE_QUEUE_DEPTH = 32;					//	server write-back buffers in flight, see DiskSink
+constexpr uint32_t WRITE_BUFFER_SIZE = 1024*1024;
+constexpr uint32_t MAX_CLIENT_COUNT = 64;							//	client registration slots in the segment
+constexpr uint32_t NO_CLIENT_SLOT = UINT32_MAX;
+constexpr uint32_t DEFAULT_CLIENT_WEIGHT = 1;
+constexpr uint32_t MAX_CLIENT_WEIGHT = 64;
+constexpr uint32_t DEFAULT_URGENT_CHUNK_RESERVE = 1;					//	busy chunks only urgent transfers take, see TransferOptions
+constexpr uint64_t JOURNAL_CHECKPOINT_SIZE = 64*1024*1024;			//	resumable ranges are synced and checkpointed this often, see TransferJournal
+constexpr uint32_t JOURNAL_ENTRY_COUNT = 1024;
+constexpr uint32_t DEDUP_BLOCK_SIZE = 1024*1024;						//	unit of the server's content-addressed store, see DedupStore
+constexpr uint32_t DEDUP_INDEX_PROBE_COUNT = 16;
+constexpr uint64_t DEDUP_EVICTION_GRACE_SECONDS = 60;				//	an evicted block still resolves references this long
+constexpr uint32_t DEDUP_PENDING_BLOCK_COUNT = 16;					//	received blocks waiting to be stored at most, more aren't stored
+constexpr uint64_t NO_MISSED_BLOCK = UINT64_MAX;					//	see TransferChunk::TakeMissedBlock
+constexpr uint64_t DEFAULT_DEDUP_STORE_SIZE = 4ull*1024*1024*1024;
+constexpr uint32_t DEFAULT_FRAME_LOAN_COUNT = 4;					//	frames of a stream a StreamConsumer may hold at a time
+constexpr uint64_t DIRECT_IO_MIN_FILE_SIZE = 64*1024*1024;			//	smaller files stay in the page cache with --direct-io
+constexpr uint32_t PREFETCH_FILE_COUNT = 256;						//	the client reads ahead at most this many files, see FilePrefetcher
+constexpr uint64_t PREFETCH_SIZE = 64*1024*1024;					//	and at most this many bytes
+constexpr uint64_t PREFETCH_HEAD_SIZE = 4*1024*1024;				//	of every file
+constexpr uint32_t MAX_FILE_NAME_LENGTH = 4096;					//	relative path the server files a transfer under
+constexpr uint32_t CACHE_LINE_SIZE = 64;
+constexpr uint32_t PAYLOAD_ALIGNMENT = 4096;
+constexpr uint32_t SHARED_MEMORY_MAGIC = 0x54464D53;				//	"SMFT"
+constexpr uint32_t SHARED_MEMORY_LAYOUT_VERSION = 18;
 constexpr char SHARED_MEMORY_NAME[] = "FILE_TRANSFER_SHARED_MEMORY";
+constexpr char SHARED_MEMORY_HEADER_NAME[] = "FILE_TRANSFER_HEADER";
 constexpr char SHARED_MEMORY_MANAGER_NAME[] = "FILE_TRANSFER_MEMORY_MANAGER";
-constexpr char SHARED_TRANSFER_ARRAY_NAME[] = "FILE_TRANSFER_CHUNK_ARRAY";
+constexpr char SHARED_MEMORY_METRICS_NAME[] = "FILE_TRANSFER_METRICS";
+constexpr char SHARED_MEMORY_JOURNAL_NAME[] = "FILE_TRANSFER_JOURNAL";
+constexpr char SHARED_MEMORY_DEDUP_INDEX_NAME[] = "FILE_TRANSFER_DEDUP_INDEX";
+constexpr char JOURNAL_FILE_NAME[] = "shmft.journal";				//	default of --journal, see TransferJournal
 
 extern long getMicrotime();
+extern uint64_t getMonotonicNanoseconds();
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+#include "SharedMemoryConsts.h"
+#include "MemoryPlacement.h"
+
+struct SharedMemoryConfig;
+
+/*
+	Versioned description of the segment layout. It is constructed by the server before
+	any other object and is the first thing a client looks up after attaching.
+*/
+struct SharedMemoryHeader
+{
+	SharedMemoryHeader(const SharedMemoryConfig& config);
+
+	bool IsCompatible() const;
+	uint64_t GetFrameStride() const;
+
+	static uint64_t GetFrameStride(uint32_t frameSize);
+
+	uint32_t _magic = SHARED_MEMORY_MAGIC;
+	uint32_t _version = SHARED_MEMORY_LAYOUT_VERSION;
+	uint64_t _segmentSize = 0;
+	uint32_t _frameSize = 0;
+	uint32_t _slotCount = 0;
+	uint32_t _chunkCount = 0;
+	uint32_t _maxFileNameLength = MAX_FILE_NAME_LENGTH;
+	int32_t _numaNode = NO_NUMA_NODE;
+	uint32_t _isHugePageBacked = 0;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "SharedMemoryConsts.h"
+#include "Histogram.h"
+#include "TransferOptions.h"
+
+/*
+	Counter on its own cache line: producers and consumers of different chunks update
+	different counters without bouncing a shared line between cores. The segment doesn't
+	honour alignas for named objects, so the counter is padded to a full line instead.
+*/
+struct MetricCounter
+{
+	void Add(uint64_t value);
+	uint64_t Get() const;
+
+	std::atomic<uint64_t> _value = {0};
+	char _padding[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+};
+
+/*
+	Live counters of the whole segment. The server constructs it right after the header,
+	both sides update it and the stats mode reads it from a read-only mapping.
+*/
+struct SharedMemoryMetrics
+{
+	MetricCounter _bytesTransferred;
+	MetricCounter _framesTransferred;
+	MetricCounter _filesCompleted;
+	MetricCounter _filesFailed;
+	MetricCounter _allocationFailures;			//	chunk acquisition attempts refused by the manager
+	MetricCounter _creditWaitNanoseconds;		//	clients sleeping for a chunk credit
+	MetricCounter _timeoutStrikes;				//	peers declared dead after a missed heartbeat
+	MetricCounter _checksumFailures;			//	frames or streams failing CRC32C verification
+	MetricCounter _compressionSavedBytes;		//	ring bytes saved by compressed frames
+	MetricCounter _producerWaitNanoseconds;		//	clients sleeping on a full ring
+	MetricCounter _consumerWaitNanoseconds;		//	server workers sleeping on an empty ring
+	MetricCounter _diskSinkWaitNanoseconds;		//	server workers waiting for a free write-back buffer
+	MetricCounter _dedupBytes;					//	bytes taken from the dedup store instead of the ring
+	MetricCounter _deadlineMisses;				//	transfers finished past their deadline
+	Histogram _handoffLatencyHistogram;			//	frame publish to pickup, nanoseconds
+	Histogram _framesPerWakeupHistogram;		//	frames a client publishes with one ring update
+	Histogram _transferLatencyHistograms[TRANSFER_PRIORITY_COUNT];	//	queueing to the last byte of a chunk, microseconds, per class
+};
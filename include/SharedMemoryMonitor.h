@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include <boost/interprocess/managed_shared_memory.hpp>
+
+#include "SharedMemoryConfig.h"
+
+using namespace boost::interprocess;
+
+struct SharedMemoryHeader;
+struct SharedMemoryMetrics;
+class MemoryManager;
+
+/*
+	The stats mode. It maps the segment read-only, so it can be attached to a running server
+	at any time without taking a lock or touching a single byte of the segment, and it
+	periodically prints the rates derived from SharedMemoryMetrics.
+*/
+class SharedMemoryMonitor
+{
+public:
+	SharedMemoryMonitor(const SharedMemoryConfig& config = SharedMemoryConfig());
+	SharedMemoryMonitor(const SharedMemoryMonitor&) = delete;
+	SharedMemoryMonitor(SharedMemoryMonitor&) = delete;
+	SharedMemoryMonitor(SharedMemoryMonitor&&) = delete;
+
+public:
+	bool IsInited() const;
+	void Run();
+
+private:
+	managed_shared_memory _sharedSegment;
+
+private:
+	const uint32_t _intervalMilliseconds;
+	const SharedMemoryHeader* _sharedMemoryHeaderPtr = nullptr;
+	const MemoryManager* _memoryManagerPtr = nullptr;
+	const SharedMemoryMetrics* _metricsPtr = nullptr;
+};
@@ -1,16 +1,29 @@
 #pragma once
 
+#include <atomic>
+#include <map>
 #include <vector>
 #include <memory>
 #include <boost/thread.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
 
 #include "SharedMemoryConsts.h"
+#include "SharedMemoryConfig.h"
+#include "ThreadPool.h"
+#include "FileMapping.h"
+#include "DiskSink.h"
+#include "TransferJournal.h"
+#include "DedupStore.h"
+#include "StreamConsumer.h"
 
 using namespace boost::interprocess;
 
 class MemoryManager;
-class TransferChunk;
+struct SharedMemoryHeader;
+struct SharedMemoryMetrics;
+struct TransferChunk;
+struct TransferRange;
+class TransferStreamReader;
 
 enum class SharedMemoryServerStatus : uint8_t
 {
@@ -26,16 +39,74 @@ struct SharedMemoryCleaner
 	~SharedMemoryCleaner();
 };
 
+/*
+	Destination of a (possibly striped) transfer. It's preallocated to the full size,
+	every range is written in place and the file is renamed once the last range is done.
+	The part file of a journaled transfer outlives a failure, so it can be resumed.
+*/
+struct IncomingFile
+{
+	IncomingFile(const std::string& temporaryName, bool isResumed);
+
+	std::string _temporaryName;
+	OutputFile _file;
+	uint64_t _sourceKey = 0;					//	0 when the transfer isn't journaled
+	uint32_t _remainingRanges = 0;
+	bool _isFailed = false;
+};
+
+/*
+	Writes the stream of one range into its IncomingFile, from the data of the stream or from
+	another file. A journaled range is checkpointed every JOURNAL_CHECKPOINT_SIZE bytes with the
+	checksum of the range so far; a resumed stream is accepted only from the checkpoint the journal holds.
+*/
+class RangeWriter
+{
+public:
+	RangeWriter(IncomingFile& incomingFile, const TransferRange& range, DiskSink* sink, TransferJournal* journal);
+	RangeWriter(const RangeWriter&) = delete;
+	RangeWriter(RangeWriter&) = delete;
+	RangeWriter(RangeWriter&&) = delete;
+
+public:
+	bool IsAccepted() const;
+	bool IsGood() const;
+	uint64_t GetOffset() const;
+	void Write(const uint8_t* source, size_t countBytes);
+	void Writev(const struct iovec* vectors, uint32_t vectorCount);
+	void Copy(int sourceFileDescriptor, size_t countBytes, uint32_t checksum);
+	bool Finish(bool isStreamFinished);
+
+private:
+	void Checkpoint();
+
+private:
+	OutputFile& _file;
+	const TransferRange& _range;
+	TransferJournal* _journal;
+	const bool _isJournaled;
+	bool _isAccepted = false;
+	uint32_t _journalIndex = 0;
+	uint32_t _checksum = 0;
+	FileSinkWriter _fileWriter;
+	uint64_t _checkpointOffset;
+};
+
 class SharedMemoryServer
 {
 public:
-	SharedMemoryServer();
+	SharedMemoryServer(const SharedMemoryConfig& config = SharedMemoryConfig());
 	SharedMemoryServer(const SharedMemoryServer&) = delete;
 	SharedMemoryServer(SharedMemoryServer&) = delete;
 	SharedMemoryServer(SharedMemoryServer&&) = delete;
+	~SharedMemoryServer();
 
 public:
 	SharedMemoryServerStatus GetServerStatus() const;
+	uint64_t GetReceivedFileCount() const;
+	uint64_t GetFailedFileCount() const;
+	const SharedMemoryMetrics* GetMetrics() const;
+	void SetStreamConsumer(const std::shared_ptr<StreamConsumer>& streamConsumer);
 	void Start();
 	void Stop();
 
@@ -43,6 +114,15 @@ private:
 	bool IsInited() const;
 	void MemoryManagerThread();
 	void TransferThread(TransferChunk* transferChunk);
+	void ReceiveRange(TransferChunk* transferChunk);
+	void ReceiveBlocks(TransferChunk* transferChunk, TransferStreamReader& reader, RangeWriter& writer, uint64_t rangeEnd);
+	void ReceiveBatch(TransferChunk* transferChunk);
+	void ReceiveStream(TransferChunk* transferChunk);
+	void SaveStream(TransferStreamReader& reader, const TransferRange& range, const std::string& name);
+	std::shared_ptr<IncomingFile> OpenIncomingFile(const TransferRange& range);
+	void CompleteIncomingFile(const TransferRange& range, const std::string& fileName, bool isCompleted);
+	void CommitReceivedFile(const std::string& temporaryName, uint64_t fileId, const std::string& fileName);
+	static bool CreateParentDirectories(const std::string& relativePath);
 
 private:
 	SharedMemoryCleaner _sharedMemoryCleaner;
@@ -50,6 +130,21 @@ private:
 
 private:
 	std::atomic<SharedMemoryServerStatus> _serverStatus = {SharedMemoryServerStatus::NOT_INITED};
+	SharedMemoryHeader* _sharedMemoryHeaderPtr = nullptr;
+	SharedMemoryMetrics* _metricsPtr = nullptr;
 	MemoryManager* _memoryManagerPtr = nullptr;
 	std::atomic<uint32_t> _countTransferThreads = {0};
+	boost::thread _memoryManagerThread;
+	boost::mutex _incomingFilesMutex;
+	std::map<uint64_t, std::shared_ptr<IncomingFile>> _incomingFiles;
+	bool _isDirectIo;
+	bool _isOverwriting;
+	uint32_t _frameLoanCount;
+	std::unique_ptr<DiskSink> _diskSink;		//	null when frames are written straight from the ring
+	std::unique_ptr<TransferJournal> _journal;
+	std::unique_ptr<DedupStore> _dedupStore;	//	null without --dedup-store
+	std::shared_ptr<StreamConsumer> _streamConsumer;	//	null when streams are saved as files
+
+private:
+	ThreadPool _transferThreadPool;			//	must be the last member: it's joined before the rest is destroyed
 };
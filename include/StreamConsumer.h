@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "TransferStream.h"
+
+/*
+	Receiving end of one stream, see OutgoingStream. Every frame is lent to Borrow(): the view
+	(in the ring slot, or in the buffer a compressed frame was expanded into) stays valid until
+	the loan is released or destroyed, on any thread, so a parser can keep working on it after
+	the call. Up to SharedMemoryConfig::_frameLoanCount frames are out at a time; the next one
+	waits for a returned loan, the client for a free slot. Slots are reused in ring order, so a frame
+	held back stalls the stream once a ring's worth of later frames is in. Without an override Borrow() passes
+	the view to Receive() and releases it on return. Returning false rejects the rest of the stream.
+	Finish() comes last, with whether every byte arrived intact; loans still out are waited for
+	after it. A receiver is called by a single worker.
+*/
+class StreamReceiver
+{
+public:
+	virtual ~StreamReceiver() {}
+
+public:
+	virtual bool Receive(const uint8_t* /*data*/, size_t /*countBytes*/) { return false; }
+	virtual bool Borrow(std::unique_ptr<FrameLoan> loan) { return Receive(loan->GetData(), loan->GetSize()); }
+	virtual void Finish(bool isCompleted) = 0;
+};
+
+/*
+	Takes the streams of a server in process instead of the disk, see SharedMemoryServer::SetStreamConsumer().
+	OpenStream() is called by the worker that picked a stream up, several workers may call it at once;
+	no receiver declines the stream. The size is the client's hint, 0 when it gave none.
+*/
+class StreamConsumer
+{
+public:
+	virtual ~StreamConsumer() {}
+
+public:
+	virtual std::unique_ptr<StreamReceiver> OpenStream(const std::string& name, uint64_t sizeHint) = 0;
+};
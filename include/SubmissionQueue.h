@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <boost/interprocess/offset_ptr.hpp>
+
+using namespace boost::interprocess;
+
+/*
+	Bounded lock-free multi-producer queue of chunk indices living in the shared segment
+	(sequence numbered cells). Clients push the chunks they have filled the metadata of,
+	the server pops them to start a transfer.
+*/
+struct SubmissionQueue
+{
+	struct Cell
+	{
+		std::atomic<uint32_t> _sequence;
+		uint32_t _chunkIndex;
+	};
+
+	static uint32_t GetCapacity(uint32_t minimalCapacity);
+
+	void Attach(Cell* cells, uint32_t capacity);
+	bool Push(uint32_t chunkIndex);
+	bool Pop(uint32_t& chunkIndex);
+	bool IsEmpty() const;
+
+	offset_ptr<Cell> _cells;
+	uint32_t _capacity = 0;
+	std::atomic<uint32_t> _enqueuePosition = {0};
+	std::atomic<uint32_t> _dequeuePosition = {0};
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+#include <boost/thread.hpp>
+
+constexpr uint32_t TASK_PRIORITY_COUNT = 3;
+
+/*
+	Fixed size pool of worker threads with a FIFO queue of pending tasks per priority, 0 first.
+	The thread count stays flat no matter how many tasks are posted; Join() drains the queue
+	and waits for the workers, so the owner can shut down cleanly instead of detaching threads.
+	SetNumaNode() pins every worker to the CPUs of a node before it runs its next task.
+*/
+class ThreadPool
+{
+public:
+	ThreadPool(uint32_t threadCount);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool(ThreadPool&) = delete;
+	ThreadPool(ThreadPool&&) = delete;
+	~ThreadPool();
+
+public:
+	static uint32_t GetDefaultThreadCount();
+
+	uint32_t GetThreadCount() const;
+	void SetNumaNode(int32_t numaNode);
+	bool Post(std::function<void()> task, uint32_t priority = 0);
+	void Wait();
+	void Join();
+
+private:
+	void WorkerThread();
+	bool IsQueueEmpty() const;
+
+private:
+	boost::thread_group _workers;
+	boost::mutex _queueMutex;
+	boost::condition_variable _cvTaskIsPosted;
+	boost::condition_variable _cvQueueIsDrained;
+	std::deque<std::function<void()>> _taskQueues[TASK_PRIORITY_COUNT];
+	uint32_t _threadCount;
+	uint32_t _countActiveTasks = 0;
+	bool _isStopping = false;
+	std::atomic<int32_t> _numaNode;
+};
@@ -1,31 +1,190 @@
 #pragma once
 
-#include <boost/interprocess/sync/interprocess_mutex.hpp>
-#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <atomic>
+
+#include <boost/interprocess/offset_ptr.hpp>
 //#include <boost/interprocess/smart_ptr/unique_ptr.hpp>
 
 #include "SharedMemoryConsts.h"
+#include "FutexEvent.h"
+#include "Heartbeat.h"
+#include "Compression.h"
+#include "ContentHash.h"
+#include "TransferOptions.h"
 
 using namespace boost::interprocess;
 
 enum class TransferChunkStatus : uint8_t
 {
 	NOT_INITED,
-	REQ_TO_READ,
-	REQ_TO_WRITE,
+	STREAMING,
 	TRANSFER_IS_FINISHED,
+	TRANSFER_IS_ABORTED,
+};
+
+enum class TransferMode : uint8_t
+{
+	SINGLE_FILE,
+	FILE_BATCH,
+	DEDUP_RANGE,
+	STREAM,
+};
+
+/*
+	Record of a FILE_BATCH stream: the header is followed by the file name and the file content.
+*/
+struct BatchRecordHeader
+{
+	uint64_t _fileId = 0;
+	uint64_t _fileSize = 0;
+	uint32_t _nameLength = 0;
+	uint32_t _reserved = 0;
+};
+
+enum class DedupRecordType : uint32_t
+{
+	DATA,
+	REFERENCE,
+	RESEND,				//	no block: the client starts again from the block the server missed
+};
+
+/*
+	Record of a DEDUP_RANGE stream, one per DEDUP_BLOCK_SIZE block of the range (the last one may be shorter).
+	A DATA record is followed by the block, a REFERENCE names a block the server's index holds, see DedupStore.
+	A reference the server can't resolve is reported back through the chunk and the server drops the
+	records that follow up to a RESEND; after it the client sends again from that block, as DATA.
+	The client finishes a range with references only once the server has written all of its blocks.
+*/
+struct DedupRecordHeader
+{
+	ContentHash _hash;
+	uint32_t _length = 0;
+	DedupRecordType _type = DedupRecordType::DATA;
+};
+
+/*
+	Byte range of a source file carried by one chunk. Large files are striped into several
+	ranges sharing the same _fileId, the server assembles them with positional writes.
+	A file with a _sourceKey is journaled: the stream of a range starts _resumedLength bytes
+	into it when the server already holds those, see TransferJournal.
+	A STREAM has no length until it's closed: _fileSize and _length hold the size hint of its producer.
+*/
+struct TransferRange
+{
+	uint64_t _fileId = 0;
+	uint64_t _fileSize = 0;
+	uint64_t _offset = 0;
+	uint64_t _length = 0;
+	uint32_t _rangeCount = 1;
+	uint64_t _sourceKey = 0;					//	identity of the source file that survives a restart of either side
+	uint64_t _resumedLength = 0;
+};
+
+/*
+	Frame header; the payload of SharedMemoryHeader::_frameSize bytes follows it directly.
+	A compressed frame holds _countBytes of _codec output that expand to _rawBytes of the stream.
+*/
+struct alignas(CACHE_LINE_SIZE) TransferFrame
+{
+	uint8_t* GetData() { return reinterpret_cast<uint8_t*>(this + 1); }
+	const uint8_t* GetData() const { return reinterpret_cast<const uint8_t*>(this + 1); }
+
+	uint32_t _countBytes = 0;
+	uint32_t _rawBytes = 0;
+	uint32_t _checksum = 0;					//	CRC32C of the stream up to and including this frame (raw bytes)
+	CompressionCodec _codec = CompressionCodec::NONE;
+	uint64_t _publishNanoseconds = 0;			//	monotonic time of the handoff, see Histogram
 };
 
+/*
+	Per-chunk data nobody touches on the hot path; kept in a table of its own so the control blocks stay small.
+*/
+struct TransferChunkMetadata
+{
+	char _fileName[MAX_FILE_NAME_LENGTH] = {0};
+};
+
+/*
+	Every chunk holds a single-producer/single-consumer ring of frames.
+	The ring storage lives in the payload area of the segment, its geometry is taken from SharedMemoryHeader.
+	The client is the only writer of _ringHead, the server is the only writer of _ringTail,
+	so frames are handed over without locks. The futex events are touched only when one of
+	the sides has to sleep on a full or an empty ring; the client beats _producerHeartbeat
+	so the server can tell a slow client from a dead one.
+	The server reads at _ringReadIndex; a frame it lends to a StreamConsumer is taken off the ring
+	without giving the slot back, and the tail moves over the lent frames once they're returned.
+	A frame is visible to the server once the head moves over it; the client wakes a sleeping
+	server at once but a busy one only every few frames, and the server may take everything
+	published in one go.
+
+	Until the client submits a chunk only the client knows it: _holderIndex names the client then,
+	so the chunks of a client that dies before submitting them can be told apart and released.
+
+	Control blocks are laid out by cache lines: the descriptor (written before submission,
+	read-only afterwards), the producer line, the consumer line and each event never share
+	a line, and each side keeps a cached copy of the other side's index so it only reads
+	the peer's line when the ring looks full (or empty).
+*/
 struct TransferChunk
 {
 	TransferChunk ();
-	bool _isChunkBusy = false;
-	interprocess_mutex _transferMutex;
-	interprocess_condition _cvToRead;
-	interprocess_condition _cvToWrite;
+	void AttachRing(uint8_t* ringPayload, uint32_t frameSize, uint32_t frameStride, uint32_t slotCount);
+	uint32_t GetFrameSize() const;
 
-	TransferChunkStatus _transferStatus = TransferChunkStatus::NOT_INITED;
-	char _fileName[MAX_FILE_NAME_LENGTH] = {0};
-	uint8_t _data[DATA_FRAME_SIZE] = {0};
-	uint32_t _countBytes = 0;
+	//	producer (client) side
+	TransferFrame* GetWriteFrame();
+	void PublishWriteFrame();
+	bool IsReaderWaiting() const;
+	void NotifyReader();
+	bool WaitForWriteFrame(uint32_t timeoutMilliseconds);
+	void FinishTransfer(bool isCompleted);
+	uint64_t TakeMissedBlock();
+	bool WaitForBlocks(uint64_t blocksEnd, uint32_t timeoutMilliseconds);
+
+	//	consumer (server) side
+	const TransferFrame* GetReadFrame(uint32_t framesAhead = 0);
+	void ReleaseReadFrames(uint32_t countFrames);
+	void TakeReadFrame();
+	void ReleaseTakenFrames(uint32_t countFrames);
+	bool WaitForReadFrame(uint32_t timeoutMilliseconds);
+	void ReportBlocks(uint64_t blocksEnd);
+	void ReportMissedBlock(uint64_t blockOffset);
+
+	TransferChunkStatus GetTransferStatus() const;
+	void Reject();
+	bool IsRejected() const;
+	void Reset();
+
+	//	descriptor
+	alignas(CACHE_LINE_SIZE) std::atomic<TransferChunkStatus> _transferStatus = {TransferChunkStatus::NOT_INITED};
+	TransferMode _transferMode = TransferMode::SINGLE_FILE;
+	TransferPriority _priority = TransferPriority::NORMAL;
+	TransferRange _range;
+	uint32_t _streamChecksum = 0;				//	CRC32C of the whole stream, valid once the transfer is finished
+	uint32_t _clientIndex = 0;					//	slot of the owner, see ClientSlot
+	std::atomic<uint32_t> _holderIndex = {NO_CLIENT_SLOT};	//	the owner from acquisition to submission, the server reclaims it from a dead one
+	offset_ptr<TransferChunkMetadata> _metadata;
+	offset_ptr<uint8_t> _ringPayload;
+	uint32_t _frameSize = 0;
+	uint32_t _frameStride = 0;
+	uint32_t _slotCount = 0;
+
+	//	producer line
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _ringHead = {0};
+	uint32_t _cachedRingTail = 0;
+	Heartbeat _producerHeartbeat;
+
+	//	consumer line
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _ringTail = {0};
+	uint32_t _ringReadIndex = 0;				//	the tail unless frames are lent
+	uint32_t _cachedRingHead = 0;
+	std::atomic<bool> _isRejected = {false};		//	the server gave up, the client stops at the next full ring
+	std::atomic<uint64_t> _blocksEnd = {0};		//	DEDUP_RANGE: file offset the server has written the blocks up to
+	std::atomic<uint64_t> _missedBlockOffset = {NO_MISSED_BLOCK};
+
+	alignas(CACHE_LINE_SIZE) FutexEvent _readEvent;
+	alignas(CACHE_LINE_SIZE) FutexEvent _writeEvent;
+
+private:
+	TransferFrame* GetFrame(uint32_t index) const;
 };
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <boost/thread.hpp>
+
+#include "SharedMemoryConsts.h"
+
+struct TransferRange;
+
+/*
+	Progress of one range of a large file: the length written and synced to disk so far and the
+	CRC32C of those bytes. It's also the record of the journal file.
+*/
+struct JournalRecord
+{
+	uint64_t _sourceKey = 0;					//	0 marks a free record
+	uint64_t _fileSize = 0;
+	uint64_t _rangeOffset = 0;
+	uint64_t _committedLength = 0;
+	uint64_t _updateSeconds = 0;				//	the least recently updated record is reused first
+	uint32_t _checksum = 0;
+	uint32_t _reserved = 0;
+};
+
+/*
+	Copy of the journal in the segment, so a client can look up where to resume without a round trip.
+	The server is the only writer; a record is published under a sequence lock (odd while it's updated).
+*/
+struct JournalTable
+{
+	struct Entry
+	{
+		std::atomic<uint32_t> _sequence = {0};
+		JournalRecord _record;
+	};
+
+	bool Find(uint64_t sourceKey, uint64_t fileSize, uint64_t rangeOffset, JournalRecord& record) const;
+
+	Entry _entries[JOURNAL_ENTRY_COUNT];
+};
+
+/*
+	Server side of resumable transfers. Ranges of files of JOURNAL_CHECKPOINT_SIZE and more are
+	written into a part file named after the source key and checkpointed every JOURNAL_CHECKPOINT_SIZE
+	bytes: the data is synced first, then the record is updated in the segment and in the journal file,
+	so a checkpoint never covers bytes a crash of either side (or of the host) can lose.
+	The journal file is read back on startup, a restarted server picks up the part files left behind.
+	It only exists while it holds records: it's created by the first resumable range and removed
+	once the last record is, so a server that never sees a large file leaves nothing behind.
+*/
+class TransferJournal
+{
+public:
+	TransferJournal(JournalTable* table, const std::string& filePath);
+	TransferJournal(const TransferJournal&) = delete;
+	TransferJournal(TransferJournal&) = delete;
+	TransferJournal(TransferJournal&&) = delete;
+	~TransferJournal();
+
+public:
+	static std::string GetPartName(uint64_t sourceKey);
+	bool Contains(uint64_t sourceKey);
+	bool Open(const TransferRange& range, uint32_t& entryIndex, uint32_t& checksum);
+	void Commit(uint32_t entryIndex, const TransferRange& range, uint64_t committedLength, uint32_t checksum);
+	void Remove(uint64_t sourceKey);
+
+private:
+	void Store(uint32_t entryIndex, const JournalRecord& record);
+	bool CreateFile();
+	void RemoveFile();
+
+private:
+	JournalTable* _table;
+	const std::string _filePath;
+	int _fileDescriptor = -1;
+	boost::mutex _mutex;
+};
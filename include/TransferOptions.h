@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+enum class TransferPriority : uint8_t
+{
+	URGENT,
+	NORMAL,
+	BULK,
+};
+
+constexpr uint32_t TRANSFER_PRIORITY_COUNT = 3;
+
+/*
+	Scheduling class of a transfer and its optional deadline, relative to the call that queues it.
+	An urgent transfer jumps the client's queue, isn't held to the client's share and is taken
+	by the server before anything else; the lower classes leave the chunks reserved for the ones
+	above them (--urgent-reserve, --normal-reserve) and yield to their waiting transfers.
+*/
+struct TransferOptions
+{
+	static bool ParsePriority(const std::string& value, TransferPriority& priority);
+	static const char* GetPriorityName(TransferPriority priority);
+
+	TransferPriority _priority = TransferPriority::NORMAL;
+	uint32_t _deadlineMilliseconds = 0;			//	0 means none
+};
+
+/*
+	A queued transfer as the client schedules it. A transfer with a deadline competes as urgent
+	once half of its time is gone without a chunk; its latency is accounted to the class it was
+	queued with, and finishing past the deadline counts as a miss.
+*/
+struct TransferTicket
+{
+	explicit TransferTicket(const TransferOptions& options);
+
+	TransferPriority GetPriority(uint64_t nowNanoseconds) const;
+	bool IsLate(uint64_t nowNanoseconds) const;
+
+	TransferPriority _priority;
+	uint64_t _queuedNanoseconds;
+	uint64_t _deadlineNanoseconds;				//	0 means none
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include <boost/thread.hpp>
+
+#include "Compression.h"
+
+struct TransferChunk;
+struct TransferFrame;
+struct Heartbeat;
+struct SharedMemoryMetrics;
+
+enum class TransferStreamStatus : uint8_t
+{
+	STREAMING,
+	FINISHED,
+	ABORTED,
+	TIMED_OUT,
+	CORRUPTED,
+};
+
+/*
+	Byte stream on top of the frame ring of a single chunk. Frames are filled (or drained) in place,
+	a frame is published to the other side only when it's full or flushed (or consumed). Waiting on a full
+	or an empty ring and the peer liveness checks are handled here for every kind of transfer.
+	Both sides account their traffic and wait time in the shared metrics when they're given.
+
+	Every frame carries the CRC32C of the stream up to its end, so the reader verifies the
+	content and the order of the frames in one pass and the final value of the chunk
+	catches frames lost at the tail; a corrupted frame is never handed out.
+
+	With a codec the writer stages a frame in private memory and compresses it into the ring slot,
+	so the caller keeps the same Reserve/Commit loop. A frame is compressed only if its sampled
+	prefix shrinks; each miss doubles the number of frames sent raw (straight into the slot, as
+	without a codec) before the next probe. The reader expands a compressed frame into its own
+	buffer and gives the slot back at once, so the client refills the ring while the frame is written out.
+
+	A full frame is published at once, but the reader is woken only once per batch of frames. The
+	batch is cut short when the server sleeps on the ring (and halves, since latency is what matters
+	then) or when the ring is full; a batch filled while the server was busy doubles the next one,
+	up to half the ring. A reader that is still spinning never waits for a batch, it sees each frame
+	as it's published. The reader may take every raw frame published behind the current one with
+	PeekFrames() and give them back together.
+*/
+class TransferStreamWriter
+{
+public:
+	TransferStreamWriter(TransferChunk* transferChunk, const Heartbeat& serverHeartbeat, SharedMemoryMetrics* metrics = nullptr,
+						CompressionCodec codec = CompressionCodec::NONE, int32_t compressionLevel = 0);
+	TransferStreamWriter(const TransferStreamWriter&) = delete;
+	TransferStreamWriter(TransferStreamWriter&) = delete;
+	TransferStreamWriter(TransferStreamWriter&&) = delete;
+
+public:
+	uint8_t* Reserve(size_t& countBytes);
+	void Commit(size_t countBytes);
+	bool Write(const void* data, size_t countBytes);
+	void Flush();
+	void Finish(bool isCompleted);
+	TransferStreamStatus GetStatus() const;
+
+private:
+	bool AcquireFrame();
+	void PublishFrame();
+	void PackStagedFrame();
+	void WakeReader();
+
+private:
+	TransferChunk* _transferChunk;
+	const Heartbeat& _serverHeartbeat;
+	SharedMemoryMetrics* _metrics;
+	TransferFrame* _frame = nullptr;
+	uint32_t _streamChecksum = 0;
+	TransferStreamStatus _status = TransferStreamStatus::STREAMING;
+	const CompressionCodec _codec;
+	const int32_t _compressionLevel;
+	std::vector<uint8_t> _stagedFrame;
+	uint32_t _stagedBytes = 0;
+	bool _isStaged = false;
+	bool _isCompressible = false;				//	the last frame compressed, the next one skips the probe
+	uint32_t _rawFramesLeft = 0;
+	uint32_t _backoffFrames = 0;
+	uint32_t _batchFrames = 0;					//	published since the reader was last woken
+	uint32_t _batchLimit = 1;
+};
+
+class TransferStreamReader;
+
+/*
+	Frame the reader lends out instead of consuming it, see TransferStreamReader::Lend().
+	A raw frame stays in its ring slot until the loan is released (or destroyed), a compressed one
+	is kept in the buffer it was expanded into. A loan has a single owner, any thread may release it.
+*/
+class FrameLoan
+{
+	friend class TransferStreamReader;
+
+public:
+	FrameLoan(TransferStreamReader& reader, const uint8_t* data, size_t countBytes, uint32_t ringSequence, std::vector<uint8_t>&& buffer);
+	FrameLoan(const FrameLoan&) = delete;
+	FrameLoan(FrameLoan&) = delete;
+	FrameLoan(FrameLoan&&) = delete;
+	~FrameLoan();
+
+public:
+	const uint8_t* GetData() const;
+	size_t GetSize() const;
+	void Release();
+
+private:
+	TransferStreamReader* _reader;				//	null once released
+	const uint8_t* _data;
+	size_t _countBytes;
+	uint32_t _ringSequence;
+	std::vector<uint8_t> _buffer;				//	empty for a frame in the ring
+};
+
+/*
+	Lending: Lend() hands out what is left of the frame Peek() returned and moves on without giving
+	its slot back. Slots come back to the client in ring order, so a frame consumed after a lent one
+	waits for it; at most maxLoans frames are out at a time, Lend() blocks for a returned one beyond that.
+	Loans outlive Close() but not the reader: WaitForLoans() comes before the chunk is released.
+*/
+class TransferStreamReader
+{
+	friend class FrameLoan;
+
+public:
+	TransferStreamReader(TransferChunk* transferChunk, SharedMemoryMetrics* metrics = nullptr);
+	TransferStreamReader(const TransferStreamReader&) = delete;
+	TransferStreamReader(TransferStreamReader&) = delete;
+	TransferStreamReader(TransferStreamReader&&) = delete;
+	~TransferStreamReader();
+
+public:
+	const uint8_t* Peek(size_t& countBytes);
+	void Consume(size_t countBytes);
+	uint32_t PeekFrames(struct iovec* vectors, uint32_t maxVectors);
+	void ConsumeFrames();
+	bool Read(void* data, size_t countBytes);
+	std::unique_ptr<FrameLoan> Lend(uint32_t maxLoans);
+	void WaitForLoans();
+	void Close();
+	TransferStreamStatus GetStatus() const;
+
+private:
+	bool UnpackFrame();
+	void ReleaseFrame();
+	void ReleaseRingFrames(uint32_t countFrames);
+	void Return(FrameLoan& loan);
+
+private:
+	TransferChunk* _transferChunk;
+	SharedMemoryMetrics* _metrics;
+	const TransferFrame* _frame = nullptr;		//	the slot being read, if the data is still in the ring
+	const uint8_t* _frameData = nullptr;
+	uint32_t _frameBytes = 0;
+	uint32_t _frameOffset = 0;
+	uint32_t _gatheredFrames = 0;				//	frames behind the current one returned by PeekFrames()
+	uint32_t _streamChecksum = 0;
+	std::vector<uint8_t> _unpackedFrame;
+	TransferStreamStatus _status = TransferStreamStatus::STREAMING;
+
+	//	lending
+	bool _isLending = false;					//	set by the first loan, frames are released through _takenFrames since
+	boost::mutex _loanMutex;
+	boost::condition_variable _cvLoanReturned;
+	std::deque<bool> _takenFrames;				//	frames off the ring from the tail on, true while lent
+	uint32_t _ringSequence = 0;					//	frames taken off the ring
+	uint32_t _countLoans = 0;
+	std::vector<std::vector<uint8_t>> _spareBuffers;	//	expanded frames given back by loans
+};
@@ -1,11 +1,11 @@
 #include <cstring>
 #include <cstdlib>
 #include <ctime>
+#include <csignal>
 
 #include <boost/interprocess/shared_memory_object.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
-#include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 
 #include <iostream>
@@ -16,55 +16,97 @@
 #include "TransferChunk.h"
 #include "SharedMemoryClient.h"
 #include "SharedMemoryServer.h"
+#include "SharedMemoryMonitor.h"
 #include "SharedMemoryConsts.h"
+#include "SharedMemoryConfig.h"
 #include "Logger.h"
 
 int main(int argc, char *argv[])
 {
-	std::string threadIdString = boost::lexical_cast<std::string>(boost::this_thread::get_id());
 	if(argc < 2)
 	{
-		TRACE("[%ld] [%s] The application takes at least 2 params: client/server\n", getMicrotime(), threadIdString.c_str());
+		TRACE_ERROR("The application takes at least 2 params: client/server\n");
 		return 0;
 	}
 
 	if(strcmp(argv[1], "client") == 0)
 	{
+		SharedMemoryConfig config;
 		std::vector<std::string> filePathsContainer;
 		for(int i = 2; i < argc; ++i)
+		{
+			if(strncmp(argv[i], "--", 2) == 0)
+			{
+				if(!config.ParseOption(argv[i]))
+					return 0;
+				continue;
+			}
 			filePathsContainer.emplace_back(argv[i]);
+		}
 
 		if(filePathsContainer.size() == 0)
 		{
-			TRACE("[%ld] [%s] The client application takes file paths for transmitting to server\n", getMicrotime(), threadIdString.c_str());
+			TRACE_ERROR("The client application takes files, directories or globs for transmitting to server\n");
 			return 0;
 		}
 
-		TRACE("[%ld] [%s] Shared memory client\n", getMicrotime(), threadIdString.c_str());
+		TRACE("Shared memory client\n");
 
-		SharedMemoryClient sharedMemoryClient;
+		SharedMemoryClient sharedMemoryClient(config);
 		sharedMemoryClient.TransferFiles(filePathsContainer);
-
-		while (sharedMemoryClient.GetClientStatus() == SharedMemoryClientStatus::TRANSFERRING)
-		{
-			sleep(MAIN_THREAD_SLEEP_TIME);
-		}
+		sharedMemoryClient.WaitForCompletion();
 	}
 	else if(strcmp(argv[1], "server") == 0)
 	{
-		TRACE("[%ld] [%s] Shared memory server\n", getMicrotime(), threadIdString.c_str());
+		SharedMemoryConfig config;
+		if(!config.ParseArguments(argc, argv, 2))
+		{
+			TRACE("Server options: --segment-size=<size> --frame-size=<size> --slot-count=<power of two> --threads=<count> --config=<file>\n");
+			return 0;
+		}
+
+		TRACE("Shared memory server\n");
+
+		//	termination signals are blocked in every thread and received here synchronously
+		sigset_t terminationSignals;
+		sigemptyset(&terminationSignals);
+		sigaddset(&terminationSignals, SIGINT);
+		sigaddset(&terminationSignals, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &terminationSignals, nullptr);
 
-		SharedMemoryServer sharedMemoryServer;
+		SharedMemoryServer sharedMemoryServer(config);
 		sharedMemoryServer.Start();
 
-		while(sharedMemoryServer.GetServerStatus() == SharedMemoryServerStatus::RUNNING)
+		if(sharedMemoryServer.GetServerStatus() == SharedMemoryServerStatus::RUNNING)
+		{
+			int signal = 0;
+			sigwait(&terminationSignals, &signal);
+			TRACE("Signal %d received, the server is stopping\n", signal);
+		}
+		sharedMemoryServer.Stop();
+	}
+	else if(strcmp(argv[1], "stats") == 0)
+	{
+		SharedMemoryConfig config;
+		if(!config.ParseArguments(argc, argv, 2))
+		{
+			TRACE("Stats options: --stats-interval=<milliseconds>\n");
+			return 0;
+		}
+
+		try
+		{
+			SharedMemoryMonitor sharedMemoryMonitor(config);
+			sharedMemoryMonitor.Run();
+		}
+		catch(interprocess_exception& ex)
 		{
-			sleep(MAIN_THREAD_SLEEP_TIME);
+			TRACE_ERROR("Unable to attach to the server: %s\n", ex.what());
 		}
 	}
 	else
 	{
-		TRACE("[%ld] [%s] The first paramenter isn't recognized. It should be 'client' or 'server'\n", getMicrotime(), threadIdString.c_str());
+		TRACE_ERROR("The first paramenter isn't recognized. It should be 'client', 'server' or 'stats'\n");
 		return 0;
 	}
 
@@ -0,0 +1,49 @@
+#include "ChunkBitmap.h"
+
+#include <new>
+
+uint32_t ChunkBitmap::GetWordCount(uint32_t bitCount)
+{
+	return (bitCount + 63) / 64;
+}
+
+void ChunkBitmap::Attach(std::atomic<uint64_t>* words, uint32_t bitCount)
+{
+	_words = words;
+	_bitCount = bitCount;
+	_wordCount = GetWordCount(bitCount);
+	for(uint32_t i = 0; i < _wordCount; ++i)
+		new (&words[i]) std::atomic<uint64_t>(0);
+
+	//	bits past the last chunk are permanently taken
+	if(bitCount % 64)
+		words[_wordCount - 1].store(~uint64_t(0) << (bitCount % 64));
+}
+
+bool ChunkBitmap::Acquire(uint32_t& index)
+{
+	//	start from the word where the previous allocation succeeded to spread the clients
+	uint32_t firstWord = _searchHint.load(std::memory_order_relaxed);
+	for(uint32_t i = 0; i < _wordCount; ++i)
+	{
+		uint32_t wordIndex = (firstWord + i) % _wordCount;
+		std::atomic<uint64_t>& word = _words[wordIndex];
+		uint64_t value = word.load(std::memory_order_relaxed);
+		while(value != ~uint64_t(0))
+		{
+			uint32_t bit = static_cast<uint32_t>(__builtin_ctzll(~value));
+			if(word.compare_exchange_weak(value, value | (uint64_t(1) << bit), std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				_searchHint.store(wordIndex, std::memory_order_relaxed);
+				index = wordIndex * 64 + bit;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void ChunkBitmap::Release(uint32_t index)
+{
+	_words[index / 64].fetch_and(~(uint64_t(1) << (index % 64)), std::memory_order_release);
+}
@@ -0,0 +1,76 @@
+#include "ClientSlot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <signal.h>
+
+namespace
+{
+	constexpr uint32_t START_TIME_FIELD_INDEX = 22;		//	of /proc/<pid>/stat, counted from 1
+	constexpr uint32_t STATE_FIELD_INDEX = 3;			//	the first one after the parenthesized command name
+}
+
+bool ClientSlot::IsRegistered() const
+{
+	const ClientSlotStatus status = _status.load(std::memory_order_acquire);
+	return status == ClientSlotStatus::ACTIVE || status == ClientSlotStatus::CLOSING;
+}
+
+bool ClientSlot::IsProcessAlive() const
+{
+	//	EPERM still means the process exists, it only belongs to another user
+	if(kill(static_cast<pid_t>(_processId), 0) != 0 && errno == ESRCH)
+		return false;
+
+	//	the pid may have been given to another process since
+	const uint64_t processStartTime = GetProcessStartTime(_processId);
+	return _processStartTime == 0 || processStartTime == 0 || processStartTime == _processStartTime;
+}
+
+uint32_t ClientSlot::GetChunkLimit() const
+{
+	const uint32_t chunkShare = _chunkShare.load(std::memory_order_relaxed);
+	return _chunkQuota ? std::min(chunkShare, _chunkQuota) : chunkShare;
+}
+
+uint32_t ClientSlot::GetWaitingCount() const
+{
+	uint32_t waitingCount = 0;
+	for(const std::atomic<uint32_t>& classWaitingCount : _waitingCounts)
+		waitingCount += classWaitingCount.load(std::memory_order_relaxed);
+	return waitingCount;
+}
+
+uint64_t ClientSlot::GetProcessStartTime(uint32_t processId)
+{
+	const std::string path = "/proc/" + std::to_string(processId) + "/stat";
+	FILE* file = fopen(path.c_str(), "re");
+	if(!file)
+		return 0;
+	char buffer[1024];
+	const size_t readSize = fread(buffer, 1, sizeof(buffer) - 1, file);
+	fclose(file);
+	buffer[readSize] = 0;
+
+	//	the command name may hold spaces and parentheses itself, the fields go on after the last ')'
+	const char* field = strrchr(buffer, ')');
+	if(!field)
+		return 0;
+	++field;
+	for(uint32_t fieldIndex = STATE_FIELD_INDEX; fieldIndex <= START_TIME_FIELD_INDEX; ++fieldIndex)
+	{
+		while(*field == ' ')
+			++field;
+		if(fieldIndex == START_TIME_FIELD_INDEX)
+			return strtoull(field, nullptr, 10);
+		field = strchr(field, ' ');
+		if(!field)
+			return 0;
+	}
+	return 0;
+}
@@ -0,0 +1,343 @@
+#include "Compression.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+	constexpr int32_t DEFAULT_LZ4_ACCELERATION = 1;
+	constexpr int32_t DEFAULT_ZSTD_LEVEL = 1;					//	low levels keep zstd close to disk speed
+
+#ifndef HAVE_LIBLZ4
+	//	LZ4 block format: sequences of a token (literal length << 4 | match length - 4), literals and a 16-bit
+	//	back offset; the last sequence has literals only. A match ends 5 bytes before the end of the block
+	//	at least and starts 12 bytes before it at least, that's what a conforming decoder relies on.
+	constexpr size_t LZ4_MIN_MATCH = 4;
+	constexpr size_t LZ4_LAST_LITERALS = 5;
+	constexpr size_t LZ4_MATCH_FIND_LIMIT = 12;
+	constexpr size_t LZ4_MAX_OFFSET = 65535;
+	constexpr uint32_t LZ4_HASH_LOG = 14;
+	constexpr uint32_t LZ4_SKIP_TRIGGER = 6;					//	the step grows every 64 bytes without a match
+
+	uint32_t ReadWord(const uint8_t* data)
+	{
+		uint32_t word;
+		memcpy(&word, data, sizeof(word));
+		return word;
+	}
+
+	//	common prefix length of two sequences, compared a machine word at a time
+	size_t CountMatch(const uint8_t* input, const uint8_t* match, const uint8_t* inputLimit)
+	{
+		const uint8_t* const inputStart = input;
+		while(input + sizeof(uint64_t) <= inputLimit)
+		{
+			uint64_t inputWord, matchWord;
+			memcpy(&inputWord, input, sizeof(inputWord));
+			memcpy(&matchWord, match, sizeof(matchWord));
+			if(const uint64_t difference = inputWord ^ matchWord)
+				return input - inputStart + (__builtin_ctzll(difference) >> 3);
+			input += sizeof(uint64_t);
+			match += sizeof(uint64_t);
+		}
+		while(input < inputLimit && *input == *match)
+		{
+			++input;
+			++match;
+		}
+		return input - inputStart;
+	}
+
+	uint32_t HashWord(uint32_t word)
+	{
+		return (word * 2654435761u) >> (32 - LZ4_HASH_LOG);
+	}
+
+	uint8_t* WriteLength(uint8_t* output, size_t length)
+	{
+		for(; length >= 255; length -= 255)
+			*output++ = 255;
+		*output++ = static_cast<uint8_t>(length);
+		return output;
+	}
+
+	//	nullptr if the sequence doesn't fit
+	uint8_t* WriteSequence(uint8_t* output, uint8_t* outputEnd, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+	{
+		if(static_cast<size_t>(outputEnd - output) < 1 + literalLength + literalLength / 255 + 1 + 2 + matchLength / 255 + 1)
+			return nullptr;
+
+		uint8_t* token = output++;
+		*token = static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4);
+		if(literalLength >= 15)
+			output = WriteLength(output, literalLength - 15);
+		memcpy(output, literals, literalLength);
+		output += literalLength;
+
+		if(matchLength)
+		{
+			*output++ = static_cast<uint8_t>(offset);
+			*output++ = static_cast<uint8_t>(offset >> 8);
+			matchLength -= LZ4_MIN_MATCH;
+			*token |= static_cast<uint8_t>(std::min<size_t>(matchLength, 15));
+			if(matchLength >= 15)
+				output = WriteLength(output, matchLength - 15);
+		}
+		return output;
+	}
+
+	size_t CompressLz4Block(const uint8_t* source, size_t sourceBytes, uint8_t* destination, size_t destinationBytes)
+	{
+		//	positions left over from a previous block are harmless: a candidate is accepted only if its bytes match
+		static thread_local uint32_t hashTable[1u << LZ4_HASH_LOG];
+
+		const uint8_t* input = source;
+		const uint8_t* anchor = source;
+		const uint8_t* const inputEnd = source + sourceBytes;
+		uint8_t* output = destination;
+		uint8_t* const outputEnd = destination + destinationBytes;
+
+		if(sourceBytes > LZ4_MATCH_FIND_LIMIT)
+		{
+			const uint8_t* const matchFindLimit = inputEnd - LZ4_MATCH_FIND_LIMIT;
+			const uint8_t* const matchEndLimit = inputEnd - LZ4_LAST_LITERALS;
+			hashTable[HashWord(ReadWord(input))] = 0;
+			++input;
+
+			while(input < matchFindLimit)
+			{
+				const uint32_t word = ReadWord(input);
+				const uint32_t position = static_cast<uint32_t>(input - source);
+				uint32_t& slot = hashTable[HashWord(word)];
+				const uint32_t matchPosition = slot;
+				slot = position;
+				if(matchPosition >= position || position - matchPosition > LZ4_MAX_OFFSET || ReadWord(source + matchPosition) != word)
+				{
+					input += 1 + ((input - anchor) >> LZ4_SKIP_TRIGGER);
+					continue;
+				}
+
+				const uint8_t* match = source + matchPosition;
+
+				while(input > anchor && match > source && input[-1] == match[-1])
+				{
+					--input;
+					--match;
+				}
+				const size_t matchLength = LZ4_MIN_MATCH + CountMatch(input + LZ4_MIN_MATCH, match + LZ4_MIN_MATCH, matchEndLimit);
+
+				output = WriteSequence(output, outputEnd, anchor, input - anchor, input - match, matchLength);
+				if(!output)
+					return 0;
+				input += matchLength;
+				anchor = input;
+				if(input < matchFindLimit)
+					hashTable[HashWord(ReadWord(input - 2))] = static_cast<uint32_t>(input - 2 - source);
+			}
+		}
+
+		output = WriteSequence(output, outputEnd, anchor, inputEnd - anchor, 0, 0);
+		return output ? static_cast<size_t>(output - destination) : 0;
+	}
+
+	bool ReadLength(const uint8_t*& input, const uint8_t* inputEnd, size_t& length)
+	{
+		uint8_t byte = 255;
+		while(byte == 255)
+		{
+			if(input == inputEnd)
+				return false;
+			byte = *input++;
+			length += byte;
+		}
+		return true;
+	}
+
+	bool DecompressLz4Block(const uint8_t* source, size_t sourceBytes, uint8_t* destination, size_t destinationBytes)
+	{
+		const uint8_t* input = source;
+		const uint8_t* const inputEnd = source + sourceBytes;
+		uint8_t* output = destination;
+		uint8_t* const outputEnd = destination + destinationBytes;
+
+		while(input < inputEnd)
+		{
+			const uint8_t token = *input++;
+			size_t literalLength = token >> 4;
+			if(literalLength == 15 && !ReadLength(input, inputEnd, literalLength))
+				return false;
+			if(literalLength > static_cast<size_t>(inputEnd - input) || literalLength > static_cast<size_t>(outputEnd - output))
+				return false;
+			memcpy(output, input, literalLength);
+			input += literalLength;
+			output += literalLength;
+			if(input == inputEnd)
+				break;
+
+			if(inputEnd - input < 2)
+				return false;
+			const size_t offset = input[0] | (input[1] << 8);
+			input += 2;
+			size_t matchLength = token & 15;
+			if(matchLength == 15 && !ReadLength(input, inputEnd, matchLength))
+				return false;
+			matchLength += LZ4_MIN_MATCH;
+			if(offset == 0 || offset > static_cast<size_t>(output - destination) || matchLength > static_cast<size_t>(outputEnd - output))
+				return false;
+
+			const uint8_t* match = output - offset;
+			if(offset >= matchLength)
+			{
+				memcpy(output, match, matchLength);
+				output += matchLength;
+			}
+			else
+			{
+				//	overlapping copy repeats the last offset bytes
+				for(size_t i = 0; i < matchLength; ++i)
+					*output++ = *match++;
+			}
+		}
+		return output == outputEnd;
+	}
+#endif
+
+#ifdef HAVE_LIBZSTD
+	struct ZstdContexts
+	{
+		ZstdContexts() : _compression(ZSTD_createCCtx()), _decompression(ZSTD_createDCtx()) {}
+		~ZstdContexts() { ZSTD_freeCCtx(_compression); ZSTD_freeDCtx(_decompression); }
+
+		ZSTD_CCtx* _compression;
+		ZSTD_DCtx* _decompression;
+	};
+
+	ZstdContexts& GetZstdContexts()
+	{
+		static thread_local ZstdContexts contexts;
+		return contexts;
+	}
+#endif
+}
+
+bool Compression::IsAvailable(CompressionCodec codec)
+{
+	switch(codec)
+	{
+		case CompressionCodec::NONE:
+		case CompressionCodec::LZ4:
+			return true;
+		case CompressionCodec::ZSTD:
+#ifdef HAVE_LIBZSTD
+			return true;
+#else
+			return false;
+#endif
+	}
+	return false;
+}
+
+bool Compression::Parse(const std::string& value, CompressionCodec& codec, int32_t& level)
+{
+	std::string::size_type separator = value.find(':');
+	std::string name = value.substr(0, separator);
+	if(name == "none")
+		codec = CompressionCodec::NONE;
+	else if(name == "lz4")
+		codec = CompressionCodec::LZ4;
+	else if(name == "zstd")
+		codec = CompressionCodec::ZSTD;
+	else
+		return false;
+
+	level = 0;
+	if(separator != std::string::npos)
+	{
+		char* end = nullptr;
+		long number = std::strtol(value.c_str() + separator + 1, &end, 10);
+		if(end == value.c_str() + separator + 1 || *end != '\0' || number < 1 || number > 19)
+			return false;
+		level = static_cast<int32_t>(number);
+	}
+	return true;
+}
+
+const char* Compression::GetName(CompressionCodec codec)
+{
+	switch(codec)
+	{
+		case CompressionCodec::NONE: return "none";
+		case CompressionCodec::LZ4: return "lz4";
+		case CompressionCodec::ZSTD: return "zstd";
+	}
+	return "unknown";
+}
+
+size_t Compression::Compress(CompressionCodec codec, int32_t level, const uint8_t* source, size_t sourceBytes, uint8_t* destination, size_t destinationBytes)
+{
+	switch(codec)
+	{
+		case CompressionCodec::LZ4:
+		{
+#ifdef HAVE_LIBLZ4
+			int countBytes = LZ4_compress_fast(reinterpret_cast<const char*>(source), reinterpret_cast<char*>(destination),
+											static_cast<int>(sourceBytes), static_cast<int>(destinationBytes),
+											level ? level : DEFAULT_LZ4_ACCELERATION);
+			return countBytes > 0 ? static_cast<size_t>(countBytes) : 0;
+#else
+			(void)level;
+			return CompressLz4Block(source, sourceBytes, destination, destinationBytes);
+#endif
+		}
+		case CompressionCodec::ZSTD:
+		{
+#ifdef HAVE_LIBZSTD
+			size_t countBytes = ZSTD_compressCCtx(GetZstdContexts()._compression, destination, destinationBytes,
+												source, sourceBytes, level ? level : DEFAULT_ZSTD_LEVEL);
+			return ZSTD_isError(countBytes) ? 0 : countBytes;
+#else
+			return 0;
+#endif
+		}
+		case CompressionCodec::NONE:
+			break;
+	}
+	return 0;
+}
+
+bool Compression::Decompress(CompressionCodec codec, const uint8_t* source, size_t sourceBytes, uint8_t* destination, size_t destinationBytes)
+{
+	switch(codec)
+	{
+		case CompressionCodec::LZ4:
+		{
+#ifdef HAVE_LIBLZ4
+			int countBytes = LZ4_decompress_safe(reinterpret_cast<const char*>(source), reinterpret_cast<char*>(destination),
+												static_cast<int>(sourceBytes), static_cast<int>(destinationBytes));
+			return countBytes >= 0 && static_cast<size_t>(countBytes) == destinationBytes;
+#else
+			return DecompressLz4Block(source, sourceBytes, destination, destinationBytes);
+#endif
+		}
+		case CompressionCodec::ZSTD:
+		{
+#ifdef HAVE_LIBZSTD
+			size_t countBytes = ZSTD_decompressDCtx(GetZstdContexts()._decompression, destination, destinationBytes, source, sourceBytes);
+			return !ZSTD_isError(countBytes) && countBytes == destinationBytes;
+#else
+			return false;
+#endif
+		}
+		case CompressionCodec::NONE:
+			break;
+	}
+	return false;
+}
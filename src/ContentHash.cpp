@@ -0,0 +1,111 @@
+#include "ContentHash.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	constexpr uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ull;
+	constexpr uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+	constexpr uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ull;
+	constexpr uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+	constexpr uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ull;
+	constexpr uint64_t LOW_SEED = 0;
+	constexpr uint64_t HIGH_SEED = 0x9E3779B97F4A7C15ull;
+
+	uint64_t RotateLeft(uint64_t value, uint32_t count)
+	{
+		return (value << count) | (value >> (64 - count));
+	}
+
+	uint64_t Read64(const uint8_t* data)
+	{
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	uint32_t Read32(const uint8_t* data)
+	{
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	uint64_t Round(uint64_t accumulator, uint64_t input)
+	{
+		accumulator += input * XXH_PRIME64_2;
+		return RotateLeft(accumulator, 31) * XXH_PRIME64_1;
+	}
+
+	uint64_t MergeRound(uint64_t hash, uint64_t accumulator)
+	{
+		hash ^= Round(0, accumulator);
+		return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+
+	//	XXH64 as specified (little-endian reads), so a digest can be checked against the reference tools
+	uint64_t Xxh64(const uint8_t* data, size_t countBytes, uint64_t seed)
+	{
+		const uint8_t* const end = data + countBytes;
+		uint64_t hash;
+		if(countBytes >= 32)
+		{
+			uint64_t accumulators[4] = {seed + XXH_PRIME64_1 + XXH_PRIME64_2, seed + XXH_PRIME64_2, seed, seed - XXH_PRIME64_1};
+			for(; data + 32 <= end; data += 32)
+			{
+				accumulators[0] = Round(accumulators[0], Read64(data));
+				accumulators[1] = Round(accumulators[1], Read64(data + 8));
+				accumulators[2] = Round(accumulators[2], Read64(data + 16));
+				accumulators[3] = Round(accumulators[3], Read64(data + 24));
+			}
+			hash = RotateLeft(accumulators[0], 1) + RotateLeft(accumulators[1], 7) + RotateLeft(accumulators[2], 12) + RotateLeft(accumulators[3], 18);
+			for(uint64_t accumulator : accumulators)
+				hash = MergeRound(hash, accumulator);
+		}
+		else
+			hash = seed + XXH_PRIME64_5;
+
+		hash += countBytes;
+		for(; data + 8 <= end; data += 8)
+			hash = RotateLeft(hash ^ Round(0, Read64(data)), 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+		if(data + 4 <= end)
+		{
+			hash = RotateLeft(hash ^ (Read32(data) * XXH_PRIME64_1), 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+			data += 4;
+		}
+		for(; data < end; ++data)
+			hash = RotateLeft(hash ^ (*data * XXH_PRIME64_5), 11) * XXH_PRIME64_1;
+
+		hash ^= hash >> 33;
+		hash *= XXH_PRIME64_2;
+		hash ^= hash >> 29;
+		hash *= XXH_PRIME64_3;
+		return hash ^ (hash >> 32);
+	}
+}
+
+ContentHash ContentHash::Compute(const void* data, size_t countBytes)
+{
+	ContentHash hash;
+	hash._low = Xxh64(static_cast<const uint8_t*>(data), countBytes, LOW_SEED);
+	hash._high = Xxh64(static_cast<const uint8_t*>(data), countBytes, HIGH_SEED);
+	return hash;
+}
+
+bool ContentHash::operator==(const ContentHash& other) const
+{
+	return _low == other._low && _high == other._high;
+}
+
+bool ContentHash::operator!=(const ContentHash& other) const
+{
+	return !(*this == other);
+}
+
+std::string ContentHash::ToString() const
+{
+	char text[33];
+	snprintf(text, sizeof(text), "%016llx%016llx", static_cast<unsigned long long>(_high), static_cast<unsigned long long>(_low));
+	return text;
+}
@@ -0,0 +1,246 @@
+#include "Crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE_TARGET __attribute__((target("sse4.2")))
+#define CRC32C_BYTE(crc, value) _mm_crc32_u8(static_cast<uint32_t>(crc), value)
+#define CRC32C_WORD(crc, value) _mm_crc32_u64(crc, value)
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_HARDWARE_TARGET
+#define CRC32C_BYTE(crc, value) __crc32cb(static_cast<uint32_t>(crc), value)
+#define CRC32C_WORD(crc, value) __crc32cd(static_cast<uint32_t>(crc), value)
+#endif
+
+namespace
+{
+	constexpr uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;		//	reflected
+	constexpr size_t LONG_BLOCK_SIZE = 8192;
+	constexpr size_t SHORT_BLOCK_SIZE = 256;
+
+	uint32_t MultiplyMatrix(const uint32_t* matrix, uint32_t vector)
+	{
+		uint32_t sum = 0;
+		for(; vector; vector >>= 1, ++matrix)
+		{
+			if(vector & 1)
+				sum ^= *matrix;
+		}
+		return sum;
+	}
+
+	void SquareMatrix(uint32_t* square, const uint32_t* matrix)
+	{
+		for(uint32_t i = 0; i < 32; ++i)
+			square[i] = MultiplyMatrix(matrix, matrix[i]);
+	}
+
+	//	tables applying "append countBytes zero bytes" to a crc, one per byte of the crc
+	struct ShiftTables
+	{
+		explicit ShiftTables(size_t countBytes)
+		{
+			//	operator for a single zero bit, then squared up to countBytes (a power of two) zero bytes
+			uint32_t odd[32];
+			uint32_t even[32];
+			odd[0] = CRC32C_POLYNOMIAL;
+			for(uint32_t i = 1; i < 32; ++i)
+				odd[i] = 1u << (i - 1);
+			SquareMatrix(even, odd);
+			SquareMatrix(odd, even);
+
+			const uint32_t* shift = nullptr;
+			while(true)
+			{
+				SquareMatrix(even, odd);
+				countBytes >>= 1;
+				if(!countBytes)
+				{
+					shift = even;
+					break;
+				}
+				SquareMatrix(odd, even);
+				countBytes >>= 1;
+				if(!countBytes)
+				{
+					shift = odd;
+					break;
+				}
+			}
+
+			for(uint32_t i = 0; i < 256; ++i)
+			{
+				for(uint32_t j = 0; j < 4; ++j)
+					_tables[j][i] = MultiplyMatrix(shift, i << (8 * j));
+			}
+		}
+
+		uint32_t Shift(uint32_t crc) const
+		{
+			return _tables[0][crc & 0xFF] ^ _tables[1][(crc >> 8) & 0xFF]
+					^ _tables[2][(crc >> 16) & 0xFF] ^ _tables[3][crc >> 24];
+		}
+
+		uint32_t _tables[4][256];
+	};
+
+	struct SlicingTables
+	{
+		SlicingTables()
+		{
+			for(uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t crc = i;
+				for(uint32_t j = 0; j < 8; ++j)
+					crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0u - (crc & 1)));
+				_tables[0][i] = crc;
+			}
+			for(uint32_t i = 0; i < 256; ++i)
+			{
+				for(uint32_t j = 1; j < 8; ++j)
+					_tables[j][i] = (_tables[j - 1][i] >> 8) ^ _tables[0][_tables[j - 1][i] & 0xFF];
+			}
+		}
+
+		uint32_t _tables[8][256];
+	};
+
+	const SlicingTables slicingTables;
+
+#ifdef CRC32C_HARDWARE_TARGET
+	const ShiftTables longShiftTables(LONG_BLOCK_SIZE);
+	const ShiftTables shortShiftTables(SHORT_BLOCK_SIZE);
+
+	//	three interleaved streams over blocks of blockSize bytes
+	CRC32C_HARDWARE_TARGET
+	const uint8_t* UpdateBlocks(uint64_t& crc, const uint8_t* next, size_t& countBytes, size_t blockSize, const ShiftTables& shiftTables)
+	{
+		while(countBytes >= 3 * blockSize)
+		{
+			uint64_t crc1 = 0;
+			uint64_t crc2 = 0;
+			const uint8_t* end = next + blockSize;
+			do
+			{
+				uint64_t word0, word1, word2;
+				memcpy(&word0, next, sizeof(uint64_t));
+				memcpy(&word1, next + blockSize, sizeof(uint64_t));
+				memcpy(&word2, next + 2 * blockSize, sizeof(uint64_t));
+				crc = CRC32C_WORD(crc, word0);
+				crc1 = CRC32C_WORD(crc1, word1);
+				crc2 = CRC32C_WORD(crc2, word2);
+				next += sizeof(uint64_t);
+			}
+			while(next < end);
+
+			crc = shiftTables.Shift(static_cast<uint32_t>(crc)) ^ crc1;
+			crc = shiftTables.Shift(static_cast<uint32_t>(crc)) ^ crc2;
+			next += 2 * blockSize;
+			countBytes -= 3 * blockSize;
+		}
+		return next;
+	}
+
+	CRC32C_HARDWARE_TARGET
+	uint32_t UpdateHardware(uint32_t crc, const void* data, size_t countBytes)
+	{
+		const uint8_t* next = static_cast<const uint8_t*>(data);
+		uint64_t crc0 = crc ^ 0xFFFFFFFFu;
+		while(countBytes && (reinterpret_cast<uintptr_t>(next) & 7) != 0)
+		{
+			crc0 = CRC32C_BYTE(crc0, *next++);
+			--countBytes;
+		}
+
+		next = UpdateBlocks(crc0, next, countBytes, LONG_BLOCK_SIZE, longShiftTables);
+		next = UpdateBlocks(crc0, next, countBytes, SHORT_BLOCK_SIZE, shortShiftTables);
+		for(; countBytes >= sizeof(uint64_t); countBytes -= sizeof(uint64_t), next += sizeof(uint64_t))
+		{
+			uint64_t word;
+			memcpy(&word, next, sizeof(uint64_t));
+			crc0 = CRC32C_WORD(crc0, word);
+		}
+		while(countBytes--)
+			crc0 = CRC32C_BYTE(crc0, *next++);
+		return static_cast<uint32_t>(crc0) ^ 0xFFFFFFFFu;
+	}
+#endif
+
+	typedef uint32_t (*UpdateFunction)(uint32_t crc, const void* data, size_t countBytes);
+
+	UpdateFunction GetUpdateFunction()
+	{
+#if defined(__x86_64__)
+		if(__builtin_cpu_supports("sse4.2"))
+			return &UpdateHardware;
+#elif defined(CRC32C_HARDWARE_TARGET)
+		return &UpdateHardware;
+#endif
+		return &Crc32c::UpdatePortable;
+	}
+}
+
+uint32_t Crc32c::Update(uint32_t crc, const void* data, size_t countBytes)
+{
+	static const UpdateFunction updateFunction = GetUpdateFunction();
+	return updateFunction(crc, data, countBytes);
+}
+
+uint32_t Crc32c::UpdatePortable(uint32_t crc, const void* data, size_t countBytes)
+{
+	const uint8_t* next = static_cast<const uint8_t*>(data);
+	const uint32_t (&tables)[8][256] = slicingTables._tables;
+	crc ^= 0xFFFFFFFFu;
+	for(; countBytes >= 8; countBytes -= 8, next += 8)
+	{
+		uint32_t low, high;
+		memcpy(&low, next, sizeof(uint32_t));
+		memcpy(&high, next + 4, sizeof(uint32_t));
+		low ^= crc;
+		crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24]
+			^ tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^ tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+	}
+	while(countBytes--)
+		crc = (crc >> 8) ^ tables[0][(crc ^ *next++) & 0xFF];
+	return crc ^ 0xFFFFFFFFu;
+}
+
+uint32_t Crc32c::Combine(uint32_t crc, uint32_t nextCrc, uint64_t nextBytes)
+{
+	if(nextBytes == 0)
+		return crc;
+
+	//	the crc is shifted over nextBytes zero bytes by operators squared from a single zero bit (as zlib's crc32_combine)
+	uint32_t evenOperator[32];
+	uint32_t oddOperator[32];
+	oddOperator[0] = CRC32C_POLYNOMIAL;
+	for(uint32_t i = 1; i < 32; ++i)
+		oddOperator[i] = 1u << (i - 1);
+	SquareMatrix(evenOperator, oddOperator);
+	SquareMatrix(oddOperator, evenOperator);
+
+	while(true)
+	{
+		SquareMatrix(evenOperator, oddOperator);
+		if(nextBytes & 1)
+			crc = MultiplyMatrix(evenOperator, crc);
+		nextBytes >>= 1;
+		if(!nextBytes)
+			break;
+
+		SquareMatrix(oddOperator, evenOperator);
+		if(nextBytes & 1)
+			crc = MultiplyMatrix(oddOperator, crc);
+		nextBytes >>= 1;
+		if(!nextBytes)
+			break;
+	}
+	return crc ^ nextCrc;
+}
+
+bool Crc32c::IsHardwareAccelerated()
+{
+	return GetUpdateFunction() != &Crc32c::UpdatePortable;
+}
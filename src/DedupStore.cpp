@@ -0,0 +1,310 @@
+#include "DedupStore.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Crc32c.h"
+#include "ThreadPool.h"
+#include "TransferOptions.h"
+#include "Logger.h"
+
+namespace
+{
+	constexpr char TEMPORARY_BLOCK_PREFIX[] = "tmp.";
+	constexpr size_t BLOCK_NAME_LENGTH = 32 + 1 + 8;						//	<hash>.<crc32c>
+
+	bool ParseBlockName(const char* name, ContentHash& hash, uint32_t& checksum)
+	{
+		unsigned long long high = 0;
+		unsigned long long low = 0;
+		unsigned int crc = 0;
+		if(strlen(name) != BLOCK_NAME_LENGTH || sscanf(name, "%16llx%16llx.%8x", &high, &low, &crc) != 3)
+			return false;
+
+		hash._high = high;
+		hash._low = low;
+		checksum = crc;
+		return true;
+	}
+
+	bool WriteAll(int fileDescriptor, const uint8_t* data, size_t countBytes)
+	{
+		while(countBytes)
+		{
+			ssize_t result = write(fileDescriptor, data, countBytes);
+			if(result < 0 && errno == EINTR)
+				continue;
+			if(result <= 0)
+				return false;
+			data += result;
+			countBytes -= static_cast<size_t>(result);
+		}
+		return true;
+	}
+}
+
+bool DedupIndex::Contains(const ContentHash& hash, uint32_t length) const
+{
+	for(uint32_t probe = 0; probe < DEDUP_INDEX_PROBE_COUNT; ++probe)
+	{
+		const DedupIndexEntry& entry = _entries[GetEntryIndex(hash, probe)];
+		uint32_t sequence = 0;
+		uint32_t entryLength = 0;
+		ContentHash entryHash;
+		do
+		{
+			sequence = entry._sequence.load(std::memory_order_acquire);
+			entryLength = entry._length;
+			entryHash = entry._hash;
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+		while((sequence & 1) || sequence != entry._sequence.load(std::memory_order_relaxed));
+
+		if(entryLength == length && entryHash == hash)
+			return true;
+	}
+	return false;
+}
+
+uint32_t DedupIndex::GetEntryIndex(const ContentHash& hash, uint32_t probe) const
+{
+	return static_cast<uint32_t>((hash._low + probe) % _entryCount);
+}
+
+DedupStore::DedupStore(DedupIndexEntry* entries, uint32_t entryCount, const std::string& directory, ThreadPool& threadPool)
+	: _directory(directory)
+	, _storedBlocks(entryCount)
+	, _threadPool(threadPool)
+{
+	_index._entries = entries;
+	_index._entryCount = entryCount;
+	if(mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST)
+		TRACE_ERROR("Unable to create the dedup store %s\n", _directory.c_str());
+	Load();
+}
+
+DedupStore::~DedupStore()
+{
+	while(!_insertsEvent.Wait([&] { return _countPendingInserts.load() == 0; }, HEARTBEAT_INTERVAL_MILLISECONDS))
+	{
+	}
+
+	//	no reference can arrive anymore; left behind, these would be loaded again as stored blocks
+	for(const StoredBlock& block : _evictedBlocks)
+		unlink(GetBlockPath(block).c_str());
+}
+
+void DedupStore::Load()
+{
+	DIR* directory = opendir(_directory.c_str());
+	if(!directory)
+		return;
+
+	uint32_t loadedCount = 0;
+	while(const dirent* directoryEntry = readdir(directory))
+	{
+		const std::string path = _directory + "/" + directoryEntry->d_name;
+		StoredBlock block;
+		if(strncmp(directoryEntry->d_name, TEMPORARY_BLOCK_PREFIX, sizeof(TEMPORARY_BLOCK_PREFIX) - 1) == 0)
+		{
+			//	a block the server was storing when it stopped
+			unlink(path.c_str());
+			continue;
+		}
+		if(!ParseBlockName(directoryEntry->d_name, block._hash, block._checksum))
+			continue;
+
+		struct stat blockStat;
+		if(stat(path.c_str(), &blockStat) != 0 || !S_ISREG(blockStat.st_mode))
+			continue;
+		block._length = static_cast<uint32_t>(blockStat.st_size);
+		block._lastUseSeconds = static_cast<uint64_t>(blockStat.st_mtime);
+
+		//	the store may have been bigger before: blocks without a free entry are dropped
+		bool isLoaded = false;
+		for(uint32_t probe = 0; probe < DEDUP_INDEX_PROBE_COUNT && !isLoaded && block._length && block._length <= DEDUP_BLOCK_SIZE; ++probe)
+		{
+			const uint32_t entryIndex = _index.GetEntryIndex(block._hash, probe);
+			if(_storedBlocks[entryIndex]._length)
+				continue;
+			Publish(entryIndex, block);
+			isLoaded = true;
+		}
+		if(isLoaded)
+			++loadedCount;
+		else
+			unlink(path.c_str());
+	}
+	closedir(directory);
+	TRACE("Dedup store %s: %u blocks\n", _directory.c_str(), loadedCount);
+}
+
+int DedupStore::Open(const ContentHash& hash, uint32_t length, uint32_t& checksum)
+{
+	boost::lock_guard<boost::mutex> lock(_mutex);
+	const StoredBlock* foundBlock = nullptr;
+	uint32_t foundIndex = 0;
+	for(uint32_t probe = 0; probe < DEDUP_INDEX_PROBE_COUNT && !foundBlock; ++probe)
+	{
+		foundIndex = _index.GetEntryIndex(hash, probe);
+		StoredBlock& block = _storedBlocks[foundIndex];
+		if(block._length == length && block._hash == hash)
+		{
+			block._lastUseSeconds = static_cast<uint64_t>(std::time(nullptr));
+			foundBlock = &block;
+		}
+	}
+	const bool isIndexed = foundBlock != nullptr;
+	for(auto evictedBlock = _evictedBlocks.begin(); evictedBlock != _evictedBlocks.end() && !foundBlock; ++evictedBlock)
+	{
+		if(evictedBlock->_length == length && evictedBlock->_hash == hash)
+			foundBlock = &*evictedBlock;
+	}
+	if(!foundBlock)
+		return -1;
+
+	checksum = foundBlock->_checksum;
+	const int fileDescriptor = open(GetBlockPath(*foundBlock).c_str(), O_RDONLY | O_CLOEXEC);
+
+	//	the file is gone (removed by hand, a full disk at startup): clients stop referencing the block
+	if(fileDescriptor < 0 && isIndexed)
+		Publish(foundIndex, StoredBlock());
+	return fileDescriptor;
+}
+
+void DedupStore::Insert(const ContentHash& hash, std::vector<uint8_t>&& block)
+{
+	if(block.empty() || block.size() > DEDUP_BLOCK_SIZE)
+		return;
+
+	//	the store is a cache: with the writes backed up, a block is better dropped than waited for
+	if(_countPendingInserts.fetch_add(1) >= DEDUP_PENDING_BLOCK_COUNT)
+	{
+		EndInsert();
+		return;
+	}
+
+	const std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>(std::move(block));
+	if(!_threadPool.Post([this, hash, data] {
+			Store(hash, data->data(), static_cast<uint32_t>(data->size()));
+			EndInsert();
+		}, static_cast<uint32_t>(TransferPriority::BULK)))
+		EndInsert();
+}
+
+void DedupStore::EndInsert()
+{
+	_countPendingInserts.fetch_sub(1);
+	_insertsEvent.Notify();
+}
+
+void DedupStore::Store(const ContentHash& hash, const uint8_t* data, uint32_t length)
+{
+	//	the hash comes from the client: a block is stored under it only if it's the hash of the data
+	if(ContentHash::Compute(data, length) != hash)
+	{
+		TRACE_ERROR("Block %s doesn't match its hash and isn't stored\n", hash.ToString().c_str());
+		return;
+	}
+
+	StoredBlock block;
+	block._hash = hash;
+	block._length = length;
+	block._checksum = Crc32c::Update(0, data, length);
+
+	//	the block is written aside and renamed in once it's complete, a crash never leaves a short one under its name
+	std::string temporaryPath = _directory + "/" + TEMPORARY_BLOCK_PREFIX + "XXXXXX";
+	const int fileDescriptor = mkstemp(&temporaryPath[0]);
+	if(fileDescriptor < 0)
+	{
+		TRACE_ERROR("Unable to store a block in %s\n", _directory.c_str());
+		return;
+	}
+	const bool isWritten = WriteAll(fileDescriptor, data, length);
+	if(close(fileDescriptor) != 0 || !isWritten)
+	{
+		unlink(temporaryPath.c_str());
+		return;
+	}
+
+	boost::lock_guard<boost::mutex> lock(_mutex);
+	const uint64_t nowSeconds = static_cast<uint64_t>(std::time(nullptr));
+	RemoveEvictedBlocks(nowSeconds);
+	uint32_t victimIndex = _index.GetEntryIndex(hash, 0);
+	for(uint32_t probe = 0; probe < DEDUP_INDEX_PROBE_COUNT; ++probe)
+	{
+		const uint32_t entryIndex = _index.GetEntryIndex(hash, probe);
+		const StoredBlock& storedBlock = _storedBlocks[entryIndex];
+		if(storedBlock._length == length && storedBlock._hash == hash)
+		{
+			//	another range has stored it meanwhile
+			unlink(temporaryPath.c_str());
+			return;
+		}
+		if(_storedBlocks[victimIndex]._length && (!storedBlock._length || storedBlock._lastUseSeconds < _storedBlocks[victimIndex]._lastUseSeconds))
+			victimIndex = entryIndex;
+	}
+
+	//	an evicted block coming back keeps its file, under the same name
+	for(auto evictedBlock = _evictedBlocks.begin(); evictedBlock != _evictedBlocks.end(); ++evictedBlock)
+	{
+		if(evictedBlock->_length == length && evictedBlock->_hash == hash)
+		{
+			_evictedBlocks.erase(evictedBlock);
+			break;
+		}
+	}
+
+	if(_storedBlocks[victimIndex]._length)
+	{
+		StoredBlock victimBlock = _storedBlocks[victimIndex];
+		victimBlock._lastUseSeconds = nowSeconds;
+		_evictedBlocks.push_back(victimBlock);
+		Publish(victimIndex, StoredBlock());
+	}
+
+	if(rename(temporaryPath.c_str(), GetBlockPath(block).c_str()) != 0)
+	{
+		unlink(temporaryPath.c_str());
+		return;
+	}
+	block._lastUseSeconds = nowSeconds;
+	Publish(victimIndex, block);
+}
+
+std::string DedupStore::GetBlockPath(const StoredBlock& block) const
+{
+	char checksum[9];
+	snprintf(checksum, sizeof(checksum), "%08x", block._checksum);
+	return _directory + "/" + block._hash.ToString() + "." + checksum;
+}
+
+void DedupStore::Publish(uint32_t entryIndex, const StoredBlock& block)
+{
+	_storedBlocks[entryIndex] = block;
+
+	DedupIndexEntry& entry = _index._entries[entryIndex];
+	const uint32_t sequence = entry._sequence.load(std::memory_order_relaxed);
+	entry._sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	entry._length = block._length;
+	entry._hash = block._hash;
+	entry._sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void DedupStore::RemoveEvictedBlocks(uint64_t nowSeconds)
+{
+	while(!_evictedBlocks.empty() && _evictedBlocks.front()._lastUseSeconds + DEDUP_EVICTION_GRACE_SECONDS < nowSeconds)
+	{
+		unlink(GetBlockPath(_evictedBlocks.front()).c_str());
+		_evictedBlocks.pop_front();
+	}
+}
@@ -0,0 +1,432 @@
+#include "DiskSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "FileMapping.h"
+#include "SharedMemoryMetrics.h"
+#include "SharedMemoryConsts.h"
+#include "Logger.h"
+
+DiskSink::DiskSink(uint32_t bufferCount, uint32_t bufferSize, SharedMemoryMetrics* metrics)
+	: _metrics(metrics)
+	, _bufferSize((std::max(bufferSize, PAYLOAD_ALIGNMENT) + PAYLOAD_ALIGNMENT - 1) / PAYLOAD_ALIGNMENT * PAYLOAD_ALIGNMENT)
+	, _writes(std::max<uint32_t>(bufferCount, 1))
+{
+	for(DiskWrite& write : _writes)
+	{
+		void* buffer = nullptr;
+		if(posix_memalign(&buffer, PAYLOAD_ALIGNMENT, _bufferSize) != 0)
+		{
+			for(DiskWrite* freeWrite : _freeWrites)
+				free(freeWrite->_buffer);
+			throw std::bad_alloc();
+		}
+		write._buffer = static_cast<uint8_t*>(buffer);
+		_freeWrites.push_back(&write);
+	}
+
+	//	every write owns a buffer, so the rings never hold more than the buffers and the final NOP
+	if(SetupRing(static_cast<uint32_t>(_writes.size()) + 1))
+		_thread = boost::thread(boost::bind(&DiskSink::CompletionThread, this));
+	else
+		_thread = boost::thread(boost::bind(&DiskSink::WriterThread, this));
+	TRACE("Disk sink: %u buffers of %u bytes, %s\n", static_cast<uint32_t>(_writes.size()), _bufferSize, GetBackendName());
+}
+
+DiskSink::~DiskSink()
+{
+	{
+		boost::unique_lock<boost::mutex> lock(_freeWritesMutex);
+		_cvWriteIsFree.wait(lock, [&] { return _freeWrites.size() == _writes.size(); });
+	}
+
+	if(_ringDescriptor >= 0)
+	{
+		SubmitToRing(nullptr);
+	}
+	else
+	{
+		boost::lock_guard<boost::mutex> lock(_queueMutex);
+		_isStopping = true;
+		_cvWriteIsQueued.notify_one();
+	}
+	_thread.join();
+
+	TeardownRing();
+	for(DiskWrite& write : _writes)
+		free(write._buffer);
+}
+
+const char* DiskSink::GetBackendName() const
+{
+	return _ringDescriptor >= 0 ? "io_uring" : "pwritev";
+}
+
+uint32_t DiskSink::GetBufferSize() const
+{
+	return _bufferSize;
+}
+
+DiskWrite* DiskSink::AcquireWrite()
+{
+	boost::unique_lock<boost::mutex> lock(_freeWritesMutex);
+	if(_freeWrites.empty())
+	{
+		//	every buffer is in flight: the disk is the bottleneck now
+		const uint64_t waitStartNanoseconds = getMonotonicNanoseconds();
+		_cvWriteIsFree.wait(lock, [&] { return !_freeWrites.empty(); });
+		if(_metrics)
+			_metrics->_diskSinkWaitNanoseconds.Add(getMonotonicNanoseconds() - waitStartNanoseconds);
+	}
+
+	DiskWrite* write = _freeWrites.back();
+	_freeWrites.pop_back();
+	return write;
+}
+
+void DiskSink::Submit(DiskWrite* write, OutputFile& file, uint64_t offset, size_t countBytes)
+{
+	write->_file = &file;
+	write->_offset = offset;
+	write->_countBytes = countBytes;
+	write->_writtenBytes = 0;
+	write->_fileDescriptor = file.GetDescriptor(write->_buffer, countBytes, offset);
+	file.BeginWrite();
+
+	if(_ringDescriptor >= 0)
+	{
+		SubmitToRing(write);
+		return;
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(_queueMutex);
+		_queue.push_back(write);
+	}
+	_cvWriteIsQueued.notify_one();
+}
+
+void DiskSink::ReleaseWrite(DiskWrite* write)
+{
+	{
+		boost::lock_guard<boost::mutex> lock(_freeWritesMutex);
+		_freeWrites.push_back(write);
+	}
+	_cvWriteIsFree.notify_all();
+}
+
+bool DiskSink::SetupRing(uint32_t entryCount)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	_ringDescriptor = static_cast<int>(syscall(__NR_io_uring_setup, entryCount, &params));
+	if(_ringDescriptor < 0)
+	{
+		TRACE_DEBUG("io_uring is not available: %s\n", strerror(errno));
+		return false;
+	}
+
+	_submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	_completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	const bool isSingleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if(isSingleMapping)
+		_submissionRingSize = _completionRingSize = std::max(_submissionRingSize, _completionRingSize);
+	_submissionEntriesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+	_submissionRing = mmap(nullptr, _submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringDescriptor, IORING_OFF_SQ_RING);
+	_completionRing = isSingleMapping
+						? _submissionRing
+						: mmap(nullptr, _completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringDescriptor, IORING_OFF_CQ_RING);
+	_submissionEntries = mmap(nullptr, _submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringDescriptor, IORING_OFF_SQES);
+	if(_submissionRing == MAP_FAILED || _completionRing == MAP_FAILED || _submissionEntries == MAP_FAILED)
+	{
+		TRACE_ERROR("io_uring rings can't be mapped: %s\n", strerror(errno));
+		TeardownRing();
+		return false;
+	}
+
+	uint8_t* submissionRing = static_cast<uint8_t*>(_submissionRing);
+	_submissionHead = reinterpret_cast<std::atomic<uint32_t>*>(submissionRing + params.sq_off.head);
+	_submissionTail = reinterpret_cast<std::atomic<uint32_t>*>(submissionRing + params.sq_off.tail);
+	_submissionMask = *reinterpret_cast<uint32_t*>(submissionRing + params.sq_off.ring_mask);
+	_submissionArray = reinterpret_cast<uint32_t*>(submissionRing + params.sq_off.array);
+
+	uint8_t* completionRing = static_cast<uint8_t*>(_completionRing);
+	_completionHead = reinterpret_cast<std::atomic<uint32_t>*>(completionRing + params.cq_off.head);
+	_completionTail = reinterpret_cast<std::atomic<uint32_t>*>(completionRing + params.cq_off.tail);
+	_completionMask = *reinterpret_cast<uint32_t*>(completionRing + params.cq_off.ring_mask);
+	_completionEntries = completionRing + params.cq_off.cqes;
+	return true;
+}
+
+void DiskSink::TeardownRing()
+{
+	if(_submissionEntries && _submissionEntries != MAP_FAILED)
+		munmap(_submissionEntries, _submissionEntriesSize);
+	if(_completionRing && _completionRing != MAP_FAILED && _completionRing != _submissionRing)
+		munmap(_completionRing, _completionRingSize);
+	if(_submissionRing && _submissionRing != MAP_FAILED)
+		munmap(_submissionRing, _submissionRingSize);
+	_submissionEntries = _completionRing = _submissionRing = nullptr;
+
+	if(_ringDescriptor >= 0)
+		close(_ringDescriptor);
+	_ringDescriptor = -1;
+}
+
+void DiskSink::SubmitToRing(DiskWrite* write)
+{
+	boost::lock_guard<boost::mutex> lock(_submissionMutex);
+	const uint32_t tail = _submissionTail->load(std::memory_order_relaxed);
+	const uint32_t index = tail & _submissionMask;
+	io_uring_sqe* entry = static_cast<io_uring_sqe*>(_submissionEntries) + index;
+	memset(entry, 0, sizeof(*entry));
+
+	//	a null write is the wakeup of the destructor
+	entry->opcode = IORING_OP_NOP;
+	if(write)
+	{
+		write->_iovec.iov_base = write->_buffer + write->_writtenBytes;
+		write->_iovec.iov_len = write->_countBytes - write->_writtenBytes;
+		entry->opcode = IORING_OP_WRITEV;
+		entry->fd = write->_fileDescriptor;
+		entry->addr = reinterpret_cast<uint64_t>(&write->_iovec);
+		entry->len = 1;
+		entry->off = write->_offset + write->_writtenBytes;
+	}
+	entry->user_data = reinterpret_cast<uint64_t>(write);
+	_submissionArray[index] = index;
+	_submissionTail->store(tail + 1, std::memory_order_release);
+
+	while(syscall(__NR_io_uring_enter, _ringDescriptor, 1, 0, 0, nullptr, 0) < 0 && errno == EINTR)
+	{
+	}
+}
+
+void DiskSink::CompletionThread()
+{
+	while(true)
+	{
+		const uint32_t head = _completionHead->load(std::memory_order_relaxed);
+		if(head == _completionTail->load(std::memory_order_acquire))
+		{
+			syscall(__NR_io_uring_enter, _ringDescriptor, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			continue;
+		}
+
+		const io_uring_cqe* entry = static_cast<const io_uring_cqe*>(_completionEntries) + (head & _completionMask);
+		DiskWrite* write = reinterpret_cast<DiskWrite*>(entry->user_data);
+		const int32_t result = entry->res;
+		_completionHead->store(head + 1, std::memory_order_release);
+
+		if(!write)
+			break;
+		if(ContinueWrite(write, result))
+			SubmitToRing(write);
+	}
+}
+
+bool DiskSink::ContinueWrite(DiskWrite* write, ssize_t result)
+{
+	if(result == -EINTR || result == -EAGAIN)
+		return true;
+
+	if(result == -EINVAL)
+	{
+		//	direct I/O refused by the device: the rest of the file goes through the page cache
+		const int fileDescriptor = write->_fileDescriptor;
+		write->_file->DisableDirectIo();
+		write->_fileDescriptor = write->_file->GetDescriptor(write->_buffer, write->_countBytes, write->_offset);
+		if(write->_fileDescriptor != fileDescriptor)
+			return true;
+	}
+
+	if(result <= 0)
+	{
+		TRACE_ERROR("Disk write failed: %s\n", strerror(result ? static_cast<int>(-result) : ENOSPC));
+		CompleteWrite(write, false);
+		return false;
+	}
+
+	write->_writtenBytes += static_cast<size_t>(result);
+	if(write->_writtenBytes < write->_countBytes)
+	{
+		//	a short write leaves an unaligned remainder behind
+		const size_t writtenBytes = write->_writtenBytes;
+		write->_fileDescriptor = write->_file->GetDescriptor(write->_buffer + writtenBytes, write->_countBytes - writtenBytes, write->_offset + writtenBytes);
+		return true;
+	}
+
+	CompleteWrite(write, true);
+	return false;
+}
+
+void DiskSink::CompleteWrite(DiskWrite* write, bool isWritten)
+{
+	write->_file->EndWrite(isWritten);
+	write->_file = nullptr;
+	ReleaseWrite(write);
+}
+
+void DiskSink::WriterThread()
+{
+	std::vector<DiskWrite*> batch;
+	std::vector<iovec> iovecs;
+	while(true)
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(_queueMutex);
+			_cvWriteIsQueued.wait(lock, [&] { return _isStopping || !_queue.empty(); });
+			if(_queue.empty())
+				break;
+			batch.assign(_queue.begin(), _queue.end());
+			_queue.clear();
+		}
+
+		//	writes continuing each other in one file go out in a single pwritev
+		std::sort(batch.begin(), batch.end(), [](const DiskWrite* left, const DiskWrite* right) {
+			return left->_fileDescriptor != right->_fileDescriptor
+					? left->_fileDescriptor < right->_fileDescriptor
+					: left->_offset < right->_offset;
+		});
+		for(size_t first = 0; first < batch.size();)
+		{
+			iovecs.clear();
+			uint64_t endOffset = batch[first]->_offset;
+			size_t last = first;
+			while(last < batch.size() && iovecs.size() < IOV_MAX
+				&& batch[last]->_fileDescriptor == batch[first]->_fileDescriptor && batch[last]->_offset == endOffset)
+			{
+				iovecs.push_back({batch[last]->_buffer, batch[last]->_countBytes});
+				endOffset += batch[last]->_countBytes;
+				++last;
+			}
+
+			ssize_t result = -1;
+			do
+			{
+				result = pwritev(batch[first]->_fileDescriptor, iovecs.data(), static_cast<int>(iovecs.size()), static_cast<off_t>(batch[first]->_offset));
+			}
+			while(result < 0 && errno == EINTR);
+
+			//	whatever a short or a failed call left is finished write by write
+			size_t remainingBytes = result > 0 ? static_cast<size_t>(result) : 0;
+			for(size_t i = first; i < last; ++i)
+			{
+				DiskWrite* write = batch[i];
+				write->_writtenBytes = std::min(remainingBytes, write->_countBytes);
+				remainingBytes -= write->_writtenBytes;
+				const bool isWritten = write->_writtenBytes == write->_countBytes
+										|| write->_file->Write(write->_buffer + write->_writtenBytes, write->_countBytes - write->_writtenBytes,
+																write->_offset + write->_writtenBytes);
+				CompleteWrite(write, isWritten);
+			}
+			first = last;
+		}
+	}
+}
+
+FileSinkWriter::FileSinkWriter(DiskSink* sink, OutputFile& file, uint64_t offset, uint64_t length)
+	: _sink(sink && length >= sink->GetBufferSize() ? sink : nullptr)
+	, _file(file)
+	, _offset(offset)
+	, _bufferOffset(offset)
+{
+}
+
+FileSinkWriter::~FileSinkWriter()
+{
+	Finish();
+}
+
+bool FileSinkWriter::Write(const uint8_t* source, size_t countBytes)
+{
+	if(!_sink)
+	{
+		_file.Write(source, countBytes, _offset);
+		_offset += countBytes;
+		return _file.IsGood();
+	}
+
+	while(countBytes)
+	{
+		if(!_write)
+		{
+			_write = _sink->AcquireWrite();
+			_bufferOffset = _offset;
+			_bufferedBytes = 0;
+		}
+
+		const size_t copyBytes = std::min(countBytes, _sink->GetBufferSize() - _bufferedBytes);
+		memcpy(_write->_buffer + _bufferedBytes, source, copyBytes);
+		_bufferedBytes += copyBytes;
+		_offset += copyBytes;
+		source += copyBytes;
+		countBytes -= copyBytes;
+		if(_bufferedBytes == _sink->GetBufferSize())
+			SubmitBuffer();
+	}
+	return _file.IsGood();
+}
+
+bool FileSinkWriter::Writev(const struct iovec* vectors, uint32_t vectorCount)
+{
+	if(!_sink)
+	{
+		_file.Writev(vectors, vectorCount, _offset);
+		for(uint32_t i = 0; i < vectorCount; ++i)
+			_offset += vectors[i].iov_len;
+		return _file.IsGood();
+	}
+
+	for(uint32_t i = 0; i < vectorCount; ++i)
+		Write(static_cast<const uint8_t*>(vectors[i].iov_base), vectors[i].iov_len);
+	return _file.IsGood();
+}
+
+void FileSinkWriter::Skip(uint64_t countBytes)
+{
+	if(_write && _bufferedBytes)
+		SubmitBuffer();
+	_offset += countBytes;
+	_bufferOffset = _offset;
+}
+
+bool FileSinkWriter::Finish()
+{
+	if(_write && _bufferedBytes)
+	{
+		SubmitBuffer();
+	}
+	else if(_write)
+	{
+		_sink->ReleaseWrite(_write);
+		_write = nullptr;
+	}
+
+	if(_sink)
+		_file.WaitForWrites();
+	return _file.IsGood();
+}
+
+uint64_t FileSinkWriter::GetOffset() const
+{
+	return _offset;
+}
+
+void FileSinkWriter::SubmitBuffer()
+{
+	_sink->Submit(_write, _file, _bufferOffset, _bufferedBytes);
+	_write = nullptr;
+	_bufferedBytes = 0;
+}
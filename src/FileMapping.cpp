@@ -0,0 +1,329 @@
+#include "FileMapping.h"
+
+#include <cerrno>
+#include <csetjmp>
+#include <csignal>
+#include <cstring>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SharedMemoryConsts.h"
+#include "Logger.h"
+
+namespace
+{
+	thread_local sigjmp_buf* tMappedCopyGuard = nullptr;		//	set while this thread copies from a mapping
+	struct sigaction gPreviousBusAction;
+	std::once_flag gBusHandlerFlag;
+
+	void OnBusError(int, siginfo_t*, void*)
+	{
+		if(tMappedCopyGuard)
+			siglongjmp(*tMappedCopyGuard, 1);
+
+		//	not a mapped copy: the faulting access repeats under the handler there was before
+		sigaction(SIGBUS, &gPreviousBusAction, nullptr);
+	}
+
+	void InstallBusHandler()
+	{
+		struct sigaction busAction;
+		memset(&busAction, 0, sizeof(busAction));
+		busAction.sa_sigaction = OnBusError;
+		busAction.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigemptyset(&busAction.sa_mask);
+		sigaction(SIGBUS, &busAction, &gPreviousBusAction);
+	}
+
+	bool CopyMapped(uint8_t* destination, const uint8_t* source, size_t countBytes)
+	{
+		sigjmp_buf guard;
+		if(sigsetjmp(guard, 1) != 0)
+		{
+			tMappedCopyGuard = nullptr;
+			return false;
+		}
+		tMappedCopyGuard = &guard;
+		memcpy(destination, source, countBytes);
+		tMappedCopyGuard = nullptr;
+		return true;
+	}
+}
+
+InputFileMapping::InputFileMapping(const std::string& filePath)
+{
+	_fileDescriptor = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+	if(_fileDescriptor < 0)
+		return;
+
+	struct stat fileStat;
+	if(fstat(_fileDescriptor, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+	{
+		close(_fileDescriptor);
+		_fileDescriptor = -1;
+		return;
+	}
+
+	_fileSize = static_cast<uint64_t>(fileStat.st_size);
+	if(_fileSize == 0)
+		return;
+
+	void* mappedData = mmap(nullptr, _fileSize, PROT_READ, MAP_PRIVATE, _fileDescriptor, 0);
+	if(mappedData == MAP_FAILED)
+	{
+		posix_fadvise(_fileDescriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+		return;
+	}
+
+	madvise(mappedData, _fileSize, MADV_SEQUENTIAL);
+	_mappedData = static_cast<const uint8_t*>(mappedData);
+	std::call_once(gBusHandlerFlag, InstallBusHandler);
+}
+
+InputFileMapping::~InputFileMapping()
+{
+	if(_mappedData)
+		munmap(const_cast<uint8_t*>(_mappedData), _fileSize);
+	if(_fileDescriptor >= 0)
+		close(_fileDescriptor);
+}
+
+bool InputFileMapping::IsOpen() const
+{
+	return _fileDescriptor >= 0;
+}
+
+uint64_t InputFileMapping::GetSize() const
+{
+	return _fileSize;
+}
+
+size_t InputFileMapping::Read(uint8_t* destination, uint64_t offset, size_t countBytes) const
+{
+	if(offset >= _fileSize)
+		return 0;
+	if(countBytes > _fileSize - offset)
+		countBytes = static_cast<size_t>(_fileSize - offset);
+
+	if(_mappedData && !_isTruncated.load())
+	{
+		if(CopyMapped(destination, _mappedData + offset, countBytes))
+			return countBytes;
+
+		//	the pages past the new end are gone; pread reads what's left
+		_isTruncated.store(true);
+		TRACE_ERROR("The source file has been truncated while it was read\n");
+	}
+
+	size_t readBytes = 0;
+	while(readBytes < countBytes)
+	{
+		ssize_t result = pread(_fileDescriptor, destination + readBytes, countBytes - readBytes, offset + readBytes);
+		if(result < 0 && errno == EINTR)
+			continue;
+		if(result <= 0)
+			break;
+		readBytes += static_cast<size_t>(result);
+	}
+	return readBytes;
+}
+
+OutputFile::OutputFile(const std::string& filePath, bool isResumed)
+	: _filePath(filePath)
+{
+	_fileDescriptor = open(filePath.c_str(), isResumed ? O_WRONLY | O_CLOEXEC : O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	_isGood = _fileDescriptor >= 0;
+}
+
+OutputFile::~OutputFile()
+{
+	Close();
+}
+
+bool OutputFile::IsGood() const
+{
+	return _isGood;
+}
+
+void OutputFile::Preallocate(uint64_t fileSize)
+{
+	if(!_isGood || fileSize == 0)
+		return;
+
+	//	not every filesystem supports fallocate, the positional writes extend the file anyway
+	if(fallocate(_fileDescriptor, 0, 0, static_cast<off_t>(fileSize)) != 0)
+		ftruncate(_fileDescriptor, static_cast<off_t>(fileSize));
+}
+
+bool OutputFile::EnableDirectIo()
+{
+	//	not every filesystem takes O_DIRECT; the file is written through the page cache then
+	if(_isGood && _directFileDescriptor < 0)
+		_directFileDescriptor = open(_filePath.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+	_isDirectIo.store(_directFileDescriptor >= 0);
+	return _isDirectIo;
+}
+
+void OutputFile::DisableDirectIo()
+{
+	//	the descriptor stays open until Close(): other ranges may be writing through it right now
+	_isDirectIo.store(false);
+}
+
+int OutputFile::GetDescriptor(const uint8_t* source, size_t countBytes, uint64_t offset) const
+{
+	const bool isAligned = (reinterpret_cast<uintptr_t>(source) | countBytes | offset) % PAYLOAD_ALIGNMENT == 0;
+	return _isDirectIo.load() && isAligned ? _directFileDescriptor : _fileDescriptor;
+}
+
+bool OutputFile::Write(const uint8_t* source, size_t countBytes, uint64_t offset)
+{
+	while(_isGood && countBytes)
+	{
+		const int fileDescriptor = GetDescriptor(source, countBytes, offset);
+		ssize_t result = pwrite(fileDescriptor, source, countBytes, offset);
+		if(result < 0 && errno == EINTR)
+			continue;
+		if(result < 0 && errno == EINVAL && fileDescriptor != _fileDescriptor)
+		{
+			//	the device wants a stricter alignment than a page: fall back to the page cache
+			DisableDirectIo();
+			continue;
+		}
+		if(result <= 0)
+		{
+			_isGood = false;
+			break;
+		}
+		source += result;
+		offset += static_cast<uint64_t>(result);
+		countBytes -= static_cast<size_t>(result);
+	}
+	return _isGood;
+}
+
+bool OutputFile::Writev(const struct iovec* vectors, uint32_t vectorCount, uint64_t offset)
+{
+	//	ring frames are never page aligned, so they always go through the page cache
+	std::vector<struct iovec> pending(vectors, vectors + vectorCount);
+	size_t firstVector = 0;
+	while(_isGood && firstVector < pending.size())
+	{
+		ssize_t result = pwritev(_fileDescriptor, &pending[firstVector], static_cast<int>(pending.size() - firstVector), static_cast<off_t>(offset));
+		if(result < 0 && errno == EINTR)
+			continue;
+		if(result <= 0)
+		{
+			_isGood = false;
+			break;
+		}
+
+		//	a short write resumes in the middle of the vector it stopped in
+		offset += static_cast<uint64_t>(result);
+		for(size_t writtenBytes = static_cast<size_t>(result); writtenBytes; )
+		{
+			const size_t vectorBytes = std::min(writtenBytes, pending[firstVector].iov_len);
+			pending[firstVector].iov_base = static_cast<uint8_t*>(pending[firstVector].iov_base) + vectorBytes;
+			pending[firstVector].iov_len -= vectorBytes;
+			writtenBytes -= vectorBytes;
+			if(pending[firstVector].iov_len == 0)
+				++firstVector;
+		}
+	}
+	return _isGood;
+}
+
+bool OutputFile::Copy(int sourceFileDescriptor, size_t countBytes, uint64_t offset)
+{
+	if(!_isGood)
+		return false;
+
+	file_clone_range cloneRange;
+	cloneRange.src_fd = sourceFileDescriptor;
+	cloneRange.src_offset = 0;
+	cloneRange.src_length = countBytes;
+	cloneRange.dest_offset = offset;
+	if(ioctl(_fileDescriptor, FICLONERANGE, &cloneRange) == 0)
+		return true;
+
+	//	EXDEV, EOPNOTSUPP or an unaligned range: nothing has been copied yet
+	loff_t sourceOffset = 0;
+	loff_t destinationOffset = static_cast<loff_t>(offset);
+	while(static_cast<size_t>(sourceOffset) < countBytes)
+	{
+		ssize_t result = copy_file_range(sourceFileDescriptor, &sourceOffset, _fileDescriptor, &destinationOffset, countBytes - static_cast<size_t>(sourceOffset), 0);
+		if(result < 0 && errno == EINTR)
+			continue;
+		if(result <= 0)
+			break;
+	}
+
+	std::vector<uint8_t> buffer;
+	while(_isGood && static_cast<size_t>(sourceOffset) < countBytes)
+	{
+		buffer.resize(countBytes - static_cast<size_t>(sourceOffset));
+		ssize_t result = pread(sourceFileDescriptor, buffer.data(), buffer.size(), sourceOffset);
+		if(result < 0 && errno == EINTR)
+			continue;
+		if(result <= 0 || !Write(buffer.data(), static_cast<size_t>(result), offset + static_cast<uint64_t>(sourceOffset)))
+		{
+			_isGood = false;
+			break;
+		}
+		sourceOffset += result;
+	}
+	return _isGood;
+}
+
+void OutputFile::BeginWrite()
+{
+	_countPendingWrites.fetch_add(1);
+}
+
+void OutputFile::EndWrite(bool isWritten)
+{
+	if(!isWritten)
+		_isGood.store(false);
+	_countPendingWrites.fetch_sub(1);
+	_writesEvent.Notify();
+}
+
+void OutputFile::WaitForWrites()
+{
+	while(!_writesEvent.Wait([&] { return _countPendingWrites.load() == 0; }, HEARTBEAT_INTERVAL_MILLISECONDS))
+	{
+	}
+}
+
+bool OutputFile::Sync()
+{
+	//	direct writes are on the disk already, but the allocation they changed may not be
+	if(_fileDescriptor >= 0 && fdatasync(_fileDescriptor) != 0)
+		_isGood.store(false);
+	return _isGood;
+}
+
+void OutputFile::Close()
+{
+	WaitForWrites();
+	_isDirectIo.store(false);
+	if(_directFileDescriptor >= 0)
+		close(_directFileDescriptor);
+	_directFileDescriptor = -1;
+
+	if(_fileDescriptor < 0)
+		return;
+
+	if(close(_fileDescriptor) != 0)
+		_isGood.store(false);
+	_fileDescriptor = -1;
+}
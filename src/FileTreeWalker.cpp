@@ -0,0 +1,303 @@
+#include "FileTreeWalker.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ThreadPool.h"
+#include "SharedMemoryConsts.h"
+#include "Logger.h"
+
+namespace
+{
+	constexpr size_t DIRECTORY_BUFFER_SIZE = 64*1024;				//	getdents64 batch, twice what readdir asks for
+
+	//	struct linux_dirent64, which glibc doesn't declare before 2.30
+	struct DirectoryEntry
+	{
+		uint64_t _inode;
+		int64_t _offset;
+		uint16_t _recordLength;
+		uint8_t _type;
+		char _name[1];
+	};
+
+	//	closed once the directory and all of its subdirectories are opened
+	struct DirectoryDescriptor
+	{
+		DirectoryDescriptor(int descriptor)
+			: _descriptor(descriptor)
+		{
+		}
+		DirectoryDescriptor(const DirectoryDescriptor&) = delete;
+		DirectoryDescriptor(DirectoryDescriptor&) = delete;
+		DirectoryDescriptor(DirectoryDescriptor&&) = delete;
+		~DirectoryDescriptor()
+		{
+			close(_descriptor);
+		}
+
+		const int _descriptor;
+	};
+
+	std::string GetBaseName(const std::string& path)
+	{
+		return path.substr(path.rfind('/') + 1);
+	}
+
+	std::string GetTreeName(const std::string& path)
+	{
+		//	"dir/", "." or "..": the tree is named after the directory itself
+		char* realPath = realpath(path.c_str(), nullptr);
+		const std::string name = realPath ? GetBaseName(realPath) : GetBaseName(path);
+		free(realPath);
+		return name;
+	}
+}
+
+//	a directory of the walk not read yet; its parent stays open until it's opened
+struct FileTreeWalker::PendingDirectory
+{
+	std::shared_ptr<DirectoryDescriptor> _parent;	//	null for the root of the tree
+	std::string _entryName;							//	relative to the parent, the path for the root
+	std::string _path;
+	std::string _name;
+};
+
+//	state of one tree, shared with its pool tasks, which may run after the walk is over
+struct FileTreeWalker::TreeWalk
+{
+	TreeWalk(ThreadPool& threadPool)
+		: _threadPool(threadPool)
+	{
+	}
+
+	ThreadPool& _threadPool;
+	boost::mutex _mutex;
+	boost::condition_variable _cvIsChanged;
+	std::vector<PendingDirectory> _directories;		//	taken from the back, depth first, so few parents are held open
+	uint32_t _countWalking = 0;
+	std::vector<SourceFile> _files;
+};
+
+FileTreeWalker::FileTreeWalker(ThreadPool& threadPool)
+	: _threadPool(threadPool)
+{
+}
+
+std::vector<SourceFile> FileTreeWalker::Walk(const std::vector<std::string>& paths)
+{
+	std::vector<SourceFile> sourceFiles;
+	for(const std::string& path : paths)
+	{
+		//	a glob the shell hasn't expanded (quoted, so a huge tree fits on the command line),
+		//	unless a file has that very name
+		struct stat pathStat;
+		if(path.find_first_of("*?[") == std::string::npos || lstat(path.c_str(), &pathStat) == 0)
+		{
+			AddPath(path, sourceFiles);
+			continue;
+		}
+
+		glob_t globResult;
+		if(glob(path.c_str(), 0, nullptr, &globResult) == 0)
+		{
+			for(size_t i = 0; i < globResult.gl_pathc; ++i)
+				AddPath(globResult.gl_pathv[i], sourceFiles);
+		}
+		else
+			TRACE_ERROR("Nothing matches %s\n", path.c_str());
+		globfree(&globResult);
+	}
+	return sourceFiles;
+}
+
+void FileTreeWalker::AddPath(const std::string& path, std::vector<SourceFile>& sourceFiles)
+{
+	//	a missing file is kept, the transfer reports it
+	SourceFile sourceFile;
+	sourceFile._path = path;
+	sourceFile._name = GetBaseName(path);
+	sourceFile._isFound = stat(path.c_str(), &sourceFile._stat) == 0;
+	if(sourceFile._isFound && S_ISDIR(sourceFile._stat.st_mode))
+		WalkTree(path, sourceFiles);
+	else
+		sourceFiles.push_back(sourceFile);
+}
+
+void FileTreeWalker::WalkTree(const std::string& path, std::vector<SourceFile>& sourceFiles)
+{
+	const std::shared_ptr<TreeWalk> treeWalk = std::make_shared<TreeWalk>(_threadPool);
+	treeWalk->_directories.push_back(PendingDirectory{nullptr, path, path, GetTreeName(path)});
+	WalkDirectories(treeWalk, true);
+
+	std::vector<SourceFile>& treeFiles = treeWalk->_files;
+	std::sort(treeFiles.begin(), treeFiles.end(), [](const SourceFile& left, const SourceFile& right) {
+		const int order = left._name.compare(0, left._name.rfind('/'), right._name, 0, right._name.rfind('/'));
+		return order != 0 ? order < 0 : left._stat.st_ino < right._stat.st_ino;
+	});
+	sourceFiles.insert(sourceFiles.end(), std::make_move_iterator(treeFiles.begin()), std::make_move_iterator(treeFiles.end()));
+}
+
+void FileTreeWalker::WalkDirectories(const std::shared_ptr<TreeWalk>& treeWalk, bool isWaiting)
+{
+	//	pool tasks leave when nothing is pending, the walking thread when nothing is being read either
+	for(;;)
+	{
+		PendingDirectory directory;
+		{
+			boost::unique_lock<boost::mutex> lock(treeWalk->_mutex);
+			if(isWaiting)
+				treeWalk->_cvIsChanged.wait(lock, [&] { return !treeWalk->_directories.empty() || treeWalk->_countWalking == 0; });
+			if(treeWalk->_directories.empty())
+				return;
+			directory = std::move(treeWalk->_directories.back());
+			treeWalk->_directories.pop_back();
+			++treeWalk->_countWalking;
+		}
+		WalkDirectory(treeWalk, directory);
+	}
+}
+
+void FileTreeWalker::WalkDirectory(const std::shared_ptr<TreeWalk>& treeWalk, PendingDirectory& directory)
+{
+	const std::string& path = directory._path;
+	const std::string& name = directory._name;
+	const int directoryDescriptor = directory._parent
+		? openat(directory._parent->_descriptor, directory._entryName.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+		: open(directory._entryName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	directory._parent.reset();
+
+	std::vector<SourceFile> directoryFiles;
+	std::vector<PendingDirectory> subdirectories;
+	if(directoryDescriptor < 0)
+		TRACE_ERROR("Unable to open directory: %s\n", path.c_str());
+	else
+	{
+		const std::shared_ptr<DirectoryDescriptor> descriptor = std::make_shared<DirectoryDescriptor>(directoryDescriptor);
+		std::vector<char> buffer(DIRECTORY_BUFFER_SIZE);
+		long readBytes = 0;
+		while((readBytes = syscall(SYS_getdents64, directoryDescriptor, buffer.data(), buffer.size())) > 0)
+		{
+			for(long position = 0; position < readBytes; )
+			{
+				const DirectoryEntry* entry = reinterpret_cast<const DirectoryEntry*>(buffer.data() + position);
+				position += entry->_recordLength;
+				if(strcmp(entry->_name, ".") == 0 || strcmp(entry->_name, "..") == 0)
+					continue;
+
+				const std::string entryPath = path + "/" + entry->_name;
+				const std::string entryName = name.empty() ? std::string(entry->_name) : name + "/" + entry->_name;
+				struct stat entryStat;
+				if(entry->_type == DT_DIR
+					|| (entry->_type == DT_UNKNOWN && fstatat(directoryDescriptor, entry->_name, &entryStat, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(entryStat.st_mode)))
+				{
+					subdirectories.push_back(PendingDirectory{descriptor, entry->_name, entryPath, entryName});
+					continue;
+				}
+				if(entry->_type != DT_REG && entry->_type != DT_LNK && entry->_type != DT_UNKNOWN)
+					continue;
+
+				SourceFile sourceFile;
+				if(fstatat(directoryDescriptor, entry->_name, &sourceFile._stat, 0) != 0 || !S_ISREG(sourceFile._stat.st_mode))
+					continue;
+				sourceFile._path = entryPath;
+				sourceFile._name = entryName;
+				sourceFile._isFound = true;
+				directoryFiles.push_back(std::move(sourceFile));
+			}
+		}
+		if(readBytes < 0)
+			TRACE_ERROR("Unable to read directory: %s\n", path.c_str());
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(treeWalk->_mutex);
+		treeWalk->_files.insert(treeWalk->_files.end(), std::make_move_iterator(directoryFiles.begin()), std::make_move_iterator(directoryFiles.end()));
+		treeWalk->_directories.insert(treeWalk->_directories.end(), std::make_move_iterator(subdirectories.begin()), std::make_move_iterator(subdirectories.end()));
+		--treeWalk->_countWalking;
+	}
+	treeWalk->_cvIsChanged.notify_all();
+
+	//	idle workers help; one that finds nothing left just returns
+	for(size_t i = 0; i < subdirectories.size(); ++i)
+		treeWalk->_threadPool.Post([treeWalk] { WalkDirectories(treeWalk, false); });
+}
+
+FilePrefetcher::FilePrefetcher(const std::vector<SourceFile>& sourceFiles)
+{
+	_paths.reserve(sourceFiles.size());
+	_prefetchOffsets.reserve(sourceFiles.size() + 1);
+	uint64_t prefetchOffset = 0;
+	for(const SourceFile& sourceFile : sourceFiles)
+	{
+		const bool isPrefetched = sourceFile._isFound && S_ISREG(sourceFile._stat.st_mode) && sourceFile._stat.st_size > 0;
+		_paths.push_back(isPrefetched ? sourceFile._path : std::string());
+		_prefetchOffsets.push_back(prefetchOffset);
+		if(isPrefetched)
+			prefetchOffset += std::min<uint64_t>(static_cast<uint64_t>(sourceFile._stat.st_size), PREFETCH_HEAD_SIZE);
+	}
+	_prefetchOffsets.push_back(prefetchOffset);
+	_thread = boost::thread(boost::bind(&FilePrefetcher::PrefetchThread, this));
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+	{
+		boost::lock_guard<boost::mutex> lock(_mutex);
+		_isStopping = true;
+	}
+	_cvIsAdvanced.notify_all();
+	_thread.join();
+}
+
+void FilePrefetcher::Advance(size_t fileIndex)
+{
+	{
+		boost::lock_guard<boost::mutex> lock(_mutex);
+		if(fileIndex <= _transferIndex)
+			return;
+		_transferIndex = fileIndex;
+	}
+	_cvIsAdvanced.notify_one();
+}
+
+void FilePrefetcher::PrefetchThread()
+{
+	size_t prefetchIndex = 0;
+	while(prefetchIndex < _paths.size())
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(_mutex);
+			_cvIsAdvanced.wait(lock, [&] {
+				return _isStopping || (prefetchIndex < _transferIndex + PREFETCH_FILE_COUNT
+										&& _prefetchOffsets[prefetchIndex] < _prefetchOffsets[_transferIndex] + PREFETCH_SIZE);
+			});
+			if(_isStopping)
+				return;
+
+			//	files the workers have got to already are being read anyway
+			prefetchIndex = std::max(prefetchIndex, _transferIndex + 1);
+			if(prefetchIndex >= _paths.size())
+				return;
+		}
+
+		const std::string& path = _paths[prefetchIndex];
+		const uint64_t headSize = _prefetchOffsets[prefetchIndex + 1] - _prefetchOffsets[prefetchIndex];
+		++prefetchIndex;
+		if(path.empty())
+			continue;
+
+		const int fileDescriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fileDescriptor < 0)
+			continue;
+		posix_fadvise(fileDescriptor, 0, static_cast<off_t>(headSize), POSIX_FADV_WILLNEED);
+		close(fileDescriptor);
+	}
+}
@@ -0,0 +1,53 @@
+#include "FutexEvent.h"
+
+#include <cerrno>
+#include <climits>
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+void FutexEvent::Pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+bool FutexEvent::Sleep(uint32_t sequence, uint64_t deadlineNanoseconds)
+{
+	const uint64_t nowNanoseconds = getMonotonicNanoseconds();
+	if(nowNanoseconds >= deadlineNanoseconds)
+		return false;
+
+	struct timespec timeout;
+	timeout.tv_sec = static_cast<time_t>((deadlineNanoseconds - nowNanoseconds) / 1000000000);
+	timeout.tv_nsec = static_cast<long>((deadlineNanoseconds - nowNanoseconds) % 1000000000);
+	if(syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_sequence), FUTEX_WAIT, sequence, &timeout, nullptr, 0) != 0
+		&& errno == ETIMEDOUT)
+		return false;
+
+	//	woken up, the value has already changed or a signal interrupted the call
+	return true;
+}
+
+void FutexEvent::Notify()
+{
+	_sequence.fetch_add(1);
+	if(_countWaiters.load() != 0)
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_sequence), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+void FutexEvent::AdaptSpinLimit(bool isSpinSucceeded)
+{
+	//	grow while spinning pays off, shrink when the waiter has to sleep anyway
+	uint32_t spinLimit = _spinLimit.load(std::memory_order_relaxed);
+	if(isSpinSucceeded)
+		spinLimit = spinLimit * 2 > FUTEX_MAX_SPIN_COUNT ? FUTEX_MAX_SPIN_COUNT : spinLimit * 2;
+	else
+		spinLimit = spinLimit / 2 < FUTEX_MIN_SPIN_COUNT ? FUTEX_MIN_SPIN_COUNT : spinLimit / 2;
+	_spinLimit.store(spinLimit, std::memory_order_relaxed);
+}
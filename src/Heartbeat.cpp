@@ -0,0 +1,14 @@
+#include "Heartbeat.h"
+
+#include "SharedMemoryConsts.h"
+
+void Heartbeat::Beat()
+{
+	_lastBeatMilliseconds.store(getMonotonicNanoseconds() / 1000000, std::memory_order_relaxed);
+}
+
+bool Heartbeat::IsAlive() const
+{
+	return getMonotonicNanoseconds() / 1000000
+			< _lastBeatMilliseconds.load(std::memory_order_relaxed) + HEARTBEAT_TIMEOUT_MILLISECONDS;
+}
@@ -0,0 +1,62 @@
+#include "Histogram.h"
+
+constexpr uint32_t Histogram::SUB_BUCKET_BITS;
+constexpr uint32_t Histogram::SUB_BUCKET_COUNT;
+constexpr uint32_t Histogram::BUCKET_COUNT;
+
+uint32_t Histogram::GetBucketIndex(uint64_t value)
+{
+	if(value < SUB_BUCKET_COUNT)
+		return static_cast<uint32_t>(value);
+
+	uint32_t exponent = 63 - static_cast<uint32_t>(__builtin_clzll(value));
+	uint32_t subBucket = static_cast<uint32_t>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+	return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + subBucket;
+}
+
+uint64_t Histogram::GetBucketLowerBound(uint32_t bucketIndex)
+{
+	if(bucketIndex < SUB_BUCKET_COUNT)
+		return bucketIndex;
+
+	uint32_t exponent = bucketIndex / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+	uint64_t subBucket = bucketIndex % SUB_BUCKET_COUNT;
+	return (SUB_BUCKET_COUNT + subBucket) << (exponent - SUB_BUCKET_BITS);
+}
+
+void Histogram::Record(uint64_t value)
+{
+	_buckets[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Histogram::Reset()
+{
+	for(std::atomic<uint64_t>& bucket : _buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::GetCount() const
+{
+	uint64_t count = 0;
+	for(const std::atomic<uint64_t>& bucket : _buckets)
+		count += bucket.load(std::memory_order_relaxed);
+	return count;
+}
+
+uint64_t Histogram::GetPercentile(double percentile) const
+{
+	const uint64_t count = GetCount();
+	if(count == 0)
+		return 0;
+
+	//	the value reported is the upper bound of the bucket holding the requested rank
+	const uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * (count - 1)) + 1;
+	uint64_t cumulativeCount = 0;
+	for(uint32_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		cumulativeCount += _buckets[i].load(std::memory_order_relaxed);
+		if(cumulativeCount >= rank)
+			return i + 1 < BUCKET_COUNT ? GetBucketLowerBound(i + 1) - 1 : UINT64_MAX;
+	}
+	return UINT64_MAX;
+}
@@ -1,20 +1,166 @@
 #include "Logger.h"
 
-#include <stdarg.h>
-#include <stdio.h>
-#include <boost/interprocess/sync/interprocess_mutex.hpp>
-#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <csignal>
+#include <pthread.h>
 
-using namespace boost::interprocess;
+#include <boost/lexical_cast.hpp>
 
-void trace(const char *fmt, ...)
+namespace
 {
-	static interprocess_mutex traceMutex;
-	scoped_lock<interprocess_mutex> lock(traceMutex);
+	//	Marks the ring of an exited thread, the writer frees it once it's drained.
+	struct ThreadRingHolder
+	{
+		~ThreadRingHolder()
+		{
+			if(_ring)
+				_ring->_isThreadFinished = true;
+		}
 
-	va_list ap;
-	va_start(ap, fmt);
-	vprintf(fmt, ap);
-	va_end(ap);
-	fflush(stdout);
+		std::shared_ptr<LogRing> _ring;
+	};
+
+	thread_local ThreadRingHolder threadRingHolder;
+}
+
+LogRing::LogRing(const std::string& threadIdString)
+	: _threadIdString(threadIdString)
+	, _records(LOG_RING_RECORD_COUNT)
+{
+}
+
+LogRecord* LogRing::GetWriteRecord()
+{
+	const uint64_t head = _head.load(std::memory_order_relaxed);
+	if(head - _tail.load(std::memory_order_acquire) == _records.size())
+		return nullptr;
+	return &_records[head % _records.size()];
+}
+
+void LogRing::PublishWriteRecord()
+{
+	_head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+const LogRecord* LogRing::GetReadRecord()
+{
+	const uint64_t tail = _tail.load(std::memory_order_relaxed);
+	if(tail == _head.load(std::memory_order_acquire))
+		return nullptr;
+	return &_records[tail % _records.size()];
+}
+
+void LogRing::ReleaseReadRecord()
+{
+	_tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+Logger& Logger::GetInstance()
+{
+	static Logger logger;
+	return logger;
+}
+
+Logger::Logger()
+	: _wallClockOffsetMicroseconds(getMicrotime() - static_cast<long>(getMonotonicNanoseconds() / 1000))
+{
+	//	the writer must not take signals the application waits for synchronously
+	sigset_t allSignals, previousSignals;
+	sigfillset(&allSignals);
+	pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+	_writerThread = boost::thread(boost::bind(&Logger::WriterThread, this));
+	pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
+}
+
+Logger::~Logger()
+{
+	_isRunning = false;
+	_writerEvent.Notify();
+	_writerThread.join();
+	Drain();
+}
+
+void Logger::Flush()
+{
+	Drain();
+}
+
+LogRing& Logger::GetThreadRing()
+{
+	if(!threadRingHolder._ring)
+	{
+		std::string threadIdString = boost::lexical_cast<std::string>(boost::this_thread::get_id());
+		threadRingHolder._ring = std::make_shared<LogRing>(threadIdString);
+
+		boost::lock_guard<boost::mutex> lock(_ringsMutex);
+		_rings.push_back(threadRingHolder._ring);
+	}
+	return *threadRingHolder._ring;
+}
+
+LogRecord& Logger::AcquireRecord(LogRing& ring)
+{
+	LogRecord* record = ring.GetWriteRecord();
+	while(!record)
+	{
+		//	the writer is behind: drain on this thread instead of dropping the record
+		Drain();
+		record = ring.GetWriteRecord();
+	}
+	return *record;
+}
+
+void Logger::Drain()
+{
+	boost::lock_guard<boost::mutex> drainLock(_drainMutex);
+	std::vector<std::shared_ptr<LogRing>> rings;
+	{
+		boost::lock_guard<boost::mutex> lock(_ringsMutex);
+		rings = _rings;
+	}
+
+	//	records are picked up to the snapshot of every head and printed in timestamp order
+	_drainRecords.clear();
+	for(const std::shared_ptr<LogRing>& ring : rings)
+	{
+		const uint64_t head = ring->_head.load(std::memory_order_acquire);
+		for(uint64_t index = ring->_tail.load(std::memory_order_relaxed); index != head; ++index)
+			_drainRecords.emplace_back(&ring->_records[index % ring->_records.size()], ring.get());
+	}
+
+	if(_drainRecords.empty())
+		return;
+
+	std::stable_sort(_drainRecords.begin(), _drainRecords.end(),
+		[](const std::pair<const LogRecord*, LogRing*>& left, const std::pair<const LogRecord*, LogRing*>& right)
+		{
+			return left.first->_nanoseconds < right.first->_nanoseconds;
+		});
+
+	for(const std::pair<const LogRecord*, LogRing*>& drainRecord : _drainRecords)
+	{
+		const LogRecord& record = *drainRecord.first;
+		fprintf(TRACE_OUTPUT, "[%ld] [%s] ", _wallClockOffsetMicroseconds + static_cast<long>(record._nanoseconds / 1000),
+				drainRecord.second->_threadIdString.c_str());
+		record._formatter(record, TRACE_OUTPUT);
+	}
+	fflush(TRACE_OUTPUT);
+
+	for(const std::pair<const LogRecord*, LogRing*>& drainRecord : _drainRecords)
+		drainRecord.second->ReleaseReadRecord();
+}
+
+void Logger::WriterThread()
+{
+	while(_isRunning)
+	{
+		_writerEvent.Wait([this]() { return !_isRunning; }, LOG_WRITER_INTERVAL_MILLISECONDS);
+		Drain();
+
+		boost::lock_guard<boost::mutex> lock(_ringsMutex);
+		_rings.erase(std::remove_if(_rings.begin(), _rings.end(),
+			[](const std::shared_ptr<LogRing>& ring)
+			{
+				return ring->_isThreadFinished && !ring->GetReadRecord();
+			}), _rings.end());
+	}
 }
@@ -1,61 +1,511 @@
 #include "MemoryManager.h"
 
+#include <algorithm>
+#include <new>
+
 #include <boost/thread.hpp>
-#include <boost/lexical_cast.hpp>
 
 #include "TransferChunk.h"
 #include "Logger.h"
 
-MemoryManager::MemoryManager(managed_shared_memory& sharedMemorySegment)
+MemoryManager::MemoryManager(managed_shared_memory& sharedMemorySegment, SharedMemoryHeader& sharedMemoryHeader)
 	: _sharedSegment(sharedMemorySegment)
 	, _memoryManagerStatus(MemoryManagerStatus::NOT_INITED)
-	, _lastChunkIndex(std::numeric_limits<uint32_t>::max())
+	, _maxChunkCount(0)
+	, _busyChunkLimit(0)
 {
 	try
 	{
-		TRACE("[%ld] [%s] Shared memory size: %d; MemoryManager Size: %d; TransferChunk size: %d; MaxChunkCount: %d\n"
-			  , getMicrotime(), boost::lexical_cast<std::string>(boost::this_thread::get_id()).c_str()
-			  , _sharedSegment.get_size(), sizeof(MemoryManager)
-			  , sizeof(TransferChunk), _maxChunkCount);
-		_transferChunkContainer = _sharedSegment.construct<TransferChunk>(SHARED_TRANSFER_ARRAY_NAME)[_maxChunkCount]();
+		//	every chunk costs its control block, its metadata, a page aligned ring of frames, a bitmap bit and
+		//	up to two cells in the submission queue of every client slot and in the urgent one; the slots and a few
+		//	pages for alignment and the segment manager bookkeeping are kept aside
+		const size_t ringSize = static_cast<size_t>(sharedMemoryHeader.GetFrameStride()) * sharedMemoryHeader._slotCount;
+		const size_t chunkOverhead = sizeof(TransferChunk) + sizeof(TransferChunkMetadata)
+									+ 2 * (MAX_CLIENT_COUNT + 1) * sizeof(SubmissionQueue::Cell) + sizeof(uint64_t);
+		const size_t reservedSize = 8 * PAYLOAD_ALIGNMENT + MAX_CLIENT_COUNT * sizeof(ClientSlot);
+		const size_t freeMemory = _sharedSegment.get_free_memory();
+		if(freeMemory > reservedSize)
+			_maxChunkCount = static_cast<uint32_t>((freeMemory - reservedSize) / (chunkOverhead + ringSize));
+
+		TRACE("Shared memory size: %lu; MemoryManager Size: %d; TransferChunk size: %d; Frame size: %d; Slot count: %d; MaxChunkCount: %d\n", _sharedSegment.get_size(), sizeof(MemoryManager), sizeof(TransferChunk)
+			  , sharedMemoryHeader._frameSize, sharedMemoryHeader._slotCount, _maxChunkCount);
+		if(_maxChunkCount == 0)
+			throw std::bad_alloc();
+
+		//	structure of arrays: cache line aligned control blocks, the metadata table and the page aligned payload area
+		_transferChunkContainer = static_cast<TransferChunk*>(_sharedSegment.allocate_aligned(sizeof(TransferChunk) * _maxChunkCount, CACHE_LINE_SIZE));
+		TransferChunkMetadata* metadata = static_cast<TransferChunkMetadata*>(_sharedSegment.allocate(sizeof(TransferChunkMetadata) * _maxChunkCount));
+		_chunkBitmap.Attach(static_cast<std::atomic<uint64_t>*>(_sharedSegment.allocate(ChunkBitmap::GetWordCount(_maxChunkCount) * sizeof(uint64_t)))
+							, _maxChunkCount);
+		const uint32_t queueCapacity = SubmissionQueue::GetCapacity(_maxChunkCount);
+		_clientSlots = static_cast<ClientSlot*>(_sharedSegment.allocate_aligned(sizeof(ClientSlot) * MAX_CLIENT_COUNT, CACHE_LINE_SIZE));
+		for(uint32_t i = 0; i < MAX_CLIENT_COUNT; ++i)
+		{
+			ClientSlot* clientSlot = new (&_clientSlots[i]) ClientSlot();
+			clientSlot->_submissionQueue.Attach(static_cast<SubmissionQueue::Cell*>(_sharedSegment.allocate(queueCapacity * sizeof(SubmissionQueue::Cell)))
+												, queueCapacity);
+		}
+		_urgentSubmissionQueue.Attach(static_cast<SubmissionQueue::Cell*>(_sharedSegment.allocate(queueCapacity * sizeof(SubmissionQueue::Cell)))
+									  , queueCapacity);
+		uint8_t* payload = static_cast<uint8_t*>(_sharedSegment.allocate_aligned(ringSize * _maxChunkCount, PAYLOAD_ALIGNMENT));
+		for(uint32_t i = 0; i < _maxChunkCount; ++i)
+		{
+			TransferChunk* transferChunk = new (&_transferChunkContainer[i]) TransferChunk();
+			transferChunk->_metadata = new (&metadata[i]) TransferChunkMetadata();
+			transferChunk->AttachRing(payload + ringSize * i, sharedMemoryHeader._frameSize
+									  , static_cast<uint32_t>(sharedMemoryHeader.GetFrameStride()), sharedMemoryHeader._slotCount);
+		}
+
+		sharedMemoryHeader._chunkCount = _maxChunkCount;
+		_busyChunkLimit = _maxChunkCount;
+		UpdateClassChunkLimits();
+		_serverHeartbeat.Beat();
 		SetMemoryManagerStatus(MemoryManagerStatus::READY);
 	}
 	catch(...)
 	{
-		TRACE("[%ld] [%s] Chunk array allocation error\n", getMicrotime(), boost::lexical_cast<std::string>(boost::this_thread::get_id()).c_str());
+		TRACE_ERROR("Chunk array allocation error\n");
 	}
 }
 
 void MemoryManager::SetMemoryManagerStatus(MemoryManagerStatus status)
 {
-	_memoryManagerStatus = status;
+	_memoryManagerStatus.store(status);
 }
 
 MemoryManagerStatus MemoryManager::GetMemoryManagerStatus() const
 {
-	return _memoryManagerStatus;
+	return _memoryManagerStatus.load();
+}
+
+Heartbeat& MemoryManager::GetServerHeartbeat()
+{
+	return _serverHeartbeat;
+}
+
+const Heartbeat& MemoryManager::GetServerHeartbeat() const
+{
+	return _serverHeartbeat;
+}
+
+uint32_t MemoryManager::GetBusyChunkCount() const
+{
+	return _busyChunkCount.load(std::memory_order_relaxed);
+}
+
+uint32_t MemoryManager::GetDrainRate() const
+{
+	return _drainRate.load(std::memory_order_relaxed);
+}
+
+void MemoryManager::SetBusyChunkLimit(uint32_t busyChunkLimit)
+{
+	_busyChunkLimit = std::min(busyChunkLimit, _maxChunkCount);
+	UpdateClassChunkLimits();
+}
+
+void MemoryManager::SetChunkReserves(uint32_t urgentChunkReserve, uint32_t normalChunkReserve)
+{
+	_urgentChunkReserve = urgentChunkReserve;
+	_normalChunkReserve = normalChunkReserve;
+	UpdateClassChunkLimits();
+}
+
+void MemoryManager::UpdateClassChunkLimits()
+{
+	//	every class keeps at least a chunk, however large the reserves above it are
+	const uint32_t normalChunkLimit = _busyChunkLimit - std::min(_urgentChunkReserve, _busyChunkLimit);
+	_classChunkLimits[static_cast<uint32_t>(TransferPriority::URGENT)] = _busyChunkLimit;
+	_classChunkLimits[static_cast<uint32_t>(TransferPriority::NORMAL)] = std::max(normalChunkLimit, 1u);
+	_classChunkLimits[static_cast<uint32_t>(TransferPriority::BULK)] = std::max(normalChunkLimit - std::min(_normalChunkReserve, normalChunkLimit), 1u);
+}
+
+const ClientSlot& MemoryManager::GetClientSlot(uint32_t clientIndex) const
+{
+	return _clientSlots[clientIndex];
+}
+
+uint32_t MemoryManager::RegisterClient(uint32_t processId, uint32_t weight, uint32_t chunkQuota)
+{
+	for(uint32_t i = 0; i < MAX_CLIENT_COUNT; ++i)
+	{
+		ClientSlot& clientSlot = _clientSlots[i];
+		ClientSlotStatus status = ClientSlotStatus::FREE;
+		if(!clientSlot._status.compare_exchange_strong(status, ClientSlotStatus::CLAIMED))
+			continue;
+
+		clientSlot._processId = processId;
+		clientSlot._processStartTime = ClientSlot::GetProcessStartTime(processId);
+		clientSlot._weight = std::max(weight, 1u);
+		clientSlot._chunkQuota = chunkQuota;
+		//	a single chunk until the server has worked out the share, so the first file doesn't wait for it
+		clientSlot._chunkShare.store(1);
+		clientSlot._status.store(ClientSlotStatus::ACTIVE, std::memory_order_release);
+		RequestSchedule();
+		return i;
+	}
+	return NO_CLIENT_SLOT;
 }
 
-uint32_t MemoryManager::GetLastChunkIndex() const
+void MemoryManager::UnregisterClient(uint32_t clientIndex)
 {
-	return _lastChunkIndex;
+	_clientSlots[clientIndex]._status.store(ClientSlotStatus::CLOSING, std::memory_order_release);
+	RequestSchedule();
 }
 
-TransferChunk* MemoryManager::GetNextFreeTransferChunkPointer()
+TransferChunk* MemoryManager::AcquireTransferChunk(uint32_t clientIndex, TransferPriority priority)
 {
-	uint32_t chunkIndex = (_lastChunkIndex + 1) % _maxChunkCount;
+	ClientSlot& clientSlot = _clientSlots[clientIndex];
+	const uint32_t clientLimit = GetClientChunkLimit(clientSlot, priority);
+	if(GetFreeClassChunkCount(priority) == 0)
+		return nullptr;
+
+	//	the limit keeps the number of chunks in flight within the number of server workers, the class limit leaves the reserves;
+	//	it's taken before the client's count, which the server trusts when it reclaims the slot of a dead client
+	const uint32_t classChunkLimit = _classChunkLimits[static_cast<uint32_t>(priority)];
+	uint32_t busyChunkCount = _busyChunkCount.load(std::memory_order_relaxed);
+	do
+	{
+		if(busyChunkCount >= classChunkLimit)
+			return nullptr;
+	}
+	while(!_busyChunkCount.compare_exchange_weak(busyChunkCount, busyChunkCount + 1));
+
+	uint32_t clientBusyChunkCount = clientSlot._busyChunkCount.load(std::memory_order_relaxed);
 	do
 	{
-		if(!_transferChunkContainer[chunkIndex]._isChunkBusy)
+		if(clientBusyChunkCount >= clientLimit)
 		{
-			_transferChunkContainer[chunkIndex]._isChunkBusy = true;
-			_lastChunkIndex = chunkIndex;
-			return &_transferChunkContainer[chunkIndex];
+			--_busyChunkCount;
+			return nullptr;
 		}
-		++chunkIndex;
-		chunkIndex = chunkIndex % _maxChunkCount;
 	}
-	while(chunkIndex != _lastChunkIndex);
+	while(!clientSlot._busyChunkCount.compare_exchange_weak(clientBusyChunkCount, clientBusyChunkCount + 1));
+
+	uint32_t chunkIndex = 0;
+	if(!_chunkBitmap.Acquire(chunkIndex))
+	{
+		--_busyChunkCount;
+		--clientSlot._busyChunkCount;
+		return nullptr;
+	}
+
+	//	a client that becomes busy takes a part of the others' shares; its submission wakes the server anyway
+	if(clientBusyChunkCount == 0)
+		_isScheduleRequested.store(true);
+
+	TransferChunk* transferChunk = &_transferChunkContainer[chunkIndex];
+	transferChunk->_clientIndex = clientIndex;
+	transferChunk->_priority = priority;
+	transferChunk->_holderIndex.store(clientIndex, std::memory_order_release);
+	return transferChunk;
+}
+
+uint32_t MemoryManager::GetClientChunkLimit(const ClientSlot& clientSlot, TransferPriority priority) const
+{
+	//	the share is the server's split of the busy limit between the clients, the quota is the client's own cap;
+	//	an urgent transfer may go over the share
+	if(priority == TransferPriority::URGENT)
+		return clientSlot._chunkQuota ? clientSlot._chunkQuota : UINT32_MAX;
+	return clientSlot.GetChunkLimit();
+}
+
+uint32_t MemoryManager::GetFreeClassChunkCount(TransferPriority priority) const
+{
+	//	the chunks a class may still take once every waiting thread of a higher class has got one
+	const uint32_t classChunkLimit = _classChunkLimits[static_cast<uint32_t>(priority)];
+	const uint32_t busyChunkCount = _busyChunkCount.load(std::memory_order_relaxed);
+	uint32_t higherWaitingCount = 0;
+	for(uint32_t i = 0; i < static_cast<uint32_t>(priority); ++i)
+		higherWaitingCount += _waitingCounts[i].load(std::memory_order_relaxed);
+	if(busyChunkCount + higherWaitingCount >= classChunkLimit)
+		return 0;
+	return classChunkLimit - busyChunkCount - higherWaitingCount;
+}
+
+uint32_t MemoryManager::GetChunkCredits(uint32_t clientIndex, TransferPriority priority) const
+{
+	const ClientSlot& clientSlot = _clientSlots[clientIndex];
+	const uint32_t clientLimit = GetClientChunkLimit(clientSlot, priority);
+	const uint32_t clientBusyChunkCount = clientSlot._busyChunkCount.load(std::memory_order_relaxed);
+	if(clientBusyChunkCount >= clientLimit)
+		return 0;
+	return std::min(clientLimit - clientBusyChunkCount, GetFreeClassChunkCount(priority));
+}
+
+bool MemoryManager::WaitForChunkCredit(uint32_t clientIndex, TransferPriority priority, uint32_t timeoutMilliseconds)
+{
+	return _creditEvent.Wait([&] { return GetChunkCredits(clientIndex, priority) != 0; }, timeoutMilliseconds);
+}
+
+void MemoryManager::SetClientWaiting(uint32_t clientIndex, TransferPriority priority, bool isWaiting)
+{
+	ClientSlot& clientSlot = _clientSlots[clientIndex];
+	const uint32_t classIndex = static_cast<uint32_t>(priority);
+	if(!isWaiting)
+	{
+		--_waitingCounts[classIndex];
+		//	the lower classes stop yielding to the thread
+		if(clientSlot._waitingCounts[classIndex].fetch_sub(1) == 1 && priority != TransferPriority::BULK)
+			NotifyCredit();
+		return;
+	}
 
+	++_waitingCounts[classIndex];
+	if(clientSlot._waitingCounts[classIndex].fetch_add(1) == 0)
+		RequestSchedule();
+}
+
+bool MemoryManager::SubmitTransferChunk(TransferChunk* transferChunk)
+{
+	//	urgent chunks are taken before the round-robin over the clients
+	ClientSlot& clientSlot = _clientSlots[transferChunk->_clientIndex];
+	SubmissionQueue& submissionQueue = transferChunk->_priority == TransferPriority::URGENT ? _urgentSubmissionQueue : clientSlot._submissionQueue;
+
+	//	the server owns the chunk from the push on and may release it (and another client take it) at once
+	transferChunk->_holderIndex.store(NO_CLIENT_SLOT, std::memory_order_release);
+	if(!submissionQueue.Push(static_cast<uint32_t>(transferChunk - _transferChunkContainer.get())))
+	{
+		transferChunk->_holderIndex.store(transferChunk->_clientIndex, std::memory_order_release);
+		return false;
+	}
+	++_pendingSubmissionCount;
+
+	//	pairs with the waiter registration in FutexEvent::Wait (no lost wakeups)
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	_submissionEvent.Notify();
+	return true;
+}
+
+void MemoryManager::RequestSchedule()
+{
+	_isScheduleRequested.store(true);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	_submissionEvent.Notify();
+}
+
+void MemoryManager::ScheduleClients()
+{
+	//	shares are recomputed when a client registers, leaves, starts waiting or goes idle,
+	//	and every heartbeat interval together with the reclamation of dead clients' slots
+	bool isScheduleDue = _isScheduleRequested.exchange(false);
+	const uint64_t nowNanoseconds = getMonotonicNanoseconds();
+	if(nowNanoseconds - _lastReclaimNanoseconds >= uint64_t(HEARTBEAT_INTERVAL_MILLISECONDS) * 1000000)
+	{
+		ReclaimClientSlots();
+		UpdateDrainRate(nowNanoseconds);
+		_lastReclaimNanoseconds = nowNanoseconds;
+		isScheduleDue = true;
+	}
+	if(!isScheduleDue)
+		return;
+
+	//	a client is active while it has chunks in flight or waits for one; only active ones split the limit
+	bool isActive[MAX_CLIENT_COUNT] = {false};
+	bool isSettled[MAX_CLIENT_COUNT] = {false};
+	uint64_t remainingLimit = _busyChunkLimit;
+	uint64_t remainingWeight = 0;
+	for(uint32_t i = 0; i < MAX_CLIENT_COUNT; ++i)
+	{
+		const ClientSlot& clientSlot = _clientSlots[i];
+		isActive[i] = clientSlot.IsRegistered()
+					&& (clientSlot._busyChunkCount.load(std::memory_order_relaxed) || clientSlot.GetWaitingCount());
+		if(isActive[i])
+			remainingWeight += clientSlot._weight;
+	}
+
+	//	water filling: a client whose quota is below its fair share keeps the quota and the rest is split again
+	bool isSettling = true;
+	while(isSettling && remainingWeight)
+	{
+		isSettling = false;
+		for(uint32_t i = 0; i < MAX_CLIENT_COUNT; ++i)
+		{
+			ClientSlot& clientSlot = _clientSlots[i];
+			if(!isActive[i] || isSettled[i] || !clientSlot._chunkQuota
+				|| clientSlot._chunkQuota >= (remainingLimit * clientSlot._weight + remainingWeight - 1) / remainingWeight)
+				continue;
+
+			clientSlot._chunkShare.store(clientSlot._chunkQuota, std::memory_order_relaxed);
+			isSettled[i] = true;
+			remainingLimit -= std::min<uint64_t>(clientSlot._chunkQuota, remainingLimit);
+			remainingWeight -= clientSlot._weight;
+			isSettling = true;
+		}
+	}
+
+	//	an idle client gets the share it would have next to the active ones, so it starts at once;
+	//	chunks above a shrunk share are not taken back, the client just doesn't get new ones for a while
+	for(uint32_t i = 0; i < MAX_CLIENT_COUNT; ++i)
+	{
+		ClientSlot& clientSlot = _clientSlots[i];
+		if(isSettled[i] || !clientSlot.IsRegistered())
+			continue;
+
+		const uint64_t weight = clientSlot._weight;
+		const uint64_t totalWeight = isActive[i] ? remainingWeight : remainingWeight + weight;
+		const uint64_t share = (remainingLimit * weight + totalWeight - 1) / totalWeight;
+		clientSlot._chunkShare.store(static_cast<uint32_t>(std::max<uint64_t>(share, 1)), std::memory_order_relaxed);
+	}
+
+	//	a grown share is a credit too
+	NotifyCredit();
+}
+
+void MemoryManager::UpdateDrainRate(uint64_t nowNanoseconds)
+{
+	const uint64_t releasedChunkCount = _releasedChunkCount.load(std::memory_order_relaxed);
+	if(_lastDrainNanoseconds)
+	{
+		//	exponential moving average over the heartbeat intervals, a quarter of weight for the last one
+		const uint64_t drainRate = (releasedChunkCount - _lastReleasedChunkCount) * 1000000000ull / std::max<uint64_t>(nowNanoseconds - _lastDrainNanoseconds, 1);
+		const uint64_t smoothedRate = (3 * uint64_t(_drainRate.load(std::memory_order_relaxed)) + drainRate + 3) / 4;
+		_drainRate.store(static_cast<uint32_t>(std::min<uint64_t>(smoothedRate, UINT32_MAX)), std::memory_order_relaxed);
+	}
+	_lastDrainNanoseconds = nowNanoseconds;
+	_lastReleasedChunkCount = releasedChunkCount;
+}
+
+void MemoryManager::NotifyCredit()
+{
+	//	pairs with the waiter registration in FutexEvent::Wait (no lost wakeups)
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	_creditEvent.Notify();
+}
+
+void MemoryManager::ReclaimClientSlots()
+{
+	//	chunks a dead client acquired but never submitted reach no server thread, they're freed here
+	bool isDead[MAX_CLIENT_COUNT] = {false};
+	bool isAnyDead = false;
+	for(uint32_t i = 0; i < MAX_CLIENT_COUNT; ++i)
+	{
+		const ClientSlot& clientSlot = _clientSlots[i];
+		isDead[i] = clientSlot._status.load(std::memory_order_acquire) == ClientSlotStatus::ACTIVE && !clientSlot.IsProcessAlive();
+		isAnyDead |= isDead[i];
+	}
+	if(!isAnyDead)
+	{
+		FreeClosedClientSlots(isDead, nullptr);
+		return;
+	}
+
+	uint32_t submittedChunkCounts[MAX_CLIENT_COUNT] = {0};
+	for(uint32_t chunkIndex = 0; chunkIndex < _maxChunkCount; ++chunkIndex)
+	{
+		TransferChunk* transferChunk = &_transferChunkContainer[chunkIndex];
+		const uint32_t holderIndex = transferChunk->_holderIndex.load(std::memory_order_acquire);
+		if(holderIndex < MAX_CLIENT_COUNT && isDead[holderIndex])
+		{
+			//	the counts go with the slot below, the client may have died before committing them
+			TRACE_ERROR("Chunk %u of the gone client process %u is released\n", chunkIndex, _clientSlots[holderIndex]._processId);
+			transferChunk->Reset();
+			_chunkBitmap.Release(chunkIndex);
+			continue;
+		}
+
+		//	the server releases a chunk's counts before resetting it, so one not reset yet is still counted
+		const uint32_t clientIndex = transferChunk->_clientIndex;
+		if(holderIndex == NO_CLIENT_SLOT && clientIndex < MAX_CLIENT_COUNT && isDead[clientIndex]
+			&& transferChunk->_transferStatus.load() != TransferChunkStatus::NOT_INITED)
+			++submittedChunkCounts[clientIndex];
+	}
+	FreeClosedClientSlots(isDead, submittedChunkCounts);
+}
+
+void MemoryManager::FreeClosedClientSlots(const bool* isDead, const uint32_t* submittedChunkCounts)
+{
+	//	a slot is reused only once the last chunk of its client is released, so its queue is empty by then
+	bool isCreditReturned = false;
+	for(uint32_t i = 0; i < MAX_CLIENT_COUNT; ++i)
+	{
+		ClientSlot& clientSlot = _clientSlots[i];
+		const ClientSlotStatus status = clientSlot._status.load(std::memory_order_acquire);
+		if(isDead[i])
+		{
+			if(submittedChunkCounts[i] != 0)
+				continue;
+
+			//	nothing of the client is left with the server: what its slot still counts are the chunks freed above
+			//	and those it had counted when it died
+			const uint32_t leakedChunkCount = clientSlot._busyChunkCount.exchange(0);
+			_busyChunkCount -= leakedChunkCount;
+			_releasedChunkCount.fetch_add(leakedChunkCount, std::memory_order_relaxed);
+			isCreditReturned |= leakedChunkCount != 0;
+			TRACE_ERROR("Client process %u has gone, its slot %u is reclaimed\n", clientSlot._processId, i);
+		}
+		else if(status != ClientSlotStatus::CLOSING || clientSlot._busyChunkCount.load() != 0)
+			continue;
+
+		//	the threads of a crashed client never stop waiting themselves
+		for(uint32_t classIndex = 0; classIndex < TRANSFER_PRIORITY_COUNT; ++classIndex)
+			_waitingCounts[classIndex] -= clientSlot._waitingCounts[classIndex].exchange(0);
+		clientSlot._chunkShare.store(0);
+		clientSlot._status.store(ClientSlotStatus::FREE, std::memory_order_release);
+	}
+
+	if(isCreditReturned)
+	{
+		RequestSchedule();
+		NotifyCredit();
+	}
+}
+
+TransferChunk* MemoryManager::TakeSubmittedTransferChunk()
+{
+	if(_pendingSubmissionCount.load() == 0)
+		return nullptr;
+
+	uint32_t chunkIndex = 0;
+	if(_urgentSubmissionQueue.Pop(chunkIndex))
+	{
+		--_pendingSubmissionCount;
+		if(chunkIndex < _maxChunkCount)
+			return &_transferChunkContainer[chunkIndex];
+	}
+
+	//	weighted round-robin: up to a weight's worth of chunks from a client, then the next one
+	for(uint32_t visitCount = 0; visitCount <= MAX_CLIENT_COUNT; ++visitCount)
+	{
+		if(_scheduleBudget && _clientSlots[_scheduleCursor]._submissionQueue.Pop(chunkIndex))
+		{
+			--_scheduleBudget;
+			--_pendingSubmissionCount;
+			if(chunkIndex < _maxChunkCount)
+				return &_transferChunkContainer[chunkIndex];
+			continue;
+		}
+
+		_scheduleCursor = (_scheduleCursor + 1) % MAX_CLIENT_COUNT;
+		_scheduleBudget = _clientSlots[_scheduleCursor]._weight;
+	}
 	return nullptr;
 }
+
+void MemoryManager::WaitForSubmission(uint32_t timeoutMilliseconds)
+{
+	_submissionEvent.Wait([&] {
+								return _pendingSubmissionCount.load() != 0 || _isScheduleRequested.load();
+							}, timeoutMilliseconds);
+}
+
+void MemoryManager::WakeServer()
+{
+	_submissionEvent.Notify();
+}
+
+void MemoryManager::ReleaseTransferChunk(TransferChunk* transferChunk)
+{
+	//	the counts go before the reset, the reclaim of a dead client's slot tells its chunks in flight by their status
+	ClientSlot& clientSlot = _clientSlots[transferChunk->_clientIndex];
+	const bool isClientIdle = --clientSlot._busyChunkCount == 0 && clientSlot.GetWaitingCount() == 0;
+	--_busyChunkCount;
+	_releasedChunkCount.fetch_add(1, std::memory_order_relaxed);
+	transferChunk->Reset();
+	_chunkBitmap.Release(static_cast<uint32_t>(transferChunk - _transferChunkContainer.get()));
+
+	//	a client going idle leaves its share to the others
+	if(isClientIdle)
+		RequestSchedule();
+	NotifyCredit();
+}
@@ -0,0 +1,124 @@
+#include "MemoryPlacement.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Logger.h"
+
+namespace
+{
+	constexpr int MEMORY_POLICY_BIND = 2;				//	MPOL_BIND
+	constexpr unsigned MEMORY_POLICY_MOVE = 1 << 1;		//	MPOL_MF_MOVE
+	constexpr int ADVICE_POPULATE_WRITE = 23;			//	MADV_POPULATE_WRITE, Linux 5.14
+
+	void GetPageRange(void* address, size_t size, uintptr_t& begin, size_t& length)
+	{
+		const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+		begin = reinterpret_cast<uintptr_t>(address) & ~(pageSize - 1);
+		length = (reinterpret_cast<uintptr_t>(address) + size - begin + pageSize - 1) & ~(pageSize - 1);
+	}
+}
+
+bool MemoryPlacement::AdviseHugePages(void* address, size_t size)
+{
+	uintptr_t begin = 0;
+	size_t length = 0;
+	GetPageRange(address, size, begin, length);
+	if(madvise(reinterpret_cast<void*>(begin), length, MADV_HUGEPAGE) != 0)
+	{
+		TRACE_ERROR("Huge pages are not available: errno %d\n", errno);
+		return false;
+	}
+	return true;
+}
+
+bool MemoryPlacement::Prefault(void* address, size_t size)
+{
+	uintptr_t begin = 0;
+	size_t length = 0;
+	GetPageRange(address, size, begin, length);
+	if(madvise(reinterpret_cast<void*>(begin), length, ADVICE_POPULATE_WRITE) == 0)
+		return true;
+
+	//	older kernels: a read fault allocates the tmpfs page as well and doesn't touch the segment content
+	const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	for(size_t offset = 0; offset < length; offset += pageSize)
+		(void)*reinterpret_cast<volatile const uint8_t*>(begin + offset);
+	return true;
+}
+
+bool MemoryPlacement::BindToNode(void* address, size_t size, int32_t numaNode)
+{
+	if(numaNode < 0)
+		return false;
+
+	uintptr_t begin = 0;
+	size_t length = 0;
+	GetPageRange(address, size, begin, length);
+
+	const size_t bitsPerWord = 8 * sizeof(unsigned long);
+	std::vector<unsigned long> nodeMask(numaNode / bitsPerWord + 1, 0);
+	nodeMask[numaNode / bitsPerWord] |= 1UL << (numaNode % bitsPerWord);
+
+	//	the policy of a shared mapping is kept by the shared memory object itself, so it holds for every process
+	if(syscall(SYS_mbind, begin, length, MEMORY_POLICY_BIND, nodeMask.data(), nodeMask.size() * bitsPerWord + 1, MEMORY_POLICY_MOVE) != 0)
+	{
+		TRACE_ERROR("Unable to bind the segment to NUMA node %d: errno %d\n", numaNode, errno);
+		return false;
+	}
+	return true;
+}
+
+bool MemoryPlacement::GetNodeCpus(int32_t numaNode, std::vector<uint32_t>& cpus)
+{
+	cpus.clear();
+	std::ifstream cpuListFile("/sys/devices/system/node/node" + std::to_string(numaNode) + "/cpulist");
+	std::string cpuList;
+	if(numaNode < 0 || !std::getline(cpuListFile, cpuList))
+		return false;
+
+	//	"0-3,8-11" form
+	std::stringstream cpuListStream(cpuList);
+	std::string cpuRange;
+	while(std::getline(cpuListStream, cpuRange, ','))
+	{
+		uint32_t first = 0;
+		uint32_t last = 0;
+		char separator = 0;
+		std::stringstream cpuRangeStream(cpuRange);
+		if(!(cpuRangeStream >> first))
+			continue;
+		last = (cpuRangeStream >> separator >> last) ? last : first;
+		for(uint32_t cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+	}
+	return !cpus.empty();
+}
+
+bool MemoryPlacement::PinCurrentThreadToNode(int32_t numaNode)
+{
+	std::vector<uint32_t> cpus;
+	if(!GetNodeCpus(numaNode, cpus))
+	{
+		TRACE_ERROR("Unable to get the CPUs of NUMA node %d\n", numaNode);
+		return false;
+	}
+
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	for(uint32_t cpu : cpus)
+	{
+		if(cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &cpuSet);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+}
@@ -0,0 +1,80 @@
+#include "OutgoingStream.h"
+
+#include "SharedMemoryClient.h"
+
+OutgoingStream::OutgoingStream(SharedMemoryClient& client, TransferChunk* transferChunk, const TransferTicket& ticket, const Heartbeat& serverHeartbeat,
+								SharedMemoryMetrics* metrics, CompressionCodec codec, int32_t compressionLevel)
+	: _client(client)
+	, _transferChunk(transferChunk)
+	, _writer(transferChunk, serverHeartbeat, metrics, codec, compressionLevel)
+	, _ticket(ticket)
+{
+}
+
+OutgoingStream::~OutgoingStream()
+{
+	//	a stream that wasn't closed is cut short, the server drops what it got
+	Finish(false);
+}
+
+uint8_t* OutgoingStream::Reserve(size_t& countBytes)
+{
+	return _isFinished ? nullptr : _writer.Reserve(countBytes);
+}
+
+void OutgoingStream::Commit(size_t countBytes)
+{
+	_writer.Commit(countBytes);
+}
+
+bool OutgoingStream::Write(const void* data, size_t countBytes)
+{
+	return !_isFinished && _writer.Write(data, countBytes);
+}
+
+bool OutgoingStream::Writev(const struct iovec* vectors, size_t vectorCount)
+{
+	for(size_t i = 0; i < vectorCount; ++i)
+	{
+		if(!Write(vectors[i].iov_base, vectors[i].iov_len))
+			return false;
+	}
+	return !_isFinished;
+}
+
+bool OutgoingStream::Flush()
+{
+	if(_isFinished)
+		return false;
+
+	_writer.Flush();
+	return _writer.GetStatus() == TransferStreamStatus::STREAMING;
+}
+
+bool OutgoingStream::Close()
+{
+	Finish(true);
+	return _writer.GetStatus() == TransferStreamStatus::FINISHED;
+}
+
+void OutgoingStream::Abort()
+{
+	Finish(false);
+}
+
+TransferStreamStatus OutgoingStream::GetStatus() const
+{
+	return _writer.GetStatus();
+}
+
+void OutgoingStream::Finish(bool isCompleted)
+{
+	if(_isFinished)
+		return;
+
+	_isFinished = true;
+	//	the chunk is the server's again once the writer is finished, it's beaten no more before that
+	_client.UnregisterStream(_transferChunk);
+	_writer.Finish(isCompleted);
+	_client.CompleteStream(_ticket, _writer.GetStatus() == TransferStreamStatus::FINISHED);
+}
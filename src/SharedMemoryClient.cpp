@@ -1,183 +1,605 @@
 #include "SharedMemoryClient.h"
 
 #include <iostream>
-#include <fstream>
+#include <algorithm>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <boost/date_time/posix_time/posix_time_types.hpp>
-#include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/lexical_cast.hpp>
 
 #include "MemoryManager.h"
 #include "TransferChunk.h"
+#include "FileMapping.h"
+#include "TransferStream.h"
+#include "TransferJournal.h"
+#include "FileTreeWalker.h"
+#include "OutgoingStream.h"
+#include "Crc32c.h"
+#include "SharedMemoryHeader.h"
+#include "SharedMemoryMetrics.h"
+#include "MemoryPlacement.h"
 #include "SharedMemoryConsts.h"
 #include "Logger.h"
 
-SharedMemoryClient::SharedMemoryClient()
+namespace
+{
+	constexpr size_t RESUME_CHECK_BUFFER_SIZE = 1024*1024;
+
+	//	FNV-1a over the identity of the file: the same file, not modified since, gets the same key in any process
+	uint64_t GetSourceKey(const struct stat& fileStat)
+	{
+		const uint64_t fields[] = {static_cast<uint64_t>(fileStat.st_dev), static_cast<uint64_t>(fileStat.st_ino), static_cast<uint64_t>(fileStat.st_size)
+									, static_cast<uint64_t>(fileStat.st_mtim.tv_sec), static_cast<uint64_t>(fileStat.st_mtim.tv_nsec)};
+		uint64_t key = 14695981039346656037ull;
+		for(uint64_t field : fields)
+		{
+			for(uint32_t i = 0; i < sizeof(field); ++i)
+			{
+				key ^= (field >> (i * 8)) & 0xFF;
+				key *= 1099511628211ull;
+			}
+		}
+		return key ? key : 1;
+	}
+}
+
+SharedMemoryClient::SharedMemoryClient(const SharedMemoryConfig& config)
 	: _sharedSegment(open_only, SHARED_MEMORY_NAME)
+	, _stripeSize(config._stripeSize)
+	, _batchFileSize(config._batchFileSize)
+	, _compressionCodec(config._compressionCodec)
+	, _compressionLevel(config._compressionLevel)
+	, _transferOptions(config._transferOptions)
+	, _transferThreadPool(config._threadCount ? config._threadCount : ThreadPool::GetDefaultThreadCount())
 {
+	_sharedMemoryHeaderPtr = _sharedSegment.find<SharedMemoryHeader>(SHARED_MEMORY_HEADER_NAME).first;
+	if(!_sharedMemoryHeaderPtr || !_sharedMemoryHeaderPtr->IsCompatible())
+	{
+		TRACE_ERROR("Shared memory layout is missing or has an incompatible version\n");
+		_sharedMemoryHeaderPtr = nullptr;
+		_memoryManagerPtr = nullptr;
+		_metricsPtr = nullptr;
+		return;
+	}
+
+	//	the mapping of every process has to ask for huge pages on its own; the node is the server's unless it's overridden
+	if(_sharedMemoryHeaderPtr->_isHugePageBacked)
+		MemoryPlacement::AdviseHugePages(_sharedSegment.get_address(), _sharedSegment.get_size());
+	const int32_t numaNode = config._numaNode != NO_NUMA_NODE ? config._numaNode : _sharedMemoryHeaderPtr->_numaNode;
+	if(numaNode != NO_NUMA_NODE)
+		_transferThreadPool.SetNumaNode(numaNode);
+
 	_memoryManagerPtr = _sharedSegment.find<MemoryManager>(SHARED_MEMORY_MANAGER_NAME).first;
-	_sharedTransferChunkArray = _sharedSegment.find<TransferChunk>(SHARED_TRANSFER_ARRAY_NAME).first;
+	_metricsPtr = _sharedSegment.find<SharedMemoryMetrics>(SHARED_MEMORY_METRICS_NAME).first;
+	_journalTablePtr = _sharedSegment.find<JournalTable>(SHARED_MEMORY_JOURNAL_NAME).first;
+	if(config._isDedupEnabled)
+	{
+		std::pair<DedupIndexEntry*, size_t> dedupIndex = _sharedSegment.find<DedupIndexEntry>(SHARED_MEMORY_DEDUP_INDEX_NAME);
+		_dedupIndex._entries = dedupIndex.first;
+		_dedupIndex._entryCount = static_cast<uint32_t>(dedupIndex.second);
+	}
+
+	if(_memoryManagerPtr && _memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::READY)
+	{
+		_clientIndex = _memoryManagerPtr->RegisterClient(static_cast<uint32_t>(getpid()), config._clientWeight, config._clientChunkQuota);
+		if(_clientIndex == NO_CLIENT_SLOT)
+			TRACE_ERROR("Every one of %u client slots is taken\n", MAX_CLIENT_COUNT);
+	}
 
 	if(IsInited())
 		_clientStatus.store(SharedMemoryClientStatus::INITED);
 }
 
+SharedMemoryClient::~SharedMemoryClient()
+{
+	{
+		boost::lock_guard<boost::mutex> lock(_streamsMutex);
+		_isStopping = true;
+	}
+	_cvStreamsChanged.notify_all();
+	if(_streamHeartbeatThread.joinable())
+		_streamHeartbeatThread.join();
+
+	//	the slot is given up once no worker can allocate from it anymore
+	_transferThreadPool.Join();
+	if(_clientIndex != NO_CLIENT_SLOT)
+		_memoryManagerPtr->UnregisterClient(_clientIndex);
+}
+
 SharedMemoryClientStatus SharedMemoryClient::GetClientStatus() const
 {
-	return _countThreads == 0
+	return _countPendingTransfers == 0
 			? SharedMemoryClientStatus::COMPLETED
 			: _clientStatus.load();
 }
 
 bool SharedMemoryClient::IsInited() const
 {
-	return _memoryManagerPtr && _memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::READY
-			&& _sharedTransferChunkArray;
+	return _sharedMemoryHeaderPtr
+			&& _memoryManagerPtr && _memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::READY
+			&& _clientIndex != NO_CLIENT_SLOT
+			&& _metricsPtr;
 }
 
 void SharedMemoryClient::TransferFiles(const std::vector<std::string>& filePathsContainer)
 {
-	std::string threadIdString = boost::lexical_cast<std::string>(boost::this_thread::get_id());
+	TransferFiles(filePathsContainer, _transferOptions);
+}
+
+void SharedMemoryClient::TransferFiles(const std::vector<std::string>& filePathsContainer, const TransferOptions& options)
+{
 	if(!IsInited())
 	{
-		TRACE("[%ld] [%s] SharedMemoryClient has not been inited properly\n", getMicrotime(), threadIdString.c_str());
+		TRACE_ERROR("SharedMemoryClient has not been inited properly\n");
 		return;
 	}
 
 	_clientStatus.store(SharedMemoryClientStatus::TRANSFERRING);
 
-	for(const std::string& filePath : filePathsContainer)
+	//	the deadline runs from this call; the workers take the tasks of the higher classes first
+	const TransferTicket ticket(options);
+	const uint32_t taskPriority = static_cast<uint32_t>(ticket._priority);
+
+	//	directories are walked on the workers before anything is sent; the prefetcher lives as long as a transfer refers to it
+	const std::vector<SourceFile> sourceFiles = FileTreeWalker(_transferThreadPool).Walk(filePathsContainer);
+	std::shared_ptr<FilePrefetcher> prefetcher = std::make_shared<FilePrefetcher>(sourceFiles);
+
+	std::vector<SourceFile> batchFiles;
+	uint64_t batchSize = 0;
+	size_t batchFileIndex = 0;
+	for(size_t fileIndex = 0; fileIndex < sourceFiles.size(); ++fileIndex)
 	{
-		if(filePath.length() > MAX_FILE_NAME_LENGTH - 1)
+		const SourceFile& sourceFile = sourceFiles[fileIndex];
+		if(sourceFile._name.length() > MAX_FILE_NAME_LENGTH - 1)
 		{
-			TRACE("[%ld] [%s] File %s has length more than 255 chars and will be ignored\n", getMicrotime(), threadIdString.c_str(), filePath.c_str());
+			TRACE_ERROR("File %s has a name longer than %u chars and will be ignored\n", sourceFile._path.c_str(), MAX_FILE_NAME_LENGTH - 1);
 			continue;
 		}
-		TransferChunk* transferChunkPtr = GetTransferChunk();
 
-		++_countThreads;
-		boost::thread(boost::bind(&SharedMemoryClient::TransferThread, this, transferChunkPtr, filePath));
+		//	a missing file still gets a single range, the transfer thread reports the error
+		const bool isRegularFile = sourceFile._isFound && S_ISREG(sourceFile._stat.st_mode);
+		const uint64_t fileSize = isRegularFile ? static_cast<uint64_t>(sourceFile._stat.st_size) : 0;
+
+		//	small files are packed together and share a single chunk
+		if(isRegularFile && _batchFileSize && fileSize <= _batchFileSize)
+		{
+			batchFiles.push_back(sourceFile);
+			batchSize += fileSize;
+			batchFileIndex = fileIndex;
+			if(batchSize >= MAX_BATCH_SIZE || batchFiles.size() == MAX_BATCH_FILE_COUNT)
+				PostBatch(batchFiles, batchSize, prefetcher, batchFileIndex, ticket);
+			continue;
+		}
+
+		TransferRange range;
+		range._fileId = GetNextFileId();
+		range._fileSize = fileSize;
+		range._rangeCount = GetRangeCount(fileSize);
+		if(isRegularFile && fileSize >= JOURNAL_CHECKPOINT_SIZE)
+			range._sourceKey = GetSourceKey(sourceFile._stat);
+
+		//	ranges are page aligned, so every range but the last one has the same length; with dedup they're
+		//	aligned to the blocks, so the blocks of a file are the same however it's striped
+		const uint64_t rangeAlignment = _dedupIndex._entries ? DEDUP_BLOCK_SIZE : PAYLOAD_ALIGNMENT;
+		uint64_t rangeLength = (fileSize + range._rangeCount - 1) / range._rangeCount;
+		rangeLength = (rangeLength + rangeAlignment - 1) / rangeAlignment * rangeAlignment;
+		if(rangeLength)
+			range._rangeCount = static_cast<uint32_t>((fileSize + rangeLength - 1) / rangeLength);
+		for(uint32_t i = 0; i < range._rangeCount; ++i)
+		{
+			range._offset = rangeLength * i;
+			range._length = std::min(rangeLength, fileSize - range._offset);
+
+			++_countPendingTransfers;
+			_transferThreadPool.Post([this, ticket, sourceFile, range, prefetcher, fileIndex] {
+				prefetcher->Advance(fileIndex);
+				const TransferRange resumedRange = ResumeRange(sourceFile._path, range);
+				TransferThread(GetTransferChunk(ticket), ticket, sourceFile, resumedRange);
+			}, taskPriority);
+		}
 	}
+	PostBatch(batchFiles, batchSize, prefetcher, batchFileIndex, ticket);
 }
 
-TransferChunk* SharedMemoryClient::GetTransferChunk()
+void SharedMemoryClient::PostBatch(std::vector<SourceFile>& batchFiles, uint64_t& batchSize, const std::shared_ptr<FilePrefetcher>& prefetcher, size_t lastFileIndex,
+								   const TransferTicket& ticket)
 {
-	std::string threadIdString = boost::lexical_cast<std::string>(boost::this_thread::get_id());
-	uint32_t timeoutStrikeCounter = 0;
-	TransferChunk* transferChunkPtr = nullptr;
-	while(true)
+	if(batchFiles.empty())
+		return;
+
+	++_countPendingTransfers;
+	std::shared_ptr<std::vector<SourceFile>> sourceFiles = std::make_shared<std::vector<SourceFile>>();
+	sourceFiles->swap(batchFiles);
+	_transferThreadPool.Post([this, ticket, sourceFiles, prefetcher, lastFileIndex] {
+		prefetcher->Advance(lastFileIndex);
+		TransferBatchThread(GetTransferChunk(ticket), ticket, *sourceFiles);
+	}, static_cast<uint32_t>(ticket._priority));
+	batchSize = 0;
+}
+
+uint64_t SharedMemoryClient::GetNextFileId()
+{
+	return (static_cast<uint64_t>(getpid()) << 32) | ++_fileIdCounter;
+}
+
+uint32_t SharedMemoryClient::GetRangeCount(uint64_t fileSize) const
+{
+	//	one range per worker at most, so a single large file keeps every core busy
+	uint64_t rangeCount = (fileSize + _stripeSize - 1) / _stripeSize;
+	rangeCount = std::min<uint64_t>(rangeCount, _transferThreadPool.GetThreadCount());
+	rangeCount = std::min<uint64_t>(rangeCount, (fileSize + PAYLOAD_ALIGNMENT - 1) / PAYLOAD_ALIGNMENT);
+	return static_cast<uint32_t>(std::max<uint64_t>(rangeCount, 1));
+}
+
+void SharedMemoryClient::WaitForCompletion()
+{
+	_transferThreadPool.Wait();
+	_clientStatus.store(SharedMemoryClientStatus::COMPLETED);
+}
+
+std::unique_ptr<OutgoingStream> SharedMemoryClient::OpenStream(const std::string& name, uint64_t sizeHint)
+{
+	return OpenStream(name, sizeHint, _transferOptions);
+}
+
+std::unique_ptr<OutgoingStream> SharedMemoryClient::OpenStream(const std::string& name, uint64_t sizeHint, const TransferOptions& options)
+{
+	if(!IsInited())
+	{
+		TRACE_ERROR("SharedMemoryClient has not been inited properly\n");
+		return nullptr;
+	}
+	if(name.empty() || name.length() > MAX_FILE_NAME_LENGTH - 1)
 	{
-		scoped_lock<interprocess_mutex> lock(_memoryManagerPtr->_memoryManagerMutex);
+		TRACE_ERROR("Stream name has to have 1 to %u chars\n", MAX_FILE_NAME_LENGTH - 1);
+		return nullptr;
+	}
+
+	//	the chunk is taken on the caller's thread, like a worker would
+	const TransferTicket ticket(options);
+	TransferChunk* transferChunkPtr = GetTransferChunk(ticket);
+	if(!transferChunkPtr)
+		return nullptr;
+
+	_clientStatus.store(SharedMemoryClientStatus::TRANSFERRING);
+	++_countPendingTransfers;
+
+	//	the length of a stream is known once it's closed; the range carries only the hint
+	TransferRange range;
+	range._fileId = GetNextFileId();
+	range._fileSize = sizeHint;
+	range._length = sizeHint;
+	strncpy(transferChunkPtr->_metadata->_fileName, name.c_str(), MAX_FILE_NAME_LENGTH - 1);
+	transferChunkPtr->_transferMode = TransferMode::STREAM;
+	transferChunkPtr->_range = range;
+	transferChunkPtr->_transferStatus.store(TransferChunkStatus::STREAMING);
+	std::unique_ptr<OutgoingStream> stream(new OutgoingStream(*this, transferChunkPtr, ticket, _memoryManagerPtr->GetServerHeartbeat(), _metricsPtr,
+															   _compressionCodec, _compressionLevel));
+	RegisterStream(transferChunkPtr);
+	_memoryManagerPtr->SubmitTransferChunk(transferChunkPtr);
+	return stream;
+}
+
+void SharedMemoryClient::RegisterStream(TransferChunk* transferChunk)
+{
+	//	the writer beats only when it takes a frame; the thread keeps a stream alive in between
+	boost::lock_guard<boost::mutex> lock(_streamsMutex);
+	_openStreamChunks.push_back(transferChunk);
+	if(!_streamHeartbeatThread.joinable())
+		_streamHeartbeatThread = boost::thread(&SharedMemoryClient::StreamHeartbeatThread, this);
+}
+
+void SharedMemoryClient::UnregisterStream(TransferChunk* transferChunk)
+{
+	boost::lock_guard<boost::mutex> lock(_streamsMutex);
+	_openStreamChunks.erase(std::remove(_openStreamChunks.begin(), _openStreamChunks.end(), transferChunk), _openStreamChunks.end());
+}
+
+void SharedMemoryClient::StreamHeartbeatThread()
+{
+	boost::unique_lock<boost::mutex> lock(_streamsMutex);
+	while(!_isStopping)
+	{
+		for(TransferChunk* transferChunk : _openStreamChunks)
+			transferChunk->_producerHeartbeat.Beat();
+		_cvStreamsChanged.timed_wait(lock, boost::posix_time::milliseconds(HEARTBEAT_INTERVAL_MILLISECONDS));
+	}
+}
+
+void SharedMemoryClient::CompleteStream(const TransferTicket& ticket, bool isCompleted)
+{
+	if(isCompleted)
+		++_transmittedFileCounter;
+	RecordLatency(ticket);
+	--_countPendingTransfers;
+}
 
-		_memoryManagerPtr->SetMemoryManagerStatus(MemoryManagerStatus::REQ_TO_ALLOC_CHUNK);
-		_memoryManagerPtr->_cvSignalToServer.notify_one();
+void SharedMemoryClient::RecordLatency(const TransferTicket& ticket) const
+{
+	//	from the call that queued the transfer to its last byte, in microseconds
+	const uint64_t nowNanoseconds = getMonotonicNanoseconds();
+	_metricsPtr->_transferLatencyHistograms[static_cast<uint32_t>(ticket._priority)].Record((nowNanoseconds - ticket._queuedNanoseconds) / 1000);
+	if(ticket.IsLate(nowNanoseconds))
+		_metricsPtr->_deadlineMisses.Add(1);
+}
 
-		if(!_memoryManagerPtr->_cvSignalToClient.timed_wait(lock, boost::get_system_time() + boost::posix_time::milliseconds(CONDITIONAL_VARIABLE_TIMEOUT_MILLISECONDS)
-													, [&] {
-														return _memoryManagerPtr->GetMemoryManagerStatus() != MemoryManagerStatus::REQ_TO_ALLOC_CHUNK;
-													}))
+TransferChunk* SharedMemoryClient::GetTransferChunk(const TransferTicket& ticket)
+{
+	TransferChunk* transferChunkPtr = nullptr;
+	bool isWaiting = false;
+	TransferPriority waitingPriority = ticket._priority;
+	uint32_t waitMilliseconds = MIN_CREDIT_WAIT_MILLISECONDS;
+	while(true)
+	{
+		//	a transfer with a deadline competes as urgent once it's half gone
+		const TransferPriority priority = ticket.GetPriority(getMonotonicNanoseconds());
+		if(isWaiting && priority != waitingPriority)
 		{
-			//	timeout handler
-			++timeoutStrikeCounter;
-			TRACE("[%ld] [%s] Waiting timeout. %d strike\n", getMicrotime(), threadIdString.c_str(), timeoutStrikeCounter);
-			if(timeoutStrikeCounter == CONDITIONAL_VARIABLE_STRIKE_LIMIT)
-			{
-				TRACE("[%ld] [%s] Server doesn't respond. Thread will be terminated\n", getMicrotime(), threadIdString.c_str());
-				break;
-			}
-			continue;
+			_memoryManagerPtr->SetClientWaiting(_clientIndex, waitingPriority, false);
+			_memoryManagerPtr->SetClientWaiting(_clientIndex, priority, true);
+			waitingPriority = priority;
 		}
 
-		timeoutStrikeCounter = 0;
-		if(_memoryManagerPtr->GetMemoryManagerStatus()  == MemoryManagerStatus::ALLOC_IS_SUCCESSFUL)
+		transferChunkPtr = _memoryManagerPtr->AcquireTransferChunk(_clientIndex, priority);
+		if(transferChunkPtr)
 		{
-			uint32_t transferChunkIndex = _memoryManagerPtr->GetLastChunkIndex();
-			transferChunkPtr = &_sharedTransferChunkArray[transferChunkIndex];
-
-			TRACE("[%ld] [%s] New chunk address: %p\n", getMicrotime(), threadIdString.c_str(), transferChunkPtr);
+			TRACE_DEBUG("New chunk address: %p\n", transferChunkPtr);
 			break;
 		}
-		else
+
+		//	every chunk, every server worker or the share of this client is busy: wait for a credit while the server
+		//	is alive; a waiting client counts as active, so the server gives it a share of its own. The server wakes
+		//	the waiters when a chunk comes back, the timeout only bounds a re-check: it starts at about the time a
+		//	chunk takes to drain and doubles up to the heartbeat interval
+		if(!isWaiting)
 		{
-			TRACE("[%ld] [%s] New transfer chunk allocation error\n", getMicrotime(), threadIdString.c_str());
+			_memoryManagerPtr->SetClientWaiting(_clientIndex, priority, true);
+			waitingPriority = priority;
+			const uint32_t drainRate = _memoryManagerPtr->GetDrainRate();
+			waitMilliseconds = drainRate ? std::max(MIN_CREDIT_WAIT_MILLISECONDS, 1000 / drainRate) : MIN_CREDIT_WAIT_MILLISECONDS;
+			isWaiting = true;
+		}
+		_metricsPtr->_allocationFailures.Add(1);
+		if(!_memoryManagerPtr->GetServerHeartbeat().IsAlive())
+		{
+			TRACE_ERROR("Server doesn't respond. New transfer chunk allocation error\n");
+			_metricsPtr->_timeoutStrikes.Add(1);
 			break;
 		}
-	}
 
-	_memoryManagerPtr->SetMemoryManagerStatus(MemoryManagerStatus::REQ_TO_ALLOC_IS_COMPLETED);
-	_memoryManagerPtr->_cvSignalToServer.notify_one();
+		const uint64_t waitStartNanoseconds = getMonotonicNanoseconds();
+		if(!_memoryManagerPtr->WaitForChunkCredit(_clientIndex, priority, std::min(waitMilliseconds, HEARTBEAT_INTERVAL_MILLISECONDS)))
+			waitMilliseconds = std::min(waitMilliseconds * 2, HEARTBEAT_INTERVAL_MILLISECONDS);
+		_metricsPtr->_creditWaitNanoseconds.Add(getMonotonicNanoseconds() - waitStartNanoseconds);
+	}
+	if(isWaiting)
+		_memoryManagerPtr->SetClientWaiting(_clientIndex, waitingPriority, false);
 	return transferChunkPtr;
 }
 
-void SharedMemoryClient::TransferThread(TransferChunk* transferChunkPtr, const std::string& filePath)
+TransferRange SharedMemoryClient::ResumeRange(const std::string& filePath, const TransferRange& range) const
+{
+	JournalRecord record;
+	if(!_journalTablePtr || !range._sourceKey || !_journalTablePtr->Find(range._sourceKey, range._fileSize, range._offset, record)
+		|| !record._committedLength || record._committedLength > range._length)
+		return range;
+
+	//	the key only tells the file hasn't been replaced; the bytes the server holds are checked before they're skipped
+	InputFileMapping file(filePath);
+	std::vector<uint8_t> buffer(RESUME_CHECK_BUFFER_SIZE);
+	uint32_t checksum = 0;
+	for(uint64_t checkedBytes = 0; checkedBytes < record._committedLength; )
+	{
+		size_t countBytes = file.Read(buffer.data(), range._offset + checkedBytes, std::min<uint64_t>(buffer.size(), record._committedLength - checkedBytes));
+		if(!countBytes)
+			return range;
+		checksum = Crc32c::Update(checksum, buffer.data(), countBytes);
+		checkedBytes += countBytes;
+	}
+	if(checksum != record._checksum)
+	{
+		TRACE_ERROR("File %s doesn't match the part the server holds, it's sent from the start\n", filePath.c_str());
+		return range;
+	}
+
+	TransferRange resumedRange = range;
+	resumedRange._resumedLength = record._committedLength;
+	TRACE("File %s is resumed at %lu of range %lu+%lu\n", filePath.c_str(), static_cast<unsigned long>(record._committedLength)
+		  , static_cast<unsigned long>(range._offset), static_cast<unsigned long>(range._length));
+	return resumedRange;
+}
+
+void SharedMemoryClient::TransferThread(TransferChunk* transferChunkPtr, const TransferTicket& ticket, const SourceFile& sourceFile, const TransferRange& range)
 {
+	const std::string& filePath = sourceFile._path;
 	if(!transferChunkPtr || filePath.empty())
 	{
-		--_countThreads;
+		--_countPendingTransfers;
 		return;
 	}
 
-	std::string threadIdString = boost::lexical_cast<std::string>(boost::this_thread::get_id());
-	TRACE("[%ld] [%s] SharedMemoryClient::TransferThread has been started\n", getMicrotime(), threadIdString.c_str());
-	TRACE("[%ld] [%s] File %s is transmitting\n", getMicrotime(), threadIdString.c_str(), filePath.c_str());
-	TRACE("[%ld] [%s] TransferChunk address: %p\n", getMicrotime(), threadIdString.c_str(), &*transferChunkPtr);
+	TRACE_DEBUG("SharedMemoryClient::TransferThread has been started\n");
+	TRACE_DEBUG("File %s is transmitting (range %lu+%lu)\n", filePath.c_str()
+		  , static_cast<unsigned long>(range._offset), static_cast<unsigned long>(range._length));
+	TRACE_DEBUG("TransferChunk address: %p\n", &*transferChunkPtr);
 
-	uint32_t timeoutStrikeCounter = 0;
 	try
 	{
-		std::ifstream file(filePath.c_str(), std::ios::in | std::ios::binary);
+		InputFileMapping file(filePath);
 
-		if (file.is_open())
-		{
-			scoped_lock<interprocess_mutex> lock(transferChunkPtr->_transferMutex);
+		strncpy(transferChunkPtr->_metadata->_fileName, sourceFile._name.c_str(), MAX_FILE_NAME_LENGTH - 1);
+		transferChunkPtr->_transferMode = _dedupIndex._entries ? TransferMode::DEDUP_RANGE : TransferMode::SINGLE_FILE;
+		transferChunkPtr->_range = range;
+		transferChunkPtr->_transferStatus.store(TransferChunkStatus::STREAMING);
+		TransferStreamWriter writer(transferChunkPtr, _memoryManagerPtr->GetServerHeartbeat(), _metricsPtr,
+									_compressionCodec, _compressionLevel);
+		_memoryManagerPtr->SubmitTransferChunk(transferChunkPtr);
 
-			strncpy(transferChunkPtr->_fileName, filePath.c_str(), MAX_FILE_NAME_LENGTH - 1);
-
-			while(file)
+		//	the server waits for every range of the file, so a failed range is still reported
+		if (file.IsOpen() && file.GetSize() >= range._offset + range._length)
+		{
+			uint64_t fileOffset = range._offset + range._resumedLength;
+			const uint64_t rangeEnd = range._offset + range._length;
+			if(_dedupIndex._entries)
+				fileOffset = SendBlocks(transferChunkPtr, writer, file, fileOffset, rangeEnd) ? rangeEnd : fileOffset;
+			else
 			{
-				file.read(reinterpret_cast<char*>(&transferChunkPtr->_data[0]), DATA_FRAME_SIZE);
-				transferChunkPtr->_countBytes = static_cast<std::uint32_t>(file.gcount());
-
-				if (!transferChunkPtr->_countBytes)
+				while(fileOffset < rangeEnd)
 				{
-					break;
-				}
-
-				transferChunkPtr->_transferStatus = TransferChunkStatus::REQ_TO_READ;
-				transferChunkPtr->_cvToRead.notify_one();
+					size_t availableBytes = 0;
+					uint8_t* destination = writer.Reserve(availableBytes);
+					if(!destination)
+						break;
 
-				if(!transferChunkPtr->_cvToWrite.timed_wait(lock, boost::get_system_time() + boost::posix_time::milliseconds(CONDITIONAL_VARIABLE_TIMEOUT_MILLISECONDS)
-															, [&] {
-																return transferChunkPtr->_transferStatus == TransferChunkStatus::REQ_TO_WRITE;
-															}))
-				{
-					//	timeout handler
-					++timeoutStrikeCounter;
-					TRACE("[%ld] [%s] Waiting timeout. %d strike\n", getMicrotime(), threadIdString.c_str(), timeoutStrikeCounter);
-					if(timeoutStrikeCounter == CONDITIONAL_VARIABLE_STRIKE_LIMIT)
+					size_t countBytes = file.Read(destination, fileOffset, std::min<uint64_t>(availableBytes, rangeEnd - fileOffset));
+					if (!countBytes)
 					{
-						TRACE("[%ld] [%s] Server doesn't respond. Thread will be terminated\n", getMicrotime(), threadIdString.c_str());
 						break;
 					}
-					continue;
+
+					writer.Commit(countBytes);
+					fileOffset += countBytes;
 				}
-				timeoutStrikeCounter = 0;
 			}
-			transferChunkPtr->_transferStatus = TransferChunkStatus::TRANSFER_IS_FINISHED;
-			file.close();
-			transferChunkPtr->_cvToRead.notify_one();
-			++_transmittedFileCounter;
+			writer.Finish(fileOffset == rangeEnd);
+			if(fileOffset == rangeEnd && range._offset == 0)
+				++_transmittedFileCounter;
 		}
 		else
 		{
-			TRACE("[%ld] [%s] Unable to open file: %s\n", getMicrotime(), threadIdString.c_str(), filePath.c_str());
+			TRACE_ERROR("Unable to open file: %s\n", filePath.c_str());
+			writer.Finish(false);
+		}
+	}
+	catch(interprocess_exception &ex)
+	{
+		TRACE_ERROR("boost IPC exception: %s\n", ex.what());
+	}
+
+	RecordLatency(ticket);
+	--_countPendingTransfers;
+	TRACE_DEBUG("ClientTransferThread has been finished\n");
+}
+
+bool SharedMemoryClient::SendBlocks(TransferChunk* transferChunk, TransferStreamWriter& writer, const InputFileMapping& file, uint64_t fileOffset, uint64_t rangeEnd) const
+{
+	//	a copy, not the mapping itself: the hash and the write would not survive a truncated source
+	std::vector<uint8_t> buffer(DEDUP_BLOCK_SIZE);
+	bool isReferenced = false;
+	for(;;)
+	{
+		//	the range is done once the server has resolved every reference in it
+		if(fileOffset == rangeEnd && isReferenced)
+		{
+			writer.Flush();
+			while(!transferChunk->WaitForBlocks(rangeEnd, HEARTBEAT_INTERVAL_MILLISECONDS))
+			{
+				transferChunk->_producerHeartbeat.Beat();
+				if(!_memoryManagerPtr->GetServerHeartbeat().IsAlive())
+					return false;
+			}
+			if(transferChunk->IsRejected())
+				return false;
+		}
+
+		//	the server has dropped everything since the block it missed: the blocks are sent again from that one
+		const uint64_t missedOffset = transferChunk->TakeMissedBlock();
+		if(missedOffset != NO_MISSED_BLOCK)
+		{
+			DedupRecordHeader resendHeader;
+			resendHeader._type = DedupRecordType::RESEND;
+			if(!writer.Write(&resendHeader, sizeof(resendHeader)))
+				return false;
+			fileOffset = missedOffset;
+			isReferenced = false;
+		}
+		else if(fileOffset == rangeEnd)
+			return true;
+
+		DedupRecordHeader recordHeader;
+		recordHeader._length = static_cast<uint32_t>(std::min<uint64_t>(DEDUP_BLOCK_SIZE, rangeEnd - fileOffset));
+		if(file.Read(buffer.data(), fileOffset, recordHeader._length) != recordHeader._length)
+			return false;
+
+		//	a block the server holds crosses the ring as its header only
+		recordHeader._hash = ContentHash::Compute(buffer.data(), recordHeader._length);
+		recordHeader._type = fileOffset != missedOffset && _dedupIndex.Contains(recordHeader._hash, recordHeader._length)
+								? DedupRecordType::REFERENCE : DedupRecordType::DATA;
+		if(!writer.Write(&recordHeader, sizeof(recordHeader))
+			|| (recordHeader._type == DedupRecordType::DATA && !writer.Write(buffer.data(), recordHeader._length)))
+			return false;
+		isReferenced |= recordHeader._type == DedupRecordType::REFERENCE;
+		fileOffset += recordHeader._length;
+	}
+}
+
+void SharedMemoryClient::TransferBatchThread(TransferChunk* transferChunkPtr, const TransferTicket& ticket, const std::vector<SourceFile>& sourceFiles)
+{
+	if(!transferChunkPtr)
+	{
+		--_countPendingTransfers;
+		return;
+	}
+
+	TRACE_DEBUG("SharedMemoryClient::TransferBatchThread has been started: %lu files\n", static_cast<unsigned long>(sourceFiles.size()));
+
+	try
+	{
+		transferChunkPtr->_metadata->_fileName[0] = '\0';
+		transferChunkPtr->_transferMode = TransferMode::FILE_BATCH;
+		transferChunkPtr->_range = TransferRange();
+		transferChunkPtr->_transferStatus.store(TransferChunkStatus::STREAMING);
+		TransferStreamWriter writer(transferChunkPtr, _memoryManagerPtr->GetServerHeartbeat(), _metricsPtr,
+									_compressionCodec, _compressionLevel);
+		_memoryManagerPtr->SubmitTransferChunk(transferChunkPtr);
+
+		//	records are packed back to back: header, name, content
+		for(const SourceFile& sourceFile : sourceFiles)
+		{
+			InputFileMapping file(sourceFile._path);
+			if(!file.IsOpen())
+			{
+				TRACE_ERROR("Unable to open file: %s\n", sourceFile._path.c_str());
+				continue;
+			}
+
+			BatchRecordHeader recordHeader;
+			recordHeader._fileId = GetNextFileId();
+			recordHeader._fileSize = file.GetSize();
+			recordHeader._nameLength = static_cast<uint32_t>(sourceFile._name.length());
+			if(!writer.Write(&recordHeader, sizeof(recordHeader)) || !writer.Write(sourceFile._name.data(), sourceFile._name.length()))
+				break;
+
+			uint64_t fileOffset = 0;
+			while(fileOffset < recordHeader._fileSize)
+			{
+				size_t availableBytes = 0;
+				uint8_t* destination = writer.Reserve(availableBytes);
+				if(!destination)
+					break;
+
+				size_t countBytes = file.Read(destination, fileOffset, std::min<uint64_t>(availableBytes, recordHeader._fileSize - fileOffset));
+				if(!countBytes)
+					break;
+
+				writer.Commit(countBytes);
+				fileOffset += countBytes;
+			}
+
+			//	a short record would desynchronize the stream: the rest of the batch is dropped
+			if(fileOffset != recordHeader._fileSize)
+				break;
+			++_transmittedFileCounter;
 		}
+		writer.Finish(writer.GetStatus() == TransferStreamStatus::STREAMING);
 	}
 	catch(interprocess_exception &ex)
 	{
-		TRACE("[%ld] [%s] boost IPC exception: %s\n", getMicrotime(), threadIdString.c_str(), ex.what());
+		TRACE_ERROR("boost IPC exception: %s\n", ex.what());
 	}
 
-	--_countThreads;
-	TRACE("[%ld] [%s] ClientTransferThread has been finished\n", getMicrotime(), threadIdString.c_str());
+	RecordLatency(ticket);
+	--_countPendingTransfers;
+	TRACE_DEBUG("ClientTransferBatchThread has been finished\n");
 }
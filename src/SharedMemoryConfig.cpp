@@ -0,0 +1,237 @@
+#include "SharedMemoryConfig.h"
+
+#include <cstdlib>
+#include <fstream>
+
+#include <boost/thread.hpp>
+
+#include "Logger.h"
+#include "SharedMemoryHeader.h"
+
+namespace
+{
+	bool ParseSize(const std::string& value, uint64_t& size)
+	{
+		if(value.empty())
+			return false;
+
+		char* end = nullptr;
+		unsigned long long number = std::strtoull(value.c_str(), &end, 10);
+		if(end == value.c_str())
+			return false;
+
+		switch(*end)
+		{
+			case 'G': case 'g': number *= 1024;	//	fallthrough
+			case 'M': case 'm': number *= 1024;	//	fallthrough
+			case 'K': case 'k': number *= 1024; ++end; break;
+			default: break;
+		}
+
+		if(*end != '\0')
+			return false;
+
+		size = number;
+		return true;
+	}
+}
+
+bool SharedMemoryConfig::ParseArguments(int argc, char* argv[], int firstArgument)
+{
+	for(int i = firstArgument; i < argc; ++i)
+	{
+		if(!ParseOption(argv[i]))
+			return false;
+	}
+	return IsValid();
+}
+
+bool SharedMemoryConfig::ParseOption(const std::string& option)
+{
+	std::string::size_type separator = option.find('=');
+	std::string key = option.substr(0, separator);
+	std::string value = separator == std::string::npos ? std::string() : option.substr(separator + 1);
+	if(key.compare(0, 2, "--") == 0)
+		key.erase(0, 2);
+
+	uint64_t number = 0;
+	bool isParsed = false;
+	if(key == "config")
+		return ParseFile(value);
+	else if(key == "segment-size")
+	{
+		isParsed = ParseSize(value, number);
+		_segmentSize = number;
+	}
+	else if(key == "frame-size")
+	{
+		isParsed = ParseSize(value, number) && number <= UINT32_MAX;
+		_frameSize = static_cast<uint32_t>(number);
+	}
+	else if(key == "slot-count")
+	{
+		isParsed = ParseSize(value, number) && number <= UINT32_MAX;
+		_slotCount = static_cast<uint32_t>(number);
+	}
+	else if(key == "stripe-size")
+	{
+		isParsed = ParseSize(value, number) && number >= PAYLOAD_ALIGNMENT;
+		_stripeSize = number;
+	}
+	else if(key == "batch-file-size")
+	{
+		isParsed = ParseSize(value, number) && number <= MAX_BATCH_SIZE;
+		_batchFileSize = number;
+	}
+	else if(key == "compression")
+	{
+		isParsed = Compression::Parse(value, _compressionCodec, _compressionLevel);
+		if(isParsed && !Compression::IsAvailable(_compressionCodec))
+		{
+			TRACE_ERROR("%s support is not built in\n", Compression::GetName(_compressionCodec));
+			isParsed = false;
+		}
+	}
+	else if(key == "client-weight")
+	{
+		isParsed = ParseSize(value, number) && number >= 1 && number <= MAX_CLIENT_WEIGHT;
+		_clientWeight = static_cast<uint32_t>(number);
+	}
+	else if(key == "client-quota")
+	{
+		isParsed = ParseSize(value, number) && number <= UINT16_MAX;
+		_clientChunkQuota = static_cast<uint32_t>(number);
+	}
+	else if(key == "priority")
+	{
+		isParsed = TransferOptions::ParsePriority(value, _transferOptions._priority);
+	}
+	else if(key == "deadline")
+	{
+		isParsed = ParseSize(value, number) && number <= UINT32_MAX;
+		_transferOptions._deadlineMilliseconds = static_cast<uint32_t>(number);
+	}
+	else if(key == "urgent-reserve")
+	{
+		isParsed = ParseSize(value, number) && number <= UINT16_MAX;
+		_urgentChunkReserve = static_cast<uint32_t>(number);
+	}
+	else if(key == "normal-reserve")
+	{
+		isParsed = ParseSize(value, number) && number <= UINT16_MAX;
+		_normalChunkReserve = static_cast<uint32_t>(number);
+	}
+	else if(key == "write-queue-depth")
+	{
+		isParsed = ParseSize(value, number) && number <= UINT16_MAX;
+		_writeQueueDepth = static_cast<uint32_t>(number);
+	}
+	else if(key == "direct-io")
+	{
+		isParsed = ParseSize(value, number) && number <= 1;
+		_isDirectIo = number != 0;
+	}
+	else if(key == "overwrite")
+	{
+		isParsed = ParseSize(value, number) && number <= 1;
+		_isOverwriting = number != 0;
+	}
+	else if(key == "journal")
+	{
+		isParsed = !value.empty();
+		_journalPath = value;
+	}
+	else if(key == "dedup-store")
+	{
+		isParsed = !value.empty();
+		_dedupStorePath = value;
+	}
+	else if(key == "dedup-store-size")
+	{
+		isParsed = ParseSize(value, number) && number >= DEDUP_BLOCK_SIZE;
+		_dedupStoreSize = number;
+	}
+	else if(key == "dedup")
+	{
+		isParsed = ParseSize(value, number) && number <= 1;
+		_isDedupEnabled = number != 0;
+	}
+	else if(key == "frame-loans")
+	{
+		isParsed = ParseSize(value, number) && number >= 1 && number <= UINT16_MAX;
+		_frameLoanCount = static_cast<uint32_t>(number);
+	}
+	else if(key == "huge-pages")
+	{
+		isParsed = ParseSize(value, number) && number <= 1;
+		_isHugePageBacked = number != 0;
+	}
+	else if(key == "prefault")
+	{
+		isParsed = ParseSize(value, number) && number <= 1;
+		_isPrefaulted = number != 0;
+	}
+	else if(key == "numa-node")
+	{
+		isParsed = ParseSize(value, number) && number <= INT16_MAX;
+		_numaNode = static_cast<int32_t>(number);
+	}
+	else if(key == "stats-interval")
+	{
+		isParsed = ParseSize(value, number) && number > 0 && number <= UINT32_MAX;
+		_statsIntervalMilliseconds = static_cast<uint32_t>(number);
+	}
+	else if(key == "threads")
+	{
+		isParsed = ParseSize(value, number) && number <= UINT16_MAX;
+		_threadCount = static_cast<uint32_t>(number);
+	}
+
+	if(!isParsed)
+		TRACE_ERROR("Unknown or malformed option: %s\n", option.c_str());
+	return isParsed;
+}
+
+bool SharedMemoryConfig::ParseFile(const std::string& filePath)
+{
+	std::ifstream file(filePath.c_str());
+	if(!file.is_open())
+	{
+		TRACE_ERROR("Unable to open config file: %s\n", filePath.c_str());
+		return false;
+	}
+
+	std::string line;
+	while(std::getline(file, line))
+	{
+		line = line.substr(0, line.find('#'));
+		line.erase(0, line.find_first_not_of(" \t"));
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if(!line.empty() && !ParseOption(line))
+			return false;
+	}
+	return true;
+}
+
+bool SharedMemoryConfig::IsValid() const
+{
+	if(_frameSize == 0 || _slotCount == 0 || (_slotCount & (_slotCount - 1)) != 0)
+	{
+		TRACE_ERROR("Frame size must be positive and slot count must be a power of two\n");
+		return false;
+	}
+
+	if(_frameSize > MAX_DATA_FRAME_SIZE)
+	{
+		TRACE_ERROR("Frame size %u is above the limit of %u bytes\n", _frameSize, MAX_DATA_FRAME_SIZE);
+		return false;
+	}
+
+	//	at least a single chunk ring has to fit into the segment
+	if(_segmentSize / _slotCount <= SharedMemoryHeader::GetFrameStride(_frameSize))
+	{
+		TRACE_ERROR("Segment size %lu is too small for %u frames of %u bytes\n", static_cast<unsigned long>(_segmentSize), _slotCount, _frameSize);
+		return false;
+	}
+	return true;
+}
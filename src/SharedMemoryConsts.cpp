@@ -1,5 +1,6 @@
 #include "SharedMemoryConsts.h"
 #include <sys/time.h>						//	TODO: remove
+#include <time.h>
 
 long getMicrotime()
 {
@@ -7,3 +8,10 @@ long getMicrotime()
 	gettimeofday(&currentTime, NULL);
 	return currentTime.tv_sec * (int)1e6 + currentTime.tv_usec;
 }
+
+uint64_t getMonotonicNanoseconds()
+{
+	struct timespec currentTime;
+	clock_gettime(CLOCK_MONOTONIC, &currentTime);
+	return static_cast<uint64_t>(currentTime.tv_sec) * 1000000000 + static_cast<uint64_t>(currentTime.tv_nsec);
+}
@@ -0,0 +1,34 @@
+#include "SharedMemoryHeader.h"
+
+#include "SharedMemoryConfig.h"
+#include "TransferChunk.h"
+
+SharedMemoryHeader::SharedMemoryHeader(const SharedMemoryConfig& config)
+	: _segmentSize(config._segmentSize)
+	, _frameSize(config._frameSize)
+	, _slotCount(config._slotCount)
+	, _numaNode(config._numaNode)
+	, _isHugePageBacked(config._isHugePageBacked)
+{
+}
+
+bool SharedMemoryHeader::IsCompatible() const
+{
+	return _magic == SHARED_MEMORY_MAGIC
+			&& _version == SHARED_MEMORY_LAYOUT_VERSION
+			&& _maxFileNameLength == MAX_FILE_NAME_LENGTH
+			&& _frameSize != 0
+			&& _frameSize <= MAX_DATA_FRAME_SIZE
+			&& _slotCount != 0;
+}
+
+uint64_t SharedMemoryHeader::GetFrameStride() const
+{
+	return GetFrameStride(_frameSize);
+}
+
+uint64_t SharedMemoryHeader::GetFrameStride(uint32_t frameSize)
+{
+	const uint64_t stride = sizeof(TransferFrame) + static_cast<uint64_t>(frameSize);
+	return (stride + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
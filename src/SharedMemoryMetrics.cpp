@@ -0,0 +1,11 @@
+#include "SharedMemoryMetrics.h"
+
+void MetricCounter::Add(uint64_t value)
+{
+	_value.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t MetricCounter::Get() const
+{
+	return _value.load(std::memory_order_relaxed);
+}
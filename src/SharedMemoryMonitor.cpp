@@ -0,0 +1,125 @@
+#include "SharedMemoryMonitor.h"
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "MemoryManager.h"
+#include "SharedMemoryHeader.h"
+#include "SharedMemoryMetrics.h"
+#include "Logger.h"
+
+namespace
+{
+	struct MetricsSnapshot
+	{
+		explicit MetricsSnapshot(const SharedMemoryMetrics& metrics)
+			: _nanoseconds(getMonotonicNanoseconds())
+			, _bytesTransferred(metrics._bytesTransferred.Get())
+			, _framesTransferred(metrics._framesTransferred.Get())
+			, _filesCompleted(metrics._filesCompleted.Get())
+			, _filesFailed(metrics._filesFailed.Get())
+			, _allocationFailures(metrics._allocationFailures.Get())
+			, _creditWaitNanoseconds(metrics._creditWaitNanoseconds.Get())
+			, _timeoutStrikes(metrics._timeoutStrikes.Get())
+			, _checksumFailures(metrics._checksumFailures.Get())
+			, _compressionSavedBytes(metrics._compressionSavedBytes.Get())
+			, _producerWaitNanoseconds(metrics._producerWaitNanoseconds.Get())
+			, _consumerWaitNanoseconds(metrics._consumerWaitNanoseconds.Get())
+			, _diskSinkWaitNanoseconds(metrics._diskSinkWaitNanoseconds.Get())
+			, _dedupBytes(metrics._dedupBytes.Get())
+		{
+		}
+
+		uint64_t _nanoseconds;
+		uint64_t _bytesTransferred;
+		uint64_t _framesTransferred;
+		uint64_t _filesCompleted;
+		uint64_t _filesFailed;
+		uint64_t _allocationFailures;
+		uint64_t _creditWaitNanoseconds;
+		uint64_t _timeoutStrikes;
+		uint64_t _checksumFailures;
+		uint64_t _compressionSavedBytes;
+		uint64_t _producerWaitNanoseconds;
+		uint64_t _consumerWaitNanoseconds;
+		uint64_t _diskSinkWaitNanoseconds;
+		uint64_t _dedupBytes;
+	};
+}
+
+SharedMemoryMonitor::SharedMemoryMonitor(const SharedMemoryConfig& config)
+	: _sharedSegment(open_read_only, SHARED_MEMORY_NAME)
+	, _intervalMilliseconds(config._statsIntervalMilliseconds)
+{
+	_sharedMemoryHeaderPtr = _sharedSegment.find<SharedMemoryHeader>(SHARED_MEMORY_HEADER_NAME).first;
+	if(!_sharedMemoryHeaderPtr || !_sharedMemoryHeaderPtr->IsCompatible())
+	{
+		TRACE_ERROR("Shared memory layout is missing or has an incompatible version\n");
+		_sharedMemoryHeaderPtr = nullptr;
+		return;
+	}
+
+	_memoryManagerPtr = _sharedSegment.find<MemoryManager>(SHARED_MEMORY_MANAGER_NAME).first;
+	_metricsPtr = _sharedSegment.find<SharedMemoryMetrics>(SHARED_MEMORY_METRICS_NAME).first;
+}
+
+bool SharedMemoryMonitor::IsInited() const
+{
+	return _sharedMemoryHeaderPtr && _memoryManagerPtr && _metricsPtr;
+}
+
+void SharedMemoryMonitor::Run()
+{
+	if(!IsInited())
+	{
+		TRACE_ERROR("SharedMemoryMonitor has not been inited properly\n");
+		return;
+	}
+
+	MetricsSnapshot previous(*_metricsPtr);
+	while(_memoryManagerPtr->GetServerHeartbeat().IsAlive())
+	{
+		boost::this_thread::sleep(boost::posix_time::milliseconds(_intervalMilliseconds));
+
+		MetricsSnapshot current(*_metricsPtr);
+		const double seconds = (current._nanoseconds - previous._nanoseconds) / 1e9;
+		TRACE("%.1f MB/s; %.0f frames/s; %.0f files/s; %lu files; %lu failed; %.0f allocation failures/s; %lu timeouts; %lu checksum failures; "
+			  "%.1f MB/s saved by compression; %.1f MB/s deduplicated; wait ms/s credit %.1f producer %.1f consumer %.1f disk %.1f; busy chunks %u/%u; %u chunks/s drained; "
+			  "handoff p50 %lu ns p99 %lu ns\n"
+			, (current._bytesTransferred - previous._bytesTransferred) / (1024.0 * 1024.0) / seconds
+			, (current._framesTransferred - previous._framesTransferred) / seconds
+			, (current._filesCompleted - previous._filesCompleted) / seconds
+			, static_cast<unsigned long>(current._filesCompleted)
+			, static_cast<unsigned long>(current._filesFailed)
+			, (current._allocationFailures - previous._allocationFailures) / seconds
+			, static_cast<unsigned long>(current._timeoutStrikes)
+			, static_cast<unsigned long>(current._checksumFailures)
+			, (current._compressionSavedBytes - previous._compressionSavedBytes) / (1024.0 * 1024.0) / seconds
+			, (current._dedupBytes - previous._dedupBytes) / (1024.0 * 1024.0) / seconds
+			, (current._creditWaitNanoseconds - previous._creditWaitNanoseconds) / 1e6 / seconds
+			, (current._producerWaitNanoseconds - previous._producerWaitNanoseconds) / 1e6 / seconds
+			, (current._consumerWaitNanoseconds - previous._consumerWaitNanoseconds) / 1e6 / seconds
+			, (current._diskSinkWaitNanoseconds - previous._diskSinkWaitNanoseconds) / 1e6 / seconds
+			, _memoryManagerPtr->GetBusyChunkCount(), _sharedMemoryHeaderPtr->_chunkCount, _memoryManagerPtr->GetDrainRate()
+			, static_cast<unsigned long>(_metricsPtr->_handoffLatencyHistogram.GetPercentile(50.0))
+			, static_cast<unsigned long>(_metricsPtr->_handoffLatencyHistogram.GetPercentile(99.0)));
+		const Histogram* latencyHistograms = _metricsPtr->_transferLatencyHistograms;
+		TRACE("    transfer latency ms p50/p99: urgent %.1f/%.1f normal %.1f/%.1f bulk %.1f/%.1f; %lu deadlines missed; frames per wakeup p50 %lu p99 %lu\n"
+			, latencyHistograms[0].GetPercentile(50.0) / 1e3, latencyHistograms[0].GetPercentile(99.0) / 1e3
+			, latencyHistograms[1].GetPercentile(50.0) / 1e3, latencyHistograms[1].GetPercentile(99.0) / 1e3
+			, latencyHistograms[2].GetPercentile(50.0) / 1e3, latencyHistograms[2].GetPercentile(99.0) / 1e3
+			, static_cast<unsigned long>(_metricsPtr->_deadlineMisses.Get())
+			, static_cast<unsigned long>(_metricsPtr->_framesPerWakeupHistogram.GetPercentile(50.0))
+			, static_cast<unsigned long>(_metricsPtr->_framesPerWakeupHistogram.GetPercentile(99.0)));
+		for(uint32_t i = 0; i < MAX_CLIENT_COUNT; ++i)
+		{
+			const ClientSlot& clientSlot = _memoryManagerPtr->GetClientSlot(i);
+			if(clientSlot.IsRegistered())
+				TRACE("    client %u: pid %u; weight %u; busy chunks %u/%u; quota %u; credits %u; waiting threads %u\n", i, clientSlot._processId, clientSlot._weight
+					, clientSlot._busyChunkCount.load(), clientSlot._chunkShare.load(), clientSlot._chunkQuota, _memoryManagerPtr->GetChunkCredits(i)
+					, clientSlot.GetWaitingCount());
+		}
+		previous = current;
+	}
+	TRACE("The server doesn't respond, the monitor is stopping\n");
+}
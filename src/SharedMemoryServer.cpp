@@ -1,16 +1,48 @@
 #include "SharedMemoryServer.h"
 
 #include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-#include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 
 #include "MemoryManager.h"
 #include "TransferChunk.h"
+#include "FileMapping.h"
+#include "TransferStream.h"
+#include "Crc32c.h"
+#include "SharedMemoryHeader.h"
+#include "SharedMemoryMetrics.h"
+#include "MemoryPlacement.h"
 #include "Logger.h"
 
+namespace
+{
+	constexpr unsigned int RENAME_NO_REPLACE = 1;		//	RENAME_NOREPLACE, which glibc doesn't declare before 2.28
+
+	//	fails with EEXIST rather than replace an existing file
+	bool RenameNoReplace(const std::string& oldPath, const std::string& newPath)
+	{
+		if(syscall(SYS_renameat2, AT_FDCWD, oldPath.c_str(), AT_FDCWD, newPath.c_str(), RENAME_NO_REPLACE) == 0)
+			return true;
+		if(errno != EINVAL && errno != ENOSYS)
+			return false;
+
+		//	a file system without the flag: a hard link fails on an existing name just the same
+		if(link(oldPath.c_str(), newPath.c_str()) != 0)
+			return false;
+		unlink(oldPath.c_str());
+		return true;
+	}
+}
+
 SharedMemoryCleaner::SharedMemoryCleaner()
 {
 	shared_memory_object::remove(SHARED_MEMORY_NAME);
@@ -21,22 +53,158 @@ SharedMemoryCleaner::~SharedMemoryCleaner()
 	shared_memory_object::remove(SHARED_MEMORY_NAME);
 }
 
-SharedMemoryServer::SharedMemoryServer()
-	: _sharedSegment(create_only, SHARED_MEMORY_NAME, VIRTUAL_SHARED_MEMORY_SIZE)
+IncomingFile::IncomingFile(const std::string& temporaryName, bool isResumed)
+	: _temporaryName(temporaryName)
+	, _file(temporaryName, isResumed)
+{
+}
+
+RangeWriter::RangeWriter(IncomingFile& incomingFile, const TransferRange& range, DiskSink* sink, TransferJournal* journal)
+	: _file(incomingFile._file)
+	, _range(range)
+	, _journal(journal)
+	, _isJournaled(incomingFile._sourceKey != 0)
+	, _fileWriter(sink, _file, range._offset + std::min(range._resumedLength, range._length), range._length - std::min(range._resumedLength, range._length))
+	, _checkpointOffset(_fileWriter.GetOffset() + JOURNAL_CHECKPOINT_SIZE)
+{
+	_isAccepted = range._resumedLength <= range._length
+					&& (_isJournaled ? _journal->Open(range, _journalIndex, _checksum) : range._resumedLength == 0);
+}
+
+bool RangeWriter::IsAccepted() const
+{
+	return _isAccepted;
+}
+
+bool RangeWriter::IsGood() const
+{
+	return _isAccepted && _file.IsGood();
+}
+
+uint64_t RangeWriter::GetOffset() const
+{
+	return _fileWriter.GetOffset();
+}
+
+void RangeWriter::Write(const uint8_t* source, size_t countBytes)
+{
+	if(!_isJournaled)
+	{
+		_fileWriter.Write(source, countBytes);
+		return;
+	}
+
+	for(size_t writtenBytes = 0; writtenBytes < countBytes; )
+	{
+		const size_t pieceBytes = static_cast<size_t>(std::min<uint64_t>(countBytes - writtenBytes, _checkpointOffset - _fileWriter.GetOffset()));
+		_fileWriter.Write(source + writtenBytes, pieceBytes);
+		_checksum = Crc32c::Update(_checksum, source + writtenBytes, pieceBytes);
+		writtenBytes += pieceBytes;
+		Checkpoint();
+	}
+}
+
+void RangeWriter::Writev(const struct iovec* vectors, uint32_t vectorCount)
+{
+	//	a journaled range is checksummed and checkpointed piece by piece
+	if(!_isJournaled)
+	{
+		_fileWriter.Writev(vectors, vectorCount);
+		return;
+	}
+
+	for(uint32_t i = 0; i < vectorCount; ++i)
+		Write(static_cast<const uint8_t*>(vectors[i].iov_base), vectors[i].iov_len);
+}
+
+void RangeWriter::Copy(int sourceFileDescriptor, size_t countBytes, uint32_t checksum)
+{
+	const uint64_t offset = _fileWriter.GetOffset();
+	_fileWriter.Skip(countBytes);
+	_file.Copy(sourceFileDescriptor, countBytes, offset);
+	if(!_isJournaled)
+		return;
+
+	//	blocks are aligned to the checkpoints, so a copy ends on one rather than crossing it
+	_checksum = Crc32c::Combine(_checksum, checksum, countBytes);
+	Checkpoint();
+}
+
+bool RangeWriter::Finish(bool isStreamFinished)
+{
+	_fileWriter.Finish();
+
+	//	a complete range is recorded as well: when another range of the file fails, the retry skips this one
+	const bool isCompleted = _isAccepted && isStreamFinished && _fileWriter.GetOffset() == _range._offset + _range._length;
+	if(_isJournaled && isCompleted && _file.Sync())
+		_journal->Commit(_journalIndex, _range, _range._length, _checksum);
+	return isCompleted;
+}
+
+void RangeWriter::Checkpoint()
+{
+	for(; _fileWriter.GetOffset() >= _checkpointOffset; _checkpointOffset += JOURNAL_CHECKPOINT_SIZE)
+	{
+		if(_fileWriter.GetOffset() == _checkpointOffset && _fileWriter.Finish() && _file.Sync())
+			_journal->Commit(_journalIndex, _range, _checkpointOffset - _range._offset, _checksum);
+	}
+}
+
+SharedMemoryServer::SharedMemoryServer(const SharedMemoryConfig& config)
+	: _sharedSegment(create_only, SHARED_MEMORY_NAME, config._segmentSize)
+	, _isDirectIo(config._isDirectIo)
+	, _isOverwriting(config._isOverwriting)
+	, _frameLoanCount(config._frameLoanCount)
+	, _transferThreadPool(config._threadCount ? config._threadCount : ThreadPool::GetDefaultThreadCount())
 {
+	//	the placement has to be set before the pages are touched by anything but the segment manager
+	if(config._numaNode != NO_NUMA_NODE)
+	{
+		MemoryPlacement::BindToNode(_sharedSegment.get_address(), _sharedSegment.get_size(), config._numaNode);
+		_transferThreadPool.SetNumaNode(config._numaNode);
+	}
+	if(config._isHugePageBacked)
+		MemoryPlacement::AdviseHugePages(_sharedSegment.get_address(), _sharedSegment.get_size());
+	if(config._isPrefaulted)
+		MemoryPlacement::Prefault(_sharedSegment.get_address(), _sharedSegment.get_size());
+
 	try
 	{
-		_memoryManagerPtr = _sharedSegment.construct<MemoryManager>(SHARED_MEMORY_MANAGER_NAME)(_sharedSegment);
+		_sharedMemoryHeaderPtr = _sharedSegment.construct<SharedMemoryHeader>(SHARED_MEMORY_HEADER_NAME)(config);
+		_metricsPtr = _sharedSegment.construct<SharedMemoryMetrics>(SHARED_MEMORY_METRICS_NAME)();
+		_journal.reset(new TransferJournal(_sharedSegment.construct<JournalTable>(SHARED_MEMORY_JOURNAL_NAME)(), config._journalPath));
+		if(!config._dedupStorePath.empty())
+		{
+			//	the index goes before the chunks: the memory manager takes whatever is left of the segment
+			const uint32_t entryCount = static_cast<uint32_t>(std::max<uint64_t>(config._dedupStoreSize / DEDUP_BLOCK_SIZE, DEDUP_INDEX_PROBE_COUNT));
+			_dedupStore.reset(new DedupStore(_sharedSegment.construct<DedupIndexEntry>(SHARED_MEMORY_DEDUP_INDEX_NAME)[entryCount](), entryCount
+											 , config._dedupStorePath, _transferThreadPool));
+		}
+		_memoryManagerPtr = _sharedSegment.construct<MemoryManager>(SHARED_MEMORY_MANAGER_NAME)(_sharedSegment, *_sharedMemoryHeaderPtr);
+
+		//	every worker may hold a buffer it fills, one more keeps a write in flight
+		if(config._writeQueueDepth)
+			_diskSink.reset(new DiskSink(std::max(config._writeQueueDepth, _transferThreadPool.GetThreadCount() + 1), WRITE_BUFFER_SIZE, _metricsPtr));
 	}
 	catch(...)
 	{
-		TRACE("[%ld] [%s] MemoryManager creating error\n", getMicrotime(), boost::lexical_cast<std::string>(boost::this_thread::get_id()).c_str());
+		TRACE_ERROR("MemoryManager creating error\n");
 		return;
 	}
 
 	if(_memoryManagerPtr &&
 		_memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::READY)
+	{
+		//	every chunk handed out to a client has an idle worker waiting for it
+		_memoryManagerPtr->SetBusyChunkLimit(_transferThreadPool.GetThreadCount());
+		_memoryManagerPtr->SetChunkReserves(config._urgentChunkReserve, config._normalChunkReserve);
 		_serverStatus.store(SharedMemoryServerStatus::INITED);
+	}
+}
+
+SharedMemoryServer::~SharedMemoryServer()
+{
+	Stop();
 }
 
 bool SharedMemoryServer::IsInited() const
@@ -49,14 +217,20 @@ void SharedMemoryServer::Start()
 	if(_serverStatus.load() != SharedMemoryServerStatus::INITED)
 		return;
 
-	boost::thread(boost::bind(&SharedMemoryServer::MemoryManagerThread, this));
 	_serverStatus.store(SharedMemoryServerStatus::RUNNING);
+	_memoryManagerThread = boost::thread(boost::bind(&SharedMemoryServer::MemoryManagerThread, this));
 }
 
 void SharedMemoryServer::Stop()
 {
-	//	stub method
-	_serverStatus.store(SharedMemoryServerStatus::STOPPED);
+	if(_serverStatus.exchange(SharedMemoryServerStatus::STOPPED) == SharedMemoryServerStatus::RUNNING)
+	{
+		_memoryManagerPtr->WakeServer();
+		_memoryManagerThread.join();
+	}
+
+	//	transfers in flight are finished (or timed out) before the segment goes away
+	_transferThreadPool.Join();
 }
 
 SharedMemoryServerStatus SharedMemoryServer::GetServerStatus() const
@@ -64,6 +238,30 @@ SharedMemoryServerStatus SharedMemoryServer::GetServerStatus() const
 	return _serverStatus.load();
 }
 
+uint64_t SharedMemoryServer::GetReceivedFileCount() const
+{
+	return _metricsPtr ? _metricsPtr->_filesCompleted.Get() : 0;
+}
+
+uint64_t SharedMemoryServer::GetFailedFileCount() const
+{
+	return _metricsPtr ? _metricsPtr->_filesFailed.Get() : 0;
+}
+
+const SharedMemoryMetrics* SharedMemoryServer::GetMetrics() const
+{
+	return _metricsPtr;
+}
+
+void SharedMemoryServer::SetStreamConsumer(const std::shared_ptr<StreamConsumer>& streamConsumer)
+{
+	//	the workers read it without a lock: it's set before Start()
+	if(_serverStatus.load() != SharedMemoryServerStatus::RUNNING)
+		_streamConsumer = streamConsumer;
+	else
+		TRACE_ERROR("Stream consumer has to be set before the server starts\n");
+}
+
 void SharedMemoryServer::MemoryManagerThread()
 {
 	if(!IsInited())
@@ -72,60 +270,24 @@ void SharedMemoryServer::MemoryManagerThread()
 		return;
 	}
 
-	std::string threadIdString = boost::lexical_cast<std::string>(boost::this_thread::get_id());
-	TRACE("[%ld] [%s] SharedMemoryServer::MemoryManagerThread has been started\n", getMicrotime(), threadIdString.c_str(), threadIdString.c_str());
+	TRACE_DEBUG("SharedMemoryServer::MemoryManagerThread has been started\n");
+	if(_sharedMemoryHeaderPtr->_numaNode != NO_NUMA_NODE)
+		MemoryPlacement::PinCurrentThreadToNode(_sharedMemoryHeaderPtr->_numaNode);
 
-	uint32_t timeoutStrikeCounter = 0;
-	TransferChunk* transferChunkPtr = nullptr;
-	while(true)
+	while(_serverStatus.load() == SharedMemoryServerStatus::RUNNING)
 	{
-		scoped_lock<interprocess_mutex> lock(_memoryManagerPtr->_memoryManagerMutex);
-		_memoryManagerPtr->_cvSignalToClient.notify_one();
-		_memoryManagerPtr->_cvSignalToServer.timed_wait(lock, boost::get_system_time() + boost::posix_time::milliseconds(CONDITIONAL_VARIABLE_TIMEOUT_MILLISECONDS)
-													, [&] {
-															return _memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::REQ_TO_ALLOC_CHUNK
-															|| _memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::REQ_TO_ALLOC_IS_COMPLETED;
-													});
-
-		if(_memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::REQ_TO_ALLOC_CHUNK)
+		_memoryManagerPtr->GetServerHeartbeat().Beat();
+		_memoryManagerPtr->ScheduleClients();
+		TransferChunk* transferChunkPtr = _memoryManagerPtr->TakeSubmittedTransferChunk();
+		if(!transferChunkPtr)
 		{
-			timeoutStrikeCounter = 0;
-			transferChunkPtr = _memoryManagerPtr->GetNextFreeTransferChunkPointer();
-			if(transferChunkPtr != nullptr)
-			{
-				TRACE("[%ld] [%s] Allocated new chunk address: %p\n", getMicrotime(), threadIdString.c_str(), &*transferChunkPtr);
-				_memoryManagerPtr->SetMemoryManagerStatus(MemoryManagerStatus::ALLOC_IS_SUCCESSFUL);
-				++_countTransferThreads;
-				boost::thread(boost::bind(&SharedMemoryServer::TransferThread, this, transferChunkPtr));
-			}
-			else
-			{
-				_memoryManagerPtr->SetMemoryManagerStatus(MemoryManagerStatus::ALLOCATION_ERROR);
-			}
-		}
-		else if (_memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::ALLOC_IS_SUCCESSFUL
-				 || _memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::ALLOCATION_ERROR)		//	client doesn't process (status doesn't change)
-			{
-				++timeoutStrikeCounter;
-				TRACE("[%ld] [%s] Waiting timeout. %d strike\n", getMicrotime(), threadIdString.c_str(), timeoutStrikeCounter);
-
-				if(timeoutStrikeCounter == CONDITIONAL_VARIABLE_STRIKE_LIMIT)
-				{
-					TRACE("[%ld] [%s] Client doesn't respond. Thread will be terminated\n", getMicrotime(), threadIdString.c_str());
-					if(transferChunkPtr)
-					{
-						transferChunkPtr->_transferStatus = TransferChunkStatus::NOT_INITED;
-						transferChunkPtr->_isChunkBusy = false;
-					}
-					_memoryManagerPtr->SetMemoryManagerStatus(MemoryManagerStatus::READY);
-					timeoutStrikeCounter = 0;
-				}
-			}
-		else if (_memoryManagerPtr->GetMemoryManagerStatus() == MemoryManagerStatus::REQ_TO_ALLOC_IS_COMPLETED)
-		{
-				_memoryManagerPtr->SetMemoryManagerStatus(MemoryManagerStatus::READY);
-				timeoutStrikeCounter = 0;
+			_memoryManagerPtr->WaitForSubmission(HEARTBEAT_INTERVAL_MILLISECONDS);
+			continue;
 		}
+
+		TRACE_DEBUG("Submitted chunk address: %p\n", &*transferChunkPtr);
+		++_countTransferThreads;
+		_transferThreadPool.Post(boost::bind(&SharedMemoryServer::TransferThread, this, transferChunkPtr), static_cast<uint32_t>(transferChunkPtr->_priority));
 	}
 }
 
@@ -137,87 +299,368 @@ void SharedMemoryServer::TransferThread(TransferChunk* transferChunk)
 		return;
 	}
 
-	std::string threadIdString = boost::lexical_cast<std::string>(boost::this_thread::get_id());
-	TRACE("[%ld] [%s] ServerTransferThread has been started\n", getMicrotime(), threadIdString.c_str());
-	TRACE("[%ld] [%s] TransferChunk address: %p\n", getMicrotime(), threadIdString.c_str(), &(*transferChunk));
+	TRACE_DEBUG("ServerTransferThread has been started\n");
+	TRACE_DEBUG("TransferChunk address: %p\n", &(*transferChunk));
 
 	try
 	{
-		std::ofstream file(threadIdString.c_str(), std::ios::binary);
-		scoped_lock<interprocess_mutex> lock(transferChunk->_transferMutex);
+		if(transferChunk->_transferMode == TransferMode::FILE_BATCH)
+			ReceiveBatch(transferChunk);
+		else if(transferChunk->_transferMode == TransferMode::STREAM)
+			ReceiveStream(transferChunk);
+		else
+			ReceiveRange(transferChunk);
+
+		_memoryManagerPtr->ReleaseTransferChunk(transferChunk);
+	}
+	catch(interprocess_exception &ex)
+	{
+		TRACE_ERROR("boost IPC exception: %s\n", ex.what());
+	}
+
+	--_countTransferThreads;
+	TRACE_DEBUG("ServerTransferThread has been finished\n");
+}
 
-		uint32_t timeoutStrikeCounter = 0;
-		while (true)
+void SharedMemoryServer::ReceiveRange(TransferChunk* transferChunk)
+{
+	const TransferRange range = transferChunk->_range;
+	const std::string fileName = transferChunk->_metadata->_fileName;
+	std::shared_ptr<IncomingFile> incomingFile = OpenIncomingFile(range);
+	TransferStreamReader reader(transferChunk, _metricsPtr);
+	bool isCompleted = false;
+	{
+		RangeWriter writer(*incomingFile, range, _diskSink.get(), _journal.get());
+		if(!writer.IsAccepted())
+			TRACE_ERROR("Range %lu+%lu of %s can't be resumed at %lu\n", static_cast<unsigned long>(range._offset)
+						, static_cast<unsigned long>(range._length), fileName.c_str(), static_cast<unsigned long>(range._resumedLength));
+
+		if(transferChunk->_transferMode == TransferMode::DEDUP_RANGE)
+			ReceiveBlocks(transferChunk, reader, writer, range._offset + range._length);
+		else
 		{
-			if(transferChunk->_transferStatus == TransferChunkStatus::REQ_TO_READ)
+			//	every frame published so far goes out with one write and comes back to the client with one tail update
+			struct iovec vectors[MAX_DRAIN_FRAME_COUNT];
+			while(writer.IsGood())
 			{
-				file.write(reinterpret_cast<char*>( transferChunk->_data ), transferChunk->_countBytes);
-				if(!file.good())
+				const uint32_t vectorCount = reader.PeekFrames(vectors, MAX_DRAIN_FRAME_COUNT);
+				if(!vectorCount)
 					break;
+
+				writer.Writev(vectors, vectorCount);
+				reader.ConsumeFrames();
 			}
-			else if (transferChunk->_transferStatus == TransferChunkStatus::TRANSFER_IS_FINISHED)
-			{
-				break;
-			}
+		}
+		reader.Close();
+		isCompleted = writer.Finish(reader.GetStatus() == TransferStreamStatus::FINISHED);
+	}
 
-			transferChunk->_transferStatus = TransferChunkStatus::REQ_TO_WRITE;
-			transferChunk->_cvToWrite.notify_one();
+	incomingFile.reset();
+	CompleteIncomingFile(range, fileName, isCompleted);
+}
+
+void SharedMemoryServer::ReceiveBlocks(TransferChunk* transferChunk, TransferStreamReader& reader, RangeWriter& writer, uint64_t rangeEnd)
+{
+	std::vector<uint8_t> block(DEDUP_BLOCK_SIZE);
+	DedupRecordHeader recordHeader;
+	bool isMissing = false;						//	a reference is reported missed, the records are dropped until the client resends
+	while(writer.IsGood() && reader.Read(&recordHeader, sizeof(recordHeader)))
+	{
+		if(recordHeader._type == DedupRecordType::RESEND)
+		{
+			isMissing = false;
+			continue;
+		}
+		if(!_dedupStore || recordHeader._length == 0 || recordHeader._length > DEDUP_BLOCK_SIZE)
+		{
+			TRACE_ERROR("Malformed dedup record\n");
+			break;
+		}
+		if(isMissing)
+		{
+			if(recordHeader._type == DedupRecordType::DATA && !reader.Read(block.data(), recordHeader._length))
+				break;
+			continue;
+		}
+		if(recordHeader._length > rangeEnd - writer.GetOffset())
+		{
+			TRACE_ERROR("Malformed dedup record\n");
+			break;
+		}
 
-			if(!transferChunk->_cvToRead.timed_wait(lock, boost::get_system_time() + boost::posix_time::milliseconds(CONDITIONAL_VARIABLE_TIMEOUT_MILLISECONDS)
-														, [&] {
-																return transferChunk->_transferStatus == TransferChunkStatus::TRANSFER_IS_FINISHED
-																|| transferChunk->_transferStatus == TransferChunkStatus::REQ_TO_READ;
-														}))
+		if(recordHeader._type == DedupRecordType::REFERENCE)
+		{
+			uint32_t checksum = 0;
+			const int fileDescriptor = _dedupStore->Open(recordHeader._hash, recordHeader._length, checksum);
+			if(fileDescriptor < 0)
 			{
-				//	timeout handler
-				++timeoutStrikeCounter;
-				TRACE("[%ld] [%s] Waiting timeout. %d strike\n", getMicrotime(), threadIdString.c_str(), timeoutStrikeCounter);
-				if(timeoutStrikeCounter == CONDITIONAL_VARIABLE_STRIKE_LIMIT)
-				{
-					TRACE("[%ld] [%s] Client doesn't respond. Thread will be terminated\n", getMicrotime(), threadIdString.c_str());
-					break;
-				}
+				TRACE_ERROR("Block %s is missing from the dedup store, the client sends it again\n", recordHeader._hash.ToString().c_str());
+				isMissing = true;
+				transferChunk->ReportMissedBlock(writer.GetOffset());
 				continue;
 			}
-			timeoutStrikeCounter = 0;
+			writer.Copy(fileDescriptor, recordHeader._length, checksum);
+			close(fileDescriptor);
+			_metricsPtr->_dedupBytes.Add(recordHeader._length);
+			transferChunk->ReportBlocks(writer.GetOffset());
+			continue;
 		}
 
-		if(timeoutStrikeCounter != CONDITIONAL_VARIABLE_STRIKE_LIMIT)
+		//	the block is written on as it comes and gathered for the store
+		uint32_t blockBytes = 0;
+		while(blockBytes < recordHeader._length && writer.IsGood())
 		{
-			if(!file.good())
-			{
-				TRACE("[%ld] [%s] File writing error: %s\n", getMicrotime(), threadIdString.c_str(), threadIdString.c_str());
-				file.close();
-				std::remove(threadIdString.c_str());		//	NOTE: Processing of deleting errors; If it is matter.
-			}
-			else
-			{
-				std::string newFileName = std::to_string(std::time(nullptr))
-											+ "_" + threadIdString + "_" + transferChunk->_fileName;
-
-				if(std::rename(threadIdString.c_str() , newFileName.c_str()) != 0)
-				{
-					TRACE("[%ld] [%s] The file has been saved as: %s\n", getMicrotime(), threadIdString.c_str(), threadIdString.c_str());
-				}
-				else
-				{
-					TRACE("[%ld] [%s] The file has been saved as: %s\n", getMicrotime(), threadIdString.c_str(), newFileName.c_str());
-				}
-			}
+			size_t countBytes = 0;
+			const uint8_t* source = reader.Peek(countBytes);
+			if(!source)
+				break;
+
+			countBytes = std::min<size_t>(countBytes, recordHeader._length - blockBytes);
+			writer.Write(source, countBytes);
+			memcpy(block.data() + blockBytes, source, countBytes);
+			blockBytes += static_cast<uint32_t>(countBytes);
+			reader.Consume(countBytes);
 		}
-		else
+		if(blockBytes != recordHeader._length)
+			break;
+		transferChunk->ReportBlocks(writer.GetOffset());
+
+		//	checked against its hash and written to the store on the pool; the next block gets a buffer of its own
+		block.resize(blockBytes);
+		_dedupStore->Insert(recordHeader._hash, std::move(block));
+		block = std::vector<uint8_t>(DEDUP_BLOCK_SIZE);
+	}
+}
+
+void SharedMemoryServer::ReceiveBatch(TransferChunk* transferChunk)
+{
+	TransferStreamReader reader(transferChunk, _metricsPtr);
+
+	BatchRecordHeader recordHeader;
+	while(reader.Read(&recordHeader, sizeof(recordHeader)))
+	{
+		char fileName[MAX_FILE_NAME_LENGTH] = {0};
+		if(recordHeader._nameLength == 0 || recordHeader._nameLength >= MAX_FILE_NAME_LENGTH
+			|| !reader.Read(fileName, recordHeader._nameLength))
+		{
+			TRACE_ERROR("Malformed batch record\n");
+			break;
+		}
+
+		std::string temporaryName = std::to_string(recordHeader._fileId) + ".part";
+		OutputFile file(temporaryName);
+		file.Preallocate(recordHeader._fileSize);
+		FileSinkWriter fileWriter(_diskSink.get(), file, 0, recordHeader._fileSize);
+		while(fileWriter.GetOffset() < recordHeader._fileSize)
+		{
+			size_t countBytes = 0;
+			const uint8_t* source = reader.Peek(countBytes);
+			if(!source)
+				break;
+
+			countBytes = static_cast<size_t>(std::min<uint64_t>(countBytes, recordHeader._fileSize - fileWriter.GetOffset()));
+			fileWriter.Write(source, countBytes);
+			reader.Consume(countBytes);
+		}
+
+		fileWriter.Finish();
+		file.Close();
+		const uint64_t fileOffset = fileWriter.GetOffset();
+		if(fileOffset != recordHeader._fileSize || !file.IsGood())
 		{
-			std::remove(threadIdString.c_str());
+			TRACE_ERROR("File receiving error: %s\n", temporaryName.c_str());
+			std::remove(temporaryName.c_str());
+			_metricsPtr->_filesFailed.Add(1);
+			if(fileOffset != recordHeader._fileSize)
+				break;
+			continue;
 		}
+		CommitReceivedFile(temporaryName, recordHeader._fileId, fileName);
+	}
+	reader.Close();
+}
 
-		transferChunk->_transferStatus = TransferChunkStatus::NOT_INITED;
-		transferChunk->_isChunkBusy = false;
+void SharedMemoryServer::ReceiveStream(TransferChunk* transferChunk)
+{
+	const TransferRange range = transferChunk->_range;
+	const std::string name = transferChunk->_metadata->_fileName;
+	TransferStreamReader reader(transferChunk, _metricsPtr);
+	if(!_streamConsumer)
+	{
+		SaveStream(reader, range, name);
+		return;
 	}
-	catch(interprocess_exception &ex)
+
+	//	frames are lent to the receiver where they are, nothing touches the disk
+	std::unique_ptr<StreamReceiver> receiver = _streamConsumer->OpenStream(name, range._fileSize);
+	bool isReceiving = receiver != nullptr;
+	while(isReceiving)
 	{
-		TRACE("[%ld] [%s] boost IPC exception: %s\n", getMicrotime(), threadIdString.c_str(), ex.what());
+		size_t countBytes = 0;
+		if(!reader.Peek(countBytes))
+			break;
+
+		isReceiving = receiver->Borrow(reader.Lend(_frameLoanCount));
 	}
+	reader.Close();
 
-	--_countTransferThreads;
-	TRACE("[%ld] [%s] ServerTransferThread [%s] has been finished\n", getMicrotime(), threadIdString.c_str(), threadIdString.c_str());
+	//	the chunk goes back to the pool only once the receiver has returned every frame
+	const bool isCompleted = isReceiving && reader.GetStatus() == TransferStreamStatus::FINISHED;
+	if(receiver)
+		receiver->Finish(isCompleted);
+	reader.WaitForLoans();
+	if(isCompleted)
+		_metricsPtr->_filesCompleted.Add(1);
+	else
+	{
+		TRACE_ERROR("Stream receiving error: %s\n", name.c_str());
+		_metricsPtr->_filesFailed.Add(1);
+	}
+}
+
+void SharedMemoryServer::SaveStream(TransferStreamReader& reader, const TransferRange& range, const std::string& name)
+{
+	//	the hint only picks the write path, the file takes whatever length the stream has
+	const std::string temporaryName = std::to_string(range._fileId) + ".part";
+	OutputFile file(temporaryName);
+	FileSinkWriter fileWriter(_diskSink.get(), file, 0, range._fileSize ? range._fileSize : std::numeric_limits<uint64_t>::max());
+	struct iovec vectors[MAX_DRAIN_FRAME_COUNT];
+	while(file.IsGood())
+	{
+		const uint32_t vectorCount = reader.PeekFrames(vectors, MAX_DRAIN_FRAME_COUNT);
+		if(!vectorCount)
+			break;
+
+		fileWriter.Writev(vectors, vectorCount);
+		reader.ConsumeFrames();
+	}
+	reader.Close();
+
+	fileWriter.Finish();
+	file.Close();
+	if(reader.GetStatus() != TransferStreamStatus::FINISHED || !file.IsGood())
+	{
+		TRACE_ERROR("Stream receiving error: %s\n", temporaryName.c_str());
+		std::remove(temporaryName.c_str());
+		_metricsPtr->_filesFailed.Add(1);
+		return;
+	}
+	CommitReceivedFile(temporaryName, range._fileId, name);
+}
+
+std::shared_ptr<IncomingFile> SharedMemoryServer::OpenIncomingFile(const TransferRange& range)
+{
+	boost::lock_guard<boost::mutex> lock(_incomingFilesMutex);
+	std::shared_ptr<IncomingFile>& incomingFile = _incomingFiles[range._fileId];
+	if(!incomingFile)
+	{
+		//	a journaled file goes into the part file of its source, unless the same source is being received already
+		uint64_t sourceKey = range._sourceKey;
+		for(const auto& otherIncomingFile : _incomingFiles)
+		{
+			if(sourceKey && otherIncomingFile.second && otherIncomingFile.second->_sourceKey == sourceKey)
+				sourceKey = 0;
+		}
+
+		const bool isResumed = sourceKey && _journal->Contains(sourceKey);
+		incomingFile = std::make_shared<IncomingFile>(sourceKey ? TransferJournal::GetPartName(sourceKey) : std::to_string(range._fileId) + ".part"
+													  , isResumed);
+		incomingFile->_sourceKey = sourceKey;
+		incomingFile->_file.Preallocate(range._fileSize);
+		if(_isDirectIo && range._fileSize >= DIRECT_IO_MIN_FILE_SIZE)
+			incomingFile->_file.EnableDirectIo();
+		incomingFile->_remainingRanges = range._rangeCount;
+	}
+	return incomingFile;
+}
+
+void SharedMemoryServer::CompleteIncomingFile(const TransferRange& range, const std::string& fileName, bool isCompleted)
+{
+	std::shared_ptr<IncomingFile> incomingFile;
+	{
+		boost::lock_guard<boost::mutex> lock(_incomingFilesMutex);
+		auto incomingFileIterator = _incomingFiles.find(range._fileId);
+		if(incomingFileIterator == _incomingFiles.end())
+			return;
+
+		incomingFileIterator->second->_isFailed |= !isCompleted;
+		if(--incomingFileIterator->second->_remainingRanges != 0)
+			return;
+
+		incomingFile = incomingFileIterator->second;
+		_incomingFiles.erase(incomingFileIterator);
+	}
+
+	OutputFile& file = incomingFile->_file;
+	const std::string& temporaryName = incomingFile->_temporaryName;
+	file.Close();
+	if(incomingFile->_isFailed || !file.IsGood())
+	{
+		_metricsPtr->_filesFailed.Add(1);
+		if(incomingFile->_sourceKey && file.IsGood())
+		{
+			TRACE_ERROR("File receiving error: %s is kept to be resumed\n", temporaryName.c_str());
+			return;
+		}
+
+		TRACE_ERROR("File receiving error: %s\n", temporaryName.c_str());
+		std::remove(temporaryName.c_str());		//	NOTE: Processing of deleting errors; If it is matter.
+		if(incomingFile->_sourceKey)
+			_journal->Remove(incomingFile->_sourceKey);
+		return;
+	}
+
+	CommitReceivedFile(temporaryName, range._fileId, fileName);
+	if(incomingFile->_sourceKey)
+		_journal->Remove(incomingFile->_sourceKey);
+}
+
+void SharedMemoryServer::CommitReceivedFile(const std::string& temporaryName, uint64_t fileId, const std::string& fileName)
+{
+	//	a file of a tree is put in place under its relative path, a single file gets a unique name;
+	//	an existing file is replaced only with --overwrite
+	std::string newFileName = std::to_string(std::time(nullptr))
+								+ "_" + std::to_string(fileId) + "_" + fileName;
+	bool isRenamed = false;
+	if(fileName.find('/') == std::string::npos || CreateParentDirectories(fileName))
+	{
+		if(fileName.find('/') != std::string::npos)
+			newFileName = fileName;
+		isRenamed = _isOverwriting ? std::rename(temporaryName.c_str(), newFileName.c_str()) == 0
+									: RenameNoReplace(temporaryName, newFileName);
+		if(!isRenamed)
+			TRACE_ERROR("Unable to save the file as %s: %s\n", newFileName.c_str(), strerror(errno));
+	}
+
+	if(!isRenamed)
+	{
+		std::remove(temporaryName.c_str());
+		_metricsPtr->_filesFailed.Add(1);
+		return;
+	}
+	_metricsPtr->_filesCompleted.Add(1);
+	TRACE("The file has been saved as: %s\n", newFileName.c_str());
+}
+
+bool SharedMemoryServer::CreateParentDirectories(const std::string& relativePath)
+{
+	//	the name comes from a client: it must stay below the current directory
+	if(relativePath.empty() || relativePath[0] == '/')
+		return false;
+	for(std::string::size_type begin = 0, end = 0; end != std::string::npos; begin = end + 1)
+	{
+		end = relativePath.find('/', begin);
+		const std::string component = relativePath.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+		if(component.empty() || component == "." || component == "..")
+		{
+			TRACE_ERROR("File name %s isn't a relative path\n", relativePath.c_str());
+			return false;
+		}
+		if(end != std::string::npos && mkdir(relativePath.substr(0, end).c_str(), 0755) != 0 && errno != EEXIST)
+		{
+			TRACE_ERROR("Unable to create directory %s\n", relativePath.substr(0, end).c_str());
+			return false;
+		}
+	}
+	return true;
 }
@@ -0,0 +1,73 @@
+#include "SubmissionQueue.h"
+
+#include <new>
+
+uint32_t SubmissionQueue::GetCapacity(uint32_t minimalCapacity)
+{
+	uint32_t capacity = 1;
+	while(capacity < minimalCapacity)
+		capacity <<= 1;
+	return capacity;
+}
+
+void SubmissionQueue::Attach(Cell* cells, uint32_t capacity)
+{
+	_cells = cells;
+	_capacity = capacity;
+	for(uint32_t i = 0; i < _capacity; ++i)
+	{
+		new (&cells[i]._sequence) std::atomic<uint32_t>(i);
+		cells[i]._chunkIndex = 0;
+	}
+}
+
+bool SubmissionQueue::Push(uint32_t chunkIndex)
+{
+	uint32_t position = _enqueuePosition.load(std::memory_order_relaxed);
+	while(true)
+	{
+		Cell& cell = _cells[position & (_capacity - 1)];
+		int32_t difference = static_cast<int32_t>(cell._sequence.load(std::memory_order_acquire) - position);
+		if(difference == 0)
+		{
+			if(_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				cell._chunkIndex = chunkIndex;
+				cell._sequence.store(position + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if(difference < 0)
+			return false;
+		else
+			position = _enqueuePosition.load(std::memory_order_relaxed);
+	}
+}
+
+bool SubmissionQueue::Pop(uint32_t& chunkIndex)
+{
+	uint32_t position = _dequeuePosition.load(std::memory_order_relaxed);
+	while(true)
+	{
+		Cell& cell = _cells[position & (_capacity - 1)];
+		int32_t difference = static_cast<int32_t>(cell._sequence.load(std::memory_order_acquire) - (position + 1));
+		if(difference == 0)
+		{
+			if(_dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				chunkIndex = cell._chunkIndex;
+				cell._sequence.store(position + _capacity, std::memory_order_release);
+				return true;
+			}
+		}
+		else if(difference < 0)
+			return false;
+		else
+			position = _dequeuePosition.load(std::memory_order_relaxed);
+	}
+}
+
+bool SubmissionQueue::IsEmpty() const
+{
+	return _dequeuePosition.load() == _enqueuePosition.load();
+}
@@ -0,0 +1,112 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+#include "MemoryPlacement.h"
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+	: _threadCount(std::max<uint32_t>(threadCount, 1))
+	, _numaNode(NO_NUMA_NODE)
+{
+	for(uint32_t i = 0; i < _threadCount; ++i)
+		_workers.create_thread(boost::bind(&ThreadPool::WorkerThread, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	Join();
+}
+
+uint32_t ThreadPool::GetDefaultThreadCount()
+{
+	return std::max<uint32_t>(boost::thread::hardware_concurrency(), 1);
+}
+
+uint32_t ThreadPool::GetThreadCount() const
+{
+	return _threadCount;
+}
+
+void ThreadPool::SetNumaNode(int32_t numaNode)
+{
+	_numaNode.store(numaNode);
+}
+
+bool ThreadPool::Post(std::function<void()> task, uint32_t priority)
+{
+	{
+		boost::lock_guard<boost::mutex> lock(_queueMutex);
+		if(_isStopping)
+			return false;
+		_taskQueues[std::min(priority, TASK_PRIORITY_COUNT - 1)].push_back(std::move(task));
+	}
+	_cvTaskIsPosted.notify_one();
+	return true;
+}
+
+void ThreadPool::Wait()
+{
+	boost::unique_lock<boost::mutex> lock(_queueMutex);
+	_cvQueueIsDrained.wait(lock, [&] {
+		return IsQueueEmpty() && _countActiveTasks == 0;
+	});
+}
+
+void ThreadPool::Join()
+{
+	{
+		boost::lock_guard<boost::mutex> lock(_queueMutex);
+		_isStopping = true;
+	}
+	_cvTaskIsPosted.notify_all();
+	_workers.join_all();
+}
+
+void ThreadPool::WorkerThread()
+{
+	int32_t pinnedNumaNode = NO_NUMA_NODE;
+	while(true)
+	{
+		std::function<void()> task;
+		{
+			boost::unique_lock<boost::mutex> lock(_queueMutex);
+			_cvTaskIsPosted.wait(lock, [&] {
+				return _isStopping || !IsQueueEmpty();
+			});
+
+			//	the queue is drained before the worker leaves
+			if(IsQueueEmpty())
+				return;
+
+			auto queue = std::find_if(std::begin(_taskQueues), std::end(_taskQueues), [](const std::deque<std::function<void()>>& tasks) {
+				return !tasks.empty();
+			});
+			task = std::move(queue->front());
+			queue->pop_front();
+			++_countActiveTasks;
+		}
+
+		const int32_t numaNode = _numaNode.load(std::memory_order_relaxed);
+		if(numaNode != pinnedNumaNode && numaNode != NO_NUMA_NODE)
+		{
+			MemoryPlacement::PinCurrentThreadToNode(numaNode);
+			pinnedNumaNode = numaNode;
+		}
+
+		task();
+
+		{
+			boost::lock_guard<boost::mutex> lock(_queueMutex);
+			--_countActiveTasks;
+			if(IsQueueEmpty() && _countActiveTasks == 0)
+				_cvQueueIsDrained.notify_all();
+		}
+	}
+}
+
+bool ThreadPool::IsQueueEmpty() const
+{
+	return std::all_of(std::begin(_taskQueues), std::end(_taskQueues), [](const std::deque<std::function<void()>>& tasks) {
+		return tasks.empty();
+	});
+}
@@ -1,3 +1,165 @@
 #include "TransferChunk.h"
 
+#include <new>
+
 TransferChunk::TransferChunk() {}
+
+void TransferChunk::AttachRing(uint8_t* ringPayload, uint32_t frameSize, uint32_t frameStride, uint32_t slotCount)
+{
+	_ringPayload = ringPayload;
+	_frameSize = frameSize;
+	_frameStride = frameStride;
+	_slotCount = slotCount;
+	for(uint32_t i = 0; i < _slotCount; ++i)
+		new (GetFrame(i)) TransferFrame();
+}
+
+uint32_t TransferChunk::GetFrameSize() const
+{
+	return _frameSize;
+}
+
+TransferFrame* TransferChunk::GetFrame(uint32_t index) const
+{
+	return reinterpret_cast<TransferFrame*>(_ringPayload.get() + static_cast<size_t>(index & (_slotCount - 1)) * _frameStride);
+}
+
+TransferFrame* TransferChunk::GetWriteFrame()
+{
+	uint32_t head = _ringHead.load(std::memory_order_relaxed);
+	if(head - _cachedRingTail == _slotCount)
+	{
+		_cachedRingTail = _ringTail.load(std::memory_order_acquire);
+		if(head - _cachedRingTail == _slotCount)
+			return nullptr;
+	}
+
+	return GetFrame(head);
+}
+
+void TransferChunk::PublishWriteFrame()
+{
+	//	a spinning reader picks the frame up from here, a sleeping one waits for NotifyReader()
+	_ringHead.store(_ringHead.load(std::memory_order_relaxed) + 1);
+}
+
+bool TransferChunk::IsReaderWaiting() const
+{
+	//	pairs with the waiter registration in FutexEvent::Wait: a reader that registers after the head
+	//	moved sees the frame before it sleeps
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return _readEvent._countWaiters.load(std::memory_order_relaxed) != 0;
+}
+
+void TransferChunk::NotifyReader()
+{
+	_readEvent.Notify();
+}
+
+bool TransferChunk::WaitForWriteFrame(uint32_t timeoutMilliseconds)
+{
+	return _writeEvent.Wait([&] {
+								return _ringHead.load() - _ringTail.load() != _slotCount;
+							}, timeoutMilliseconds);
+}
+
+void TransferChunk::FinishTransfer(bool isCompleted)
+{
+	_transferStatus.store(isCompleted ? TransferChunkStatus::TRANSFER_IS_FINISHED : TransferChunkStatus::TRANSFER_IS_ABORTED);
+	_readEvent.Notify();
+}
+
+uint64_t TransferChunk::TakeMissedBlock()
+{
+	//	checked before every block, so the common case doesn't write the line
+	return _missedBlockOffset.load(std::memory_order_relaxed) == NO_MISSED_BLOCK ? NO_MISSED_BLOCK : _missedBlockOffset.exchange(NO_MISSED_BLOCK);
+}
+
+bool TransferChunk::WaitForBlocks(uint64_t blocksEnd, uint32_t timeoutMilliseconds)
+{
+	return _writeEvent.Wait([&] {
+								return _blocksEnd.load() >= blocksEnd || _missedBlockOffset.load() != NO_MISSED_BLOCK || _isRejected.load();
+							}, timeoutMilliseconds);
+}
+
+const TransferFrame* TransferChunk::GetReadFrame(uint32_t framesAhead)
+{
+	if(_cachedRingHead - _ringReadIndex <= framesAhead)
+	{
+		_cachedRingHead = _ringHead.load(std::memory_order_acquire);
+		if(_cachedRingHead - _ringReadIndex <= framesAhead)
+			return nullptr;
+	}
+
+	return GetFrame(_ringReadIndex + framesAhead);
+}
+
+void TransferChunk::ReleaseReadFrames(uint32_t countFrames)
+{
+	//	nothing is lent: the frames read are the ones at the tail
+	_ringReadIndex += countFrames;
+	_ringTail.store(_ringReadIndex);
+	_writeEvent.Notify();
+}
+
+void TransferChunk::TakeReadFrame()
+{
+	++_ringReadIndex;
+}
+
+void TransferChunk::ReleaseTakenFrames(uint32_t countFrames)
+{
+	_ringTail.store(_ringTail.load(std::memory_order_relaxed) + countFrames);
+	_writeEvent.Notify();
+}
+
+bool TransferChunk::WaitForReadFrame(uint32_t timeoutMilliseconds)
+{
+	return _readEvent.Wait([&] {
+								return _ringHead.load() != _ringReadIndex
+									|| _transferStatus.load() == TransferChunkStatus::TRANSFER_IS_FINISHED
+									|| _transferStatus.load() == TransferChunkStatus::TRANSFER_IS_ABORTED;
+							}, timeoutMilliseconds);
+}
+
+TransferChunkStatus TransferChunk::GetTransferStatus() const
+{
+	return _transferStatus.load();
+}
+
+void TransferChunk::ReportBlocks(uint64_t blocksEnd)
+{
+	_blocksEnd.store(blocksEnd);
+	_writeEvent.Notify();
+}
+
+void TransferChunk::ReportMissedBlock(uint64_t blockOffset)
+{
+	_missedBlockOffset.store(blockOffset);
+	_writeEvent.Notify();
+}
+
+void TransferChunk::Reject()
+{
+	_isRejected.store(true);
+	_writeEvent.Notify();
+}
+
+bool TransferChunk::IsRejected() const
+{
+	return _isRejected.load();
+}
+
+void TransferChunk::Reset()
+{
+	_isRejected.store(false);
+	_holderIndex.store(NO_CLIENT_SLOT);
+	_blocksEnd.store(0);
+	_missedBlockOffset.store(NO_MISSED_BLOCK);
+	_transferStatus.store(TransferChunkStatus::NOT_INITED);
+	_ringHead.store(0);
+	_ringTail.store(0);
+	_ringReadIndex = 0;
+	_cachedRingTail = 0;
+	_cachedRingHead = 0;
+}
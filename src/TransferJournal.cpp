@@ -0,0 +1,250 @@
+#include "TransferJournal.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iterator>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TransferChunk.h"
+#include "Logger.h"
+
+namespace
+{
+	constexpr uint32_t JOURNAL_MAGIC = 0x4C4A4D53;					//	"SMJL"
+	constexpr uint32_t JOURNAL_VERSION = 1;
+
+	struct JournalFileHeader
+	{
+		uint32_t _magic = JOURNAL_MAGIC;
+		uint32_t _version = JOURNAL_VERSION;
+		uint32_t _recordCount = JOURNAL_ENTRY_COUNT;
+		uint32_t _recordSize = sizeof(JournalRecord);
+	};
+
+	off_t GetRecordPosition(uint32_t entryIndex)
+	{
+		return static_cast<off_t>(sizeof(JournalFileHeader) + static_cast<size_t>(entryIndex) * sizeof(JournalRecord));
+	}
+}
+
+bool JournalTable::Find(uint64_t sourceKey, uint64_t fileSize, uint64_t rangeOffset, JournalRecord& record) const
+{
+	for(const Entry& entry : _entries)
+	{
+		uint32_t sequence = 0;
+		JournalRecord entryRecord;
+		do
+		{
+			sequence = entry._sequence.load(std::memory_order_acquire);
+			entryRecord = entry._record;
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+		while((sequence & 1) || sequence != entry._sequence.load(std::memory_order_relaxed));
+
+		if(entryRecord._sourceKey == sourceKey && entryRecord._fileSize == fileSize && entryRecord._rangeOffset == rangeOffset)
+		{
+			record = entryRecord;
+			return true;
+		}
+	}
+	return false;
+}
+
+TransferJournal::TransferJournal(JournalTable* table, const std::string& filePath)
+	: _table(table)
+	, _filePath(filePath)
+{
+	//	no journal, nothing to resume: it's created by the first resumable range
+	_fileDescriptor = open(filePath.c_str(), O_RDWR | O_CLOEXEC);
+	if(_fileDescriptor < 0)
+		return;
+
+	//	a journal of another layout is dropped, the part files it refers to are overwritten by the next transfers
+	JournalFileHeader header;
+	const JournalFileHeader expectedHeader;
+	if(pread(_fileDescriptor, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))
+		|| header._magic != expectedHeader._magic || header._version != expectedHeader._version
+		|| header._recordCount != expectedHeader._recordCount || header._recordSize != expectedHeader._recordSize)
+	{
+		RemoveFile();
+		return;
+	}
+
+	uint32_t resumableCount = 0;
+	std::vector<uint32_t> staleIndices;
+	for(uint32_t i = 0; i < JOURNAL_ENTRY_COUNT; ++i)
+	{
+		JournalRecord record;
+		if(pread(_fileDescriptor, &record, sizeof(record), GetRecordPosition(i)) != static_cast<ssize_t>(sizeof(record)) || !record._sourceKey)
+			continue;
+
+		//	progress is only worth something while the part file is there
+		struct stat partStat;
+		if(stat(GetPartName(record._sourceKey).c_str(), &partStat) != 0 || static_cast<uint64_t>(partStat.st_size) < record._rangeOffset + record._committedLength)
+		{
+			staleIndices.push_back(i);
+			continue;
+		}
+		_table->_entries[i]._record = record;
+		++resumableCount;
+	}
+	TRACE("Transfer journal %s: %u resumable ranges\n", filePath.c_str(), resumableCount);
+
+	//	only once every record is loaded, clearing the last one removes the file
+	for(uint32_t staleIndex : staleIndices)
+		Store(staleIndex, JournalRecord());
+	if(!resumableCount)
+		RemoveFile();
+}
+
+TransferJournal::~TransferJournal()
+{
+	if(_fileDescriptor >= 0)
+		close(_fileDescriptor);
+}
+
+std::string TransferJournal::GetPartName(uint64_t sourceKey)
+{
+	return std::to_string(sourceKey) + ".part";
+}
+
+bool TransferJournal::Contains(uint64_t sourceKey)
+{
+	boost::lock_guard<boost::mutex> lock(_mutex);
+	for(const JournalTable::Entry& entry : _table->_entries)
+	{
+		if(entry._record._sourceKey == sourceKey)
+			return true;
+	}
+	return false;
+}
+
+bool TransferJournal::Open(const TransferRange& range, uint32_t& entryIndex, uint32_t& checksum)
+{
+	boost::lock_guard<boost::mutex> lock(_mutex);
+	uint32_t oldestIndex = 0;
+	for(uint32_t i = 0; i < JOURNAL_ENTRY_COUNT; ++i)
+	{
+		const JournalRecord& record = _table->_entries[i]._record;
+		if(record._sourceKey == range._sourceKey && record._fileSize == range._fileSize && record._rangeOffset == range._offset)
+		{
+			//	the client resumes from what it has looked up, anything else means the record has moved on since
+			if(range._resumedLength && record._committedLength != range._resumedLength)
+				return false;
+
+			entryIndex = i;
+			checksum = range._resumedLength ? record._checksum : 0;
+			if(!range._resumedLength && record._committedLength)
+			{
+				JournalRecord restartedRecord = record;
+				restartedRecord._committedLength = 0;
+				restartedRecord._checksum = 0;
+				Store(i, restartedRecord);
+			}
+			return true;
+		}
+		if(record._updateSeconds < _table->_entries[oldestIndex]._record._updateSeconds)
+			oldestIndex = i;
+	}
+	if(range._resumedLength)
+		return false;
+
+	const JournalRecord& oldestRecord = _table->_entries[oldestIndex]._record;
+	if(oldestRecord._sourceKey)
+		TRACE_ERROR("Transfer journal is full, progress of %s is dropped\n", GetPartName(oldestRecord._sourceKey).c_str());
+
+	JournalRecord record;
+	record._sourceKey = range._sourceKey;
+	record._fileSize = range._fileSize;
+	record._rangeOffset = range._offset;
+	record._updateSeconds = static_cast<uint64_t>(std::time(nullptr));
+	Store(oldestIndex, record);
+	entryIndex = oldestIndex;
+	checksum = 0;
+	return true;
+}
+
+void TransferJournal::Commit(uint32_t entryIndex, const TransferRange& range, uint64_t committedLength, uint32_t checksum)
+{
+	boost::lock_guard<boost::mutex> lock(_mutex);
+	JournalRecord record = _table->_entries[entryIndex]._record;
+	if(record._sourceKey != range._sourceKey || record._rangeOffset != range._offset)
+		return;
+
+	record._committedLength = committedLength;
+	record._checksum = checksum;
+	record._updateSeconds = static_cast<uint64_t>(std::time(nullptr));
+	Store(entryIndex, record);
+}
+
+void TransferJournal::Remove(uint64_t sourceKey)
+{
+	boost::lock_guard<boost::mutex> lock(_mutex);
+	for(uint32_t i = 0; i < JOURNAL_ENTRY_COUNT; ++i)
+	{
+		if(_table->_entries[i]._record._sourceKey == sourceKey)
+			Store(i, JournalRecord());
+	}
+}
+
+void TransferJournal::Store(uint32_t entryIndex, const JournalRecord& record)
+{
+	JournalTable::Entry& entry = _table->_entries[entryIndex];
+	const uint32_t sequence = entry._sequence.load(std::memory_order_relaxed);
+	entry._sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	entry._record = record;
+	entry._sequence.store(sequence + 2, std::memory_order_release);
+
+	if(record._sourceKey && _fileDescriptor < 0 && !CreateFile())
+		return;
+	if(_fileDescriptor < 0)
+		return;
+
+	//	the record isn't synced: a lost update only makes a restarted transfer resume from an earlier checkpoint
+	if(pwrite(_fileDescriptor, &record, sizeof(record), GetRecordPosition(entryIndex)) != static_cast<ssize_t>(sizeof(record)))
+		TRACE_ERROR("Transfer journal write error\n");
+
+	if(!record._sourceKey && std::none_of(std::begin(_table->_entries), std::end(_table->_entries), [](const JournalTable::Entry& tableEntry) {
+		return tableEntry._record._sourceKey != 0;
+	}))
+		RemoveFile();
+}
+
+bool TransferJournal::CreateFile()
+{
+	const JournalFileHeader header;
+	_fileDescriptor = open(_filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(_fileDescriptor < 0
+		|| ftruncate(_fileDescriptor, GetRecordPosition(JOURNAL_ENTRY_COUNT)) != 0
+		|| pwrite(_fileDescriptor, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+	{
+		TRACE_ERROR("Unable to create the transfer journal %s, transfers won't be resumable after a restart\n", _filePath.c_str());
+		RemoveFile();
+		return false;
+	}
+
+	//	records kept in the segment only while the file couldn't be created
+	for(uint32_t i = 0; i < JOURNAL_ENTRY_COUNT; ++i)
+	{
+		const JournalRecord& record = _table->_entries[i]._record;
+		if(record._sourceKey && pwrite(_fileDescriptor, &record, sizeof(record), GetRecordPosition(i)) != static_cast<ssize_t>(sizeof(record)))
+			TRACE_ERROR("Transfer journal write error\n");
+	}
+	return true;
+}
+
+void TransferJournal::RemoveFile()
+{
+	if(_fileDescriptor < 0)
+		return;
+
+	close(_fileDescriptor);
+	_fileDescriptor = -1;
+	if(unlink(_filePath.c_str()) != 0)
+		TRACE_ERROR("Unable to remove the transfer journal %s\n", _filePath.c_str());
+}
@@ -0,0 +1,46 @@
+#include "TransferOptions.h"
+
+#include "SharedMemoryConsts.h"
+
+bool TransferOptions::ParsePriority(const std::string& value, TransferPriority& priority)
+{
+	if(value == "urgent")
+		priority = TransferPriority::URGENT;
+	else if(value == "normal")
+		priority = TransferPriority::NORMAL;
+	else if(value == "bulk")
+		priority = TransferPriority::BULK;
+	else
+		return false;
+	return true;
+}
+
+const char* TransferOptions::GetPriorityName(TransferPriority priority)
+{
+	switch(priority)
+	{
+		case TransferPriority::URGENT: return "urgent";
+		case TransferPriority::NORMAL: return "normal";
+		case TransferPriority::BULK: return "bulk";
+	}
+	return "unknown";
+}
+
+TransferTicket::TransferTicket(const TransferOptions& options)
+	: _priority(options._priority)
+	, _queuedNanoseconds(getMonotonicNanoseconds())
+	, _deadlineNanoseconds(options._deadlineMilliseconds ? _queuedNanoseconds + uint64_t(options._deadlineMilliseconds) * 1000000 : 0)
+{
+}
+
+TransferPriority TransferTicket::GetPriority(uint64_t nowNanoseconds) const
+{
+	if(_deadlineNanoseconds && nowNanoseconds - _queuedNanoseconds >= (_deadlineNanoseconds - _queuedNanoseconds) / 2)
+		return TransferPriority::URGENT;
+	return _priority;
+}
+
+bool TransferTicket::IsLate(uint64_t nowNanoseconds) const
+{
+	return _deadlineNanoseconds && nowNanoseconds > _deadlineNanoseconds;
+}
@@ -0,0 +1,599 @@
+#include "TransferStream.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include <boost/thread.hpp>
+
+#include "TransferChunk.h"
+#include "SharedMemoryMetrics.h"
+#include "Crc32c.h"
+#include "SharedMemoryConsts.h"
+#include "Logger.h"
+
+namespace
+{
+	constexpr uint32_t COMPRESSION_MIN_GAIN_DIVISOR = 8;
+}
+
+TransferStreamWriter::TransferStreamWriter(TransferChunk* transferChunk, const Heartbeat& serverHeartbeat, SharedMemoryMetrics* metrics,
+											CompressionCodec codec, int32_t compressionLevel)
+	: _transferChunk(transferChunk)
+	, _serverHeartbeat(serverHeartbeat)
+	, _metrics(metrics)
+	, _codec(codec)
+	, _compressionLevel(compressionLevel)
+{
+	_transferChunk->_producerHeartbeat.Beat();
+}
+
+bool TransferStreamWriter::AcquireFrame()
+{
+	while(!_frame && _status == TransferStreamStatus::STREAMING)
+	{
+		_transferChunk->_producerHeartbeat.Beat();
+		_frame = _transferChunk->GetWriteFrame();
+		if(_frame)
+		{
+			_frame->_countBytes = 0;
+			break;
+		}
+
+		if(_transferChunk->IsRejected())
+		{
+			_status = TransferStreamStatus::ABORTED;
+			break;
+		}
+
+		//	the ring is full: the reader is woken and the client sleeps until it drains a frame
+		WakeReader();
+		const uint64_t waitStartNanoseconds = getMonotonicNanoseconds();
+		bool isWaited = _transferChunk->WaitForWriteFrame(HEARTBEAT_INTERVAL_MILLISECONDS);
+		if(_metrics)
+			_metrics->_producerWaitNanoseconds.Add(getMonotonicNanoseconds() - waitStartNanoseconds);
+		if(!isWaited && !_serverHeartbeat.IsAlive())
+		{
+			TRACE_ERROR("Server doesn't respond. Thread will be terminated\n");
+			_status = TransferStreamStatus::TIMED_OUT;
+			if(_metrics)
+				_metrics->_timeoutStrikes.Add(1);
+		}
+	}
+	return _frame != nullptr;
+}
+
+uint8_t* TransferStreamWriter::Reserve(size_t& countBytes)
+{
+	if(!_frame && !_isStaged && _status == TransferStreamStatus::STREAMING)
+	{
+		//	a new frame is staged for the codec unless the stream is backing off after a miss
+		if(_codec != CompressionCodec::NONE && _rawFramesLeft == 0)
+		{
+			_stagedFrame.resize(_transferChunk->GetFrameSize());
+			_stagedBytes = 0;
+			_isStaged = true;
+		}
+		else
+		{
+			if(_rawFramesLeft)
+				--_rawFramesLeft;
+			AcquireFrame();
+		}
+	}
+
+	if(_isStaged && _status == TransferStreamStatus::STREAMING)
+	{
+		countBytes = _stagedFrame.size() - _stagedBytes;
+		return _stagedFrame.data() + _stagedBytes;
+	}
+
+	if(!_frame)
+	{
+		countBytes = 0;
+		return nullptr;
+	}
+
+	countBytes = _transferChunk->GetFrameSize() - _frame->_countBytes;
+	return _frame->GetData() + _frame->_countBytes;
+}
+
+void TransferStreamWriter::Commit(size_t countBytes)
+{
+	if(_isStaged)
+	{
+		_stagedBytes += static_cast<uint32_t>(countBytes);
+		if(_stagedBytes == _stagedFrame.size())
+			PublishFrame();
+		return;
+	}
+
+	_frame->_countBytes += static_cast<uint32_t>(countBytes);
+	if(_frame->_countBytes == _transferChunk->GetFrameSize())
+		PublishFrame();
+}
+
+bool TransferStreamWriter::Write(const void* data, size_t countBytes)
+{
+	const uint8_t* source = static_cast<const uint8_t*>(data);
+	while(countBytes)
+	{
+		size_t availableBytes = 0;
+		uint8_t* destination = Reserve(availableBytes);
+		if(!destination)
+			return false;
+
+		availableBytes = std::min(availableBytes, countBytes);
+		memcpy(destination, source, availableBytes);
+		Commit(availableBytes);
+		source += availableBytes;
+		countBytes -= availableBytes;
+	}
+	return true;
+}
+
+void TransferStreamWriter::Flush()
+{
+	//	a partial frame goes out as it is, the stream goes on in the next one
+	PublishFrame();
+	WakeReader();
+}
+
+void TransferStreamWriter::PublishFrame()
+{
+	const uint8_t* rawData = nullptr;
+	uint32_t rawBytes = 0;
+	if(_isStaged)
+	{
+		_isStaged = false;
+		if(!_stagedBytes || !AcquireFrame())
+			return;
+
+		PackStagedFrame();
+		rawData = _stagedFrame.data();
+		rawBytes = _stagedBytes;
+	}
+	else if(_frame)
+	{
+		_frame->_codec = CompressionCodec::NONE;
+		_frame->_rawBytes = _frame->_countBytes;
+		rawData = _frame->GetData();
+		rawBytes = _frame->_countBytes;
+	}
+
+	if(!_frame)
+		return;
+
+	if(rawBytes)
+	{
+		_streamChecksum = Crc32c::Update(_streamChecksum, rawData, rawBytes);
+		_frame->_checksum = _streamChecksum;
+		_frame->_publishNanoseconds = getMonotonicNanoseconds();
+		_transferChunk->PublishWriteFrame();
+		if(++_batchFrames >= _batchLimit || _transferChunk->IsReaderWaiting())
+			WakeReader();
+	}
+	_frame = nullptr;
+}
+
+void TransferStreamWriter::WakeReader()
+{
+	if(!_batchFrames)
+		return;
+
+	//	a sleeping reader keeps up with the client, a busy one gets larger batches
+	const uint32_t maxBatchFrames = std::max(_transferChunk->_slotCount / 2, 1u);
+	if(_transferChunk->IsReaderWaiting())
+		_batchLimit = std::max(_batchLimit / 2, 1u);
+	else if(_batchFrames >= _batchLimit)
+		_batchLimit = std::min(_batchLimit * 2, maxBatchFrames);
+
+	if(_metrics)
+		_metrics->_framesPerWakeupHistogram.Record(_batchFrames);
+	_transferChunk->NotifyReader();
+	_batchFrames = 0;
+}
+
+void TransferStreamWriter::PackStagedFrame()
+{
+	//	a frame has to shrink by an eighth at least to be worth expanding on the other side
+	uint8_t* slotData = _frame->GetData();
+	bool isWorthCompressing = _isCompressible;
+	if(!isWorthCompressing)
+	{
+		const size_t sampleBytes = std::min<size_t>(_stagedBytes, COMPRESSION_SAMPLE_SIZE);
+		isWorthCompressing = Compression::Compress(_codec, _compressionLevel, _stagedFrame.data(), sampleBytes,
+												slotData, sampleBytes - sampleBytes / COMPRESSION_MIN_GAIN_DIVISOR) != 0;
+	}
+
+	const size_t packedBytes = isWorthCompressing
+								? Compression::Compress(_codec, _compressionLevel, _stagedFrame.data(), _stagedBytes,
+														slotData, _stagedBytes - _stagedBytes / COMPRESSION_MIN_GAIN_DIVISOR)
+								: 0;
+	_isCompressible = packedBytes != 0;
+	if(_isCompressible)
+	{
+		_frame->_codec = _codec;
+		_frame->_countBytes = static_cast<uint32_t>(packedBytes);
+		_backoffFrames = 0;
+		if(_metrics)
+			_metrics->_compressionSavedBytes.Add(_stagedBytes - packedBytes);
+	}
+	else
+	{
+		memcpy(slotData, _stagedFrame.data(), _stagedBytes);
+		_frame->_codec = CompressionCodec::NONE;
+		_frame->_countBytes = _stagedBytes;
+		_backoffFrames = std::min(std::max(_backoffFrames * 2, 1u), COMPRESSION_MAX_BACKOFF_FRAMES);
+		_rawFramesLeft = _backoffFrames;
+	}
+	_frame->_rawBytes = _stagedBytes;
+}
+
+void TransferStreamWriter::Finish(bool isCompleted)
+{
+	Flush();
+	isCompleted &= _status == TransferStreamStatus::STREAMING;
+	_transferChunk->_streamChecksum = _streamChecksum;
+	_transferChunk->FinishTransfer(isCompleted);
+	if(_status == TransferStreamStatus::STREAMING)
+		_status = isCompleted ? TransferStreamStatus::FINISHED : TransferStreamStatus::ABORTED;
+}
+
+TransferStreamStatus TransferStreamWriter::GetStatus() const
+{
+	return _status;
+}
+
+TransferStreamReader::TransferStreamReader(TransferChunk* transferChunk, SharedMemoryMetrics* metrics)
+	: _transferChunk(transferChunk)
+	, _metrics(metrics)
+{
+}
+
+TransferStreamReader::~TransferStreamReader()
+{
+	//	a loan in a slot must not outlive the chunk
+	WaitForLoans();
+}
+
+const uint8_t* TransferStreamReader::Peek(size_t& countBytes)
+{
+	while(!_frameData && _status == TransferStreamStatus::STREAMING)
+	{
+		_frame = _transferChunk->GetReadFrame();
+		if(_frame)
+		{
+			if(_metrics)
+				_metrics->_handoffLatencyHistogram.Record(getMonotonicNanoseconds() - _frame->_publishNanoseconds);
+			if(!UnpackFrame())
+			{
+				_status = TransferStreamStatus::CORRUPTED;
+				break;
+			}
+			if(_metrics)
+			{
+				_metrics->_bytesTransferred.Add(_frameBytes);
+				_metrics->_framesTransferred.Add(1);
+			}
+			break;
+		}
+
+		TransferChunkStatus transferStatus = _transferChunk->GetTransferStatus();
+		if (transferStatus == TransferChunkStatus::TRANSFER_IS_FINISHED
+			|| transferStatus == TransferChunkStatus::TRANSFER_IS_ABORTED)
+		{
+			//	the last frames may have been published right before the status
+			if(_transferChunk->GetReadFrame())
+				continue;
+			_status = transferStatus == TransferChunkStatus::TRANSFER_IS_FINISHED
+						? TransferStreamStatus::FINISHED
+						: TransferStreamStatus::ABORTED;
+			if(_status == TransferStreamStatus::FINISHED && _transferChunk->_streamChecksum != _streamChecksum)
+			{
+				TRACE_ERROR("Stream checksum mismatch: %08x instead of %08x\n", _streamChecksum, _transferChunk->_streamChecksum);
+				_status = TransferStreamStatus::CORRUPTED;
+				if(_metrics)
+					_metrics->_checksumFailures.Add(1);
+			}
+			break;
+		}
+
+		//	the ring is empty: sleep until the client publishes a frame
+		const uint64_t waitStartNanoseconds = getMonotonicNanoseconds();
+		bool isWaited = _transferChunk->WaitForReadFrame(HEARTBEAT_INTERVAL_MILLISECONDS);
+		if(_metrics)
+			_metrics->_consumerWaitNanoseconds.Add(getMonotonicNanoseconds() - waitStartNanoseconds);
+		if(!isWaited && !_transferChunk->_producerHeartbeat.IsAlive())
+		{
+			TRACE_ERROR("Client doesn't respond. Thread will be terminated\n");
+			_status = TransferStreamStatus::TIMED_OUT;
+			if(_metrics)
+				_metrics->_timeoutStrikes.Add(1);
+		}
+	}
+
+	if(!_frameData || _status != TransferStreamStatus::STREAMING)
+	{
+		countBytes = 0;
+		return nullptr;
+	}
+
+	countBytes = _frameBytes - _frameOffset;
+	return _frameData + _frameOffset;
+}
+
+void TransferStreamReader::Consume(size_t countBytes)
+{
+	_frameOffset += static_cast<uint32_t>(countBytes);
+	if(_frameOffset == _frameBytes)
+		ReleaseFrame();
+}
+
+uint32_t TransferStreamReader::PeekFrames(struct iovec* vectors, uint32_t maxVectors)
+{
+	size_t countBytes = 0;
+	const uint8_t* source = Peek(countBytes);
+	if(!source || maxVectors == 0)
+		return 0;
+
+	vectors[0].iov_base = const_cast<uint8_t*>(source);
+	vectors[0].iov_len = countBytes;
+
+	//	the raw frames published behind a raw one are verified and handed out in place; a compressed or
+	//	a corrupted one is left for Peek()
+	uint32_t countVectors = 1;
+	while(_frame && countVectors < maxVectors)
+	{
+		const TransferFrame* frame = _transferChunk->GetReadFrame(countVectors);
+		if(!frame || frame->_codec != CompressionCodec::NONE)
+			break;
+
+		const uint32_t checksum = Crc32c::Update(_streamChecksum, frame->GetData(), frame->_countBytes);
+		if(checksum != frame->_checksum)
+			break;
+
+		_streamChecksum = checksum;
+		if(_metrics)
+		{
+			_metrics->_handoffLatencyHistogram.Record(getMonotonicNanoseconds() - frame->_publishNanoseconds);
+			_metrics->_bytesTransferred.Add(frame->_countBytes);
+			_metrics->_framesTransferred.Add(1);
+		}
+		vectors[countVectors].iov_base = const_cast<uint8_t*>(frame->GetData());
+		vectors[countVectors].iov_len = frame->_countBytes;
+		++countVectors;
+	}
+	_gatheredFrames = countVectors - 1;
+	return countVectors;
+}
+
+void TransferStreamReader::ConsumeFrames()
+{
+	if(_frame)
+		ReleaseRingFrames(1 + _gatheredFrames);
+	_frameData = nullptr;
+	_gatheredFrames = 0;
+}
+
+bool TransferStreamReader::Read(void* data, size_t countBytes)
+{
+	uint8_t* destination = static_cast<uint8_t*>(data);
+	while(countBytes)
+	{
+		size_t availableBytes = 0;
+		const uint8_t* source = Peek(availableBytes);
+		if(!source)
+			return false;
+
+		availableBytes = std::min(availableBytes, countBytes);
+		memcpy(destination, source, availableBytes);
+		Consume(availableBytes);
+		destination += availableBytes;
+		countBytes -= availableBytes;
+	}
+	return true;
+}
+
+bool TransferStreamReader::UnpackFrame()
+{
+	const uint32_t expectedChecksum = _frame->_checksum;
+	const uint8_t* frameData = _frame->GetData();
+	uint32_t frameBytes = _frame->_countBytes;
+	if(_frame->_codec != CompressionCodec::NONE)
+	{
+		const uint32_t rawBytes = _frame->_rawBytes;
+		_unpackedFrame.resize(_transferChunk->GetFrameSize());
+		if(rawBytes > _unpackedFrame.size()
+			|| !Compression::Decompress(_frame->_codec, frameData, frameBytes, _unpackedFrame.data(), rawBytes))
+		{
+			TRACE_ERROR("Frame decompression failed: %u bytes of %s\n", frameBytes, Compression::GetName(_frame->_codec));
+			if(_metrics)
+				_metrics->_checksumFailures.Add(1);
+			return false;
+		}
+
+		//	the slot goes back to the client before the frame is written out
+		ReleaseRingFrames(1);
+		frameData = _unpackedFrame.data();
+		frameBytes = rawBytes;
+	}
+
+	const uint32_t checksum = Crc32c::Update(_streamChecksum, frameData, frameBytes);
+	if(checksum != expectedChecksum)
+	{
+		TRACE_ERROR("Frame checksum mismatch: %08x instead of %08x\n", checksum, expectedChecksum);
+		if(_metrics)
+			_metrics->_checksumFailures.Add(1);
+		return false;
+	}
+
+	_streamChecksum = checksum;
+	_frameData = frameData;
+	_frameBytes = frameBytes;
+	_frameOffset = 0;
+	return true;
+}
+
+void TransferStreamReader::ReleaseFrame()
+{
+	if(_frame)
+		ReleaseRingFrames(1);
+	_frameData = nullptr;
+}
+
+void TransferStreamReader::ReleaseRingFrames(uint32_t countFrames)
+{
+	_frame = nullptr;
+	if(!_isLending)
+	{
+		_transferChunk->ReleaseReadFrames(countFrames);
+		return;
+	}
+
+	//	the slots go back at once unless a lent frame is ahead of them
+	boost::lock_guard<boost::mutex> lock(_loanMutex);
+	for(uint32_t i = 0; i < countFrames; ++i)
+		_transferChunk->TakeReadFrame();
+	_ringSequence += countFrames;
+	if(_takenFrames.empty())
+		_transferChunk->ReleaseTakenFrames(countFrames);
+	else
+		_takenFrames.insert(_takenFrames.end(), countFrames, false);
+}
+
+std::unique_ptr<FrameLoan> TransferStreamReader::Lend(uint32_t maxLoans)
+{
+	if(!_frameData)
+		return nullptr;
+
+	boost::unique_lock<boost::mutex> lock(_loanMutex);
+	_isLending = true;
+	_cvLoanReturned.wait(lock, [&] { return _countLoans < std::max<uint32_t>(maxLoans, 1); });
+	++_countLoans;
+
+	const uint8_t* data = _frameData + _frameOffset;
+	const size_t countBytes = _frameBytes - _frameOffset;
+	std::unique_ptr<FrameLoan> loan;
+	if(_frame)
+	{
+		//	a raw frame is lent in its slot, which stays taken until the loan comes back
+		_transferChunk->TakeReadFrame();
+		_takenFrames.push_back(true);
+		loan.reset(new FrameLoan(*this, data, countBytes, _ringSequence++, std::vector<uint8_t>()));
+	}
+	else
+	{
+		//	an expanded frame is lent with its buffer, the next one is expanded into a spare
+		loan.reset(new FrameLoan(*this, data, countBytes, 0, std::move(_unpackedFrame)));
+		_unpackedFrame.clear();
+		if(!_spareBuffers.empty())
+		{
+			_unpackedFrame.swap(_spareBuffers.back());
+			_spareBuffers.pop_back();
+		}
+	}
+	_frame = nullptr;
+	_frameData = nullptr;
+	return loan;
+}
+
+void TransferStreamReader::WaitForLoans()
+{
+	boost::unique_lock<boost::mutex> lock(_loanMutex);
+	_cvLoanReturned.wait(lock, [&] { return _countLoans == 0; });
+}
+
+void TransferStreamReader::Return(FrameLoan& loan)
+{
+	boost::lock_guard<boost::mutex> lock(_loanMutex);
+	if(loan._buffer.empty())
+	{
+		//	the tail moves over every returned frame up to the oldest one still lent
+		_takenFrames[loan._ringSequence - (_ringSequence - static_cast<uint32_t>(_takenFrames.size()))] = false;
+		uint32_t countFrames = 0;
+		while(!_takenFrames.empty() && !_takenFrames.front())
+		{
+			_takenFrames.pop_front();
+			++countFrames;
+		}
+		if(countFrames)
+			_transferChunk->ReleaseTakenFrames(countFrames);
+	}
+	else
+		_spareBuffers.push_back(std::move(loan._buffer));
+
+	--_countLoans;
+	_cvLoanReturned.notify_all();
+}
+
+void TransferStreamReader::Close()
+{
+	//	a stream that hasn't finished is rejected whatever ended it, so a client that stalled past
+	//	the timeout stops once the ring is full rather than wait for a chunk that is given back
+	if(_status == TransferStreamStatus::FINISHED)
+		return;
+	_transferChunk->Reject();
+	if(_status != TransferStreamStatus::STREAMING && _status != TransferStreamStatus::CORRUPTED)
+		return;
+
+	//	the receiver gave up early: the frames in flight are dropped, so the chunk isn't released
+	//	while the client still writes into it
+	ReleaseFrame();
+
+	while(true)
+	{
+		_frame = _transferChunk->GetReadFrame();
+		if(_frame)
+		{
+			ReleaseRingFrames(1);
+			continue;
+		}
+
+		TransferChunkStatus transferStatus = _transferChunk->GetTransferStatus();
+		if(transferStatus == TransferChunkStatus::TRANSFER_IS_FINISHED
+			|| transferStatus == TransferChunkStatus::TRANSFER_IS_ABORTED)
+			break;
+
+		if(!_transferChunk->WaitForReadFrame(HEARTBEAT_INTERVAL_MILLISECONDS) && !_transferChunk->_producerHeartbeat.IsAlive())
+			break;
+	}
+}
+
+TransferStreamStatus TransferStreamReader::GetStatus() const
+{
+	return _status;
+}
+
+FrameLoan::FrameLoan(TransferStreamReader& reader, const uint8_t* data, size_t countBytes, uint32_t ringSequence, std::vector<uint8_t>&& buffer)
+	: _reader(&reader)
+	, _data(data)
+	, _countBytes(countBytes)
+	, _ringSequence(ringSequence)
+	, _buffer(std::move(buffer))
+{
+}
+
+FrameLoan::~FrameLoan()
+{
+	Release();
+}
+
+const uint8_t* FrameLoan::GetData() const
+{
+	return _data;
+}
+
+size_t FrameLoan::GetSize() const
+{
+	return _countBytes;
+}
+
+void FrameLoan::Release()
+{
+	if(!_reader)
+		return;
+
+	TransferStreamReader* reader = _reader;
+	_reader = nullptr;
+	reader->Return(*this);
+}